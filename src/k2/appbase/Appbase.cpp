@@ -37,15 +37,43 @@ int App::start(int argc, char** argv) {
     k2::RPCProtocolFactory::Dist_t tcpproto;
     k2::RPCProtocolFactory::Dist_t rrdmaproto;
     k2::RPCProtocolFactory::Dist_t autoproto;
+    k2::RPCProtocolFactory::Dist_t smpproto;
+    k2::RPCProtocolFactory::Dist_t udpproto;
     k2::Prometheus prometheus;
     MultiAddressProvider addrProvider;
     RPCProtocolFactory::BuilderFunc_t tcpProtobuilder;
+    MultiAddressProvider udpAddrProvider;
+    RPCProtocolFactory::BuilderFunc_t udpProtobuilder;
 
     addOptions()
     ("prometheus_port", bpo::value<uint16_t>()->default_value(8089), "HTTP port for the prometheus server")
     ("tcp_port", bpo::value<uint16_t>(), "If specified, this TCP port will be opened on all shards (kernel-based incoming connection load-balancing via shared bind on same port from multiple listeners. Conflicts with --tcp_endpoints")
     ("tcp_endpoints", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of TCP listening endpoints to assign to each core. You can specify either full endpoints, e.g. 'tcp+k2rpc://192.168.1.2:12345' or just ports , e.g. '12345'. If simple ports are specified, the stack will bind to 0.0.0.0. Conflicts with --tcp_port")
     ("enable_tx_checksum", bpo::value<bool>()->default_value(false), "enables transport-level checksums (and validation) on all messages. it incurs double - read penalty(data is read separately to compute checksum)")
+    ("tx_compression_threshold", bpo::value<uint32_t>()->default_value(0), "LZ4-compress outgoing TCP/RDMA payloads of at least this many bytes, once the peer has shown it can decompress them. 0(default) disables compression of outgoing payloads")
+    ("enable_smp_rpc", bpo::value<bool>()->default_value(true), "enables the cross-core transport for endpoints within the same process(smp+k2rpc)")
+    ("enable_udp_rpc", bpo::value<bool>()->default_value(false), "enables the datagram transport(udp+k2rpc) for small idempotent messages. Without --udp_endpoints, each core only gets a client-mode channel")
+    ("udp_endpoints", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of UDP listening endpoints to assign to each core, in the same form as --tcp_endpoints. Requires --enable_udp_rpc")
+    ("udp_max_datagram_size", bpo::value<uint32_t>(), "The largest message(default 8192 bytes) sent over UDP. Larger messages are dropped")
+    ("udp_retransmit_interval", bpo::value<k2::ParseableDuration>(), "How often requests sent over UDP are sent again until a reply arrives, as chrono literals(default 10ms)")
+    ("tcp_max_batch_bytes", bpo::value<uint32_t>(), "Outgoing TCP messages produced within one task quota are written out as one batch. Batches reaching this size(default 64KB) are written right away. Use 0 to disable batching")
+    ("tcp_max_queued_bytes", bpo::value<uint64_t>(), "Send budget per TCP channel, in bytes(default 32MB). Requests to a channel over budget wait until the channel drains")
+    ("tcp_max_queued_messages", bpo::value<uint32_t>(), "Send budget per TCP channel, in messages(default 64K). Requests to a channel over budget wait until the channel drains")
+    ("tcp_conns_per_endpoint", bpo::value<uint32_t>(), "Number of TCP connections(default 1) opened to each remote endpoint. Requests are spread over the connections, other messages use the first one")
+    ("tcp_stripe_policy", bpo::value<k2::String>(), "How requests are spread over the connections to an endpoint: round_robin(default) or least_queued")
+    ("rpc_timeout_tick", bpo::value<k2::ParseableDuration>(), "Resolution of the timer wheel used to expire outstanding RPC requests, as chrono literals(default 1ms)")
+    ("payload_pool_max_bytes", bpo::value<uint64_t>(), "The most memory(default 16MB) each core keeps in its pool of free payload buffers for reuse")
+    ("rpc_compact_verbs", bpo::value<std::vector<int>>()->multitoken(), "A list(space-delimited) of verbs whose RPC requests and replies use the compact payload encoding(varints, delta-encoded timestamps), with peers which support it")
+    ("tso_prefer_udp", bpo::value<bool>(), "The TSO client talks to the TSO workers over UDP when they offer it. Needs --enable_udp_rpc")
+    ("tso_min_batch_size", bpo::value<uint16_t>(), "The smallest timestamp batch(default 4) the TSO client asks for. The batch size follows the request rate")
+    ("tso_max_batch_size", bpo::value<uint16_t>(), "The largest timestamp batch(default 32) the TSO client asks for")
+    ("tso_enable_prefetch", bpo::value<bool>(), "The TSO client requests the next timestamp batch before the current one runs out or expires(default true)")
+    ("tso_endpoints", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of more TSO servers for the TSO client to use together with --tso_endpoint")
+    ("tso_hedge_percentile", bpo::value<uint32_t>(), "The TSO client sends a batch request to a second worker once it takes longer than this percentile of recent batch latencies(default 95, 0 to disable)")
+    ("tso_worker_backoff", bpo::value<k2::ParseableDuration>(), "How long the TSO client avoids a worker after it failed, doubled with each failure in a row(default 100ms)")
+    ("tso_proxy_group_size", bpo::value<uint32_t>(), "Share timestamp batches between groups of this many cores. The first core of each group gets the batches from the TSO server and hands out slices to the others(default 0, disabled)")
+    ("tso_proxy_batch_size", bpo::value<uint16_t>(), "The smallest timestamp batch(default 64) the proxy core asks for. Needs --tso_proxy_group_size")
+    ("rpc_timeout_wheel_slots", bpo::value<uint32_t>(), "Number of slots in the RPC request timeout wheel(default 1024). Longer timeouts are handled by re-inserting into the wheel")
     //("vservers", bpo::value<std::vector<int>>()->multitoken(), "This option accepts exactly 2 integers, which specify how many virtual servers to create(1) and how many cores each server should have(2). The servers are reachable within the same process over the sim protocol, with auto-assigned names.")
     ;
 
@@ -93,6 +121,14 @@ int App::start(int argc, char** argv) {
             tcpProtobuilder = k2::TCPRPCProtocol::builder(std::ref(vnet));
         }
 
+        if (config.count("udp_endpoints")) {
+            std::vector<k2::String> udp_endpoints = config["udp_endpoints"].as<std::vector<k2::String>>();
+            udpAddrProvider = MultiAddressProvider(udp_endpoints);
+            udpProtobuilder = k2::UDPRPCProtocol::builder(std::ref(vnet), std::ref(udpAddrProvider));
+        } else {
+            udpProtobuilder = k2::UDPRPCProtocol::builder(std::ref(vnet));
+        }
+
         // call the stop() method on each object when we're about to exit. This also deletes the objects
         seastar::engine().at_exit([&] {
             K2INFO("stop config");
@@ -114,6 +150,14 @@ int App::start(int argc, char** argv) {
             K2INFO("stop rrdma");
             return rrdmaproto.stop();
         });
+        seastar::engine().at_exit([&] {
+            K2INFO("stop smpproto");
+            return smpproto.stop();
+        });
+        seastar::engine().at_exit([&] {
+            K2INFO("stop udpproto");
+            return udpproto.stop();
+        });
         seastar::engine().at_exit([&] {
             K2INFO("stop dispatcher");
             return RPCDist().stop();
@@ -171,6 +215,14 @@ int App::start(int argc, char** argv) {
                     K2INFO("create auto-rrdma proto");
                     return autoproto.start(k2::AutoRRDMARPCProtocol::builder(std::ref(vnet), std::ref(rrdmaproto)));
                 })
+                .then([&]() {
+                    K2INFO("create smp proto");
+                    return smpproto.start(k2::SMPRPCProtocol::builder(std::ref(vnet), std::ref(smpproto)));
+                })
+                .then([&]() {
+                    K2INFO("create udp proto");
+                    return udpproto.start(udpProtobuilder);
+                })
                 .then([&]() {
                     K2INFO("create dispatcher");
                     return RPCDist().start();
@@ -215,6 +267,30 @@ int App::start(int argc, char** argv) {
                     // Could register more protocols here via separate invoke_on_all calls
                     return RPCDist().invoke_on_all(&k2::RPCDispatcher::registerProtocol, seastar::ref(autoproto));
                 })
+                .then([&]() {
+                    ConfigVar<bool> enableSMP{"enable_smp_rpc"};
+                    if (!enableSMP()) {
+                        return seastar::make_ready_future();
+                    }
+                    K2INFO("start smp protocol");
+                    return smpproto.invoke_on_all(&k2::RPCProtocolFactory::start)
+                        .then([&]() {
+                            K2INFO("register smp protocol");
+                            return RPCDist().invoke_on_all(&k2::RPCDispatcher::registerProtocol, seastar::ref(smpproto));
+                        });
+                })
+                .then([&]() {
+                    ConfigVar<bool> enableUDP{"enable_udp_rpc"};
+                    if (!enableUDP()) {
+                        return seastar::make_ready_future();
+                    }
+                    K2INFO("start udp protocol");
+                    return udpproto.invoke_on_all(&k2::RPCProtocolFactory::start)
+                        .then([&]() {
+                            K2INFO("register udp protocol");
+                            return RPCDist().invoke_on_all(&k2::RPCDispatcher::registerProtocol, seastar::ref(udpproto));
+                        });
+                })
                 .then([&]() {
                     K2INFO("start dispatcher");
                     return RPCDist().invoke_on_all(&k2::RPCDispatcher::start);
@@ -39,14 +39,16 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/Discovery.h>
 #include <k2/transport/RPCProtocolFactory.h>
 #include <k2/transport/RRDMARPCProtocol.h>
+#include <k2/transport/SMPRPCProtocol.h>
 #include <k2/transport/TCPRPCProtocol.h>
+#include <k2/transport/UDPRPCProtocol.h>
 #include <k2/transport/VirtualNetworkStack.h>
 
 #include "AppEssentials.h"
 
 namespace k2 {
 
-// Helper class used to provide listening addresses for the TCP protocol
+// Helper class used to provide listening addresses for the TCP and UDP protocols
 class MultiAddressProvider : public k2::IAddressProvider {
    public:
     MultiAddressProvider() = default;
@@ -28,6 +28,7 @@ int main(int argc, char** argv) {
     k2::App app("CPOService");
     app.addOptions()
         ("assignment_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for K2 partition assignment")
+        ("assignment_parallelism", bpo::value<uint32_t>(), "The most partition assignments of a collection in flight at a time(default 64)")
         ("heartbeat_deadline", bpo::value<k2::ParseableDuration>(), "K2 Txn heartbeat deadline")
         ("data_dir", bpo::value<k2::String>(), "The directory where we can keep data");
     app.addApplet<k2::CPOService>([]() mutable -> seastar::distributed<k2::CPOService>& {
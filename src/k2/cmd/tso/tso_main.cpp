@@ -28,6 +28,10 @@ int main(int argc, char** argv)
     k2::App app("TSOService");
 
     app.addApplet<k2::TSOService>();
+    app.addOptions()
+        ("tso_inject_delay", bpo::value<k2::ParseableDuration>(), "Testing only: delay every timestamp batch reply by this much, as chrono literals(default 0)")
+        ("tso.ctrol_target_worker_batch_rate", bpo::value<uint64_t>(), "Batch requests per second a worker should get at most(default 200000). Above that, the workers suggest larger batches to the clients")
+        ("tso.worker_max_tracked_clients", bpo::value<size_t>(), "How many clients a worker tracks the request rate of, for its batch size suggestions(default 10000)");
 
     return app.start(argc, argv);
 }
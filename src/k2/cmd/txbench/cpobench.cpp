@@ -0,0 +1,173 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <algorithm>
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/cpo/client/CPOClient.h>
+#include <k2/dto/AssignmentManager.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/transport/TCPRPCProtocol.h>
+
+#include <seastar/core/sleep.hh>
+
+// Measures how long the CPO takes to create a collection and assign all of its partitions, for each of the
+// partition counts in --partition_counts.
+// This process also plays the nodes: every core accepts any partition assignment after --assignment_delay,
+// and the partitions are spread over the endpoints of all cores, many to a core. Core 0 creates the collections.
+class CPOBench {
+public:  // application lifespan
+    CPOBench() {
+        K2INFO("ctor");
+    }
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2INFO("stopping");
+        return std::move(_benchFut);
+    }
+
+    seastar::future<> start() {
+        k2::RPC().registerRPCObserver<k2::dto::AssignmentCreateRequest, k2::dto::AssignmentCreateResponse>
+        (k2::dto::Verbs::K2_ASSIGNMENT_CREATE, [this](k2::dto::AssignmentCreateRequest&& request) {
+            return _handleAssign(std::move(request));
+        });
+        if (seastar::engine().cpu_id() != 0) {
+            return seastar::make_ready_future();
+        }
+        K2INFO("Starting benchmark" <<
+            ", with cores=" << seastar::smp::count <<
+            ", with rounds=" << _rounds() <<
+            ", with assignmentDelay=" << _assignmentDelay());
+
+        _cpo = k2::CPOClient(_cpoURL());
+        _benchFut = seastar::sleep(_startDelay())
+        .then([] {
+            return k2::AppBase().getDist<CPOBench>().map_reduce0(
+                [](CPOBench&) { return std::vector<k2::String>{k2::RPC().getServerEndpoint(k2::TCPRPCProtocol::proto)->getURL()}; },
+                std::vector<k2::String>(),
+                [](std::vector<k2::String> all, std::vector<k2::String> one) {
+                    all.insert(all.end(), one.begin(), one.end());
+                    return all;
+                });
+        })
+        .then([this](std::vector<k2::String>&& coreEndpoints) {
+            _coreEndpoints = std::move(coreEndpoints);
+            return seastar::do_for_each(_partitionCounts(), [this](uint32_t partitions) {
+                return _benchPartitionCount(partitions);
+            });
+        })
+        .handle_exception([](auto exc) {
+            K2ERROR_EXC("Unable to execute benchmark", exc);
+        })
+        .finally([] {
+            K2INFO("Done with benchmark");
+            seastar::engine().exit(0);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    // the nodes' side: accept the assignment, the way the AssignmentManager of a node does
+    seastar::future<std::tuple<k2::Status, k2::dto::AssignmentCreateResponse>>
+    _handleAssign(k2::dto::AssignmentCreateRequest&& request) {
+        return seastar::sleep(_assignmentDelay()).then([request=std::move(request)] () mutable {
+            request.partition.astate = k2::dto::AssignmentState::Assigned;
+            request.partition.endpoints = {k2::RPC().getServerEndpoint(k2::TCPRPCProtocol::proto)->getURL()};
+            k2::dto::AssignmentCreateResponse resp{.assignedPartition = std::move(request.partition)};
+            return k2::RPCResponse(k2::Statuses::S201_Created("assignment accepted"), std::move(resp));
+        });
+    }
+
+    // create _rounds() collections with this many partitions, one after the other, and report the create times
+    seastar::future<> _benchPartitionCount(uint32_t partitions) {
+        return seastar::do_with(std::vector<k2::Duration>(), [this, partitions](auto& times) {
+            return seastar::do_until(
+                [this, &times] { return times.size() >= _rounds(); },
+                [this, partitions, &times] {
+                    auto start = k2::Clock::now();
+                    return _createCollection(partitions).then([start, &times](k2::Status&& status) {
+                        if (!status.is2xxOK()) {
+                            throw std::runtime_error("unable to create collection: " + status.message);
+                        }
+                        times.push_back(k2::Clock::now() - start);
+                    });
+                })
+            .then([partitions, &times] {
+                if (times.empty()) {
+                    return;
+                }
+                std::sort(times.begin(), times.end());
+                k2::Duration total{0};
+                for (auto& t: times) {
+                    total += t;
+                }
+                K2INFO("Created " << times.size() << " collections with " << partitions << " partitions"
+                        << ", create time(ms): min=" << k2::msec(times.front()).count()
+                        << ", avg=" << k2::msec(total / times.size()).count()
+                        << ", max=" << k2::msec(times.back()).count());
+            });
+        });
+    }
+
+    seastar::future<k2::Status> _createCollection(uint32_t partitions) {
+        std::vector<k2::String> endpoints;
+        for (uint32_t i = 0; i < partitions; ++i) {
+            endpoints.push_back(_coreEndpoints[i % _coreEndpoints.size()]);
+        }
+        k2::dto::CollectionMetadata metadata{
+            .name = "cpobench_" + std::to_string(k2::nsec_count(k2::Clock::now())),
+            .hashScheme = k2::dto::HashScheme::HashCRC32C,
+            .storageDriver = k2::dto::StorageDriver::K23SI,
+            .capacity = {},
+            .retentionPeriod = 1h
+        };
+        return _cpo.CreateAndWaitForCollection(k2::Deadline<>(_createTimeout()), std::move(metadata), std::move(endpoints), std::vector<k2::String>());
+    }
+
+    k2::ConfigVar<k2::String> _cpoURL{"cpo"};
+    k2::ConfigVar<std::vector<uint32_t>> _partitionCounts{"partition_counts", {10, 100, 1000}};
+    k2::ConfigVar<uint32_t> _rounds{"rounds", 3};
+    k2::ConfigDuration _assignmentDelay{"assignment_delay", 1ms};
+    k2::ConfigDuration _createTimeout{"create_timeout", 60s};
+    k2::ConfigDuration _startDelay{"start_delay", 1s};
+
+    seastar::future<> _benchFut = seastar::make_ready_future();
+    k2::CPOClient _cpo;
+    std::vector<k2::String> _coreEndpoints;
+};  // class CPOBench
+
+int main(int argc, char** argv) {
+    k2::App app("CPOBench");
+    app.addApplet<CPOBench>();
+    app.addOptions()
+        ("partition_counts", bpo::value<std::vector<uint32_t>>()->multitoken(), "A list(space-delimited) of partition counts to create collections with(default 10 100 1000)")
+        ("rounds", bpo::value<uint32_t>(), "How many collections to create for each partition count(default 3)")
+        ("assignment_delay", bpo::value<k2::ParseableDuration>(), "How long this process takes to accept an assignment, standing in for the partition module start(default 1ms)")
+        ("create_timeout", bpo::value<k2::ParseableDuration>(), "How long to wait for a collection to be created and assigned(default 60s)")
+        ("cpo", bpo::value<k2::String>(), "URL of Control Plane Oracle (CPO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("cpo_request_timeout", bpo::value<k2::ParseableDuration>(), "CPO request timeout")
+        ("cpo_request_backoff", bpo::value<k2::ParseableDuration>(), "CPO request backoff");
+    return app.start(argc, argv);
+}
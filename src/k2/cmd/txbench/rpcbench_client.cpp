@@ -25,10 +25,28 @@ Copyright(c) 2020 Futurewei Cloud
 // stl
 #include <k2/appbase/Appbase.h>
 #include <k2/appbase/AppEssentials.h>
+#include <k2/transport/PayloadPool.h>
+#include <seastar/core/memory.hh>
 #include <seastar/core/sleep.hh>
 
 #include "rpcbench_common.h"
 
+// The allocation counters of the current core, used to report allocations per request
+struct AllocCounters {
+    uint64_t mallocs = 0;
+    uint64_t bufferAllocs = 0;
+    uint64_t payloadAllocs = 0;
+
+    static AllocCounters now() {
+        auto& poolStats = k2::PayloadPool::local().getStats();
+        return AllocCounters{
+            .mallocs = seastar::memory::stats().mallocs(),
+            .bufferAllocs = poolStats.bufferAllocs,
+            .payloadAllocs = poolStats.payloadAllocs
+        };
+    }
+};
+
 class Client {
 public:  // application lifespan
     // required for seastar::distributed interface
@@ -48,6 +66,7 @@ public:  // application lifespan
             sm::make_gauge("session_id", _session.sessionId, sm::description("Session ID"), labels),
             sm::make_counter("total_count", _session.totalCount, sm::description("Total number of requests"), labels),
             sm::make_counter("total_bytes", _session.totalSize, sm::description("Total data bytes sent"), labels),
+            sm::make_counter("error_count", _session.errorCount, sm::description("Total number of requests which failed or timed out"), labels),
             sm::make_histogram("request_latency", [this]{ return _requestLatency.getHistogram();}, sm::description("Latency of acks"), labels)
         });
     }
@@ -75,7 +94,15 @@ public:  // application lifespan
             return seastar::make_ready_future<>();
         })
         .finally([this]() {
-            K2INFO("Done with benchmark");
+            auto elapsed = k2::Clock::now() - _benchStart;
+            auto rate = _session.totalCount * 1'000'000'000.0 / std::max(k2::nsec(elapsed).count(), int64_t(1));
+            auto allocs = AllocCounters::now();
+            double requests = std::max(_session.totalCount, uint64_t(1));
+            K2INFO("Done with benchmark. requests=" << _session.totalCount << ", errors=" << _session.errorCount
+                   << ", elapsed=" << elapsed << ", rate=" << rate << " req/s"
+                   << ", mallocs/req=" << (allocs.mallocs - _benchAllocs.mallocs) / requests
+                   << ", buffer allocs/req=" << (allocs.bufferAllocs - _benchAllocs.bufferAllocs) / requests
+                   << ", payload allocs/req=" << (allocs.payloadAllocs - _benchAllocs.payloadAllocs) / requests);
         });
 
         return seastar::make_ready_future();
@@ -115,6 +142,8 @@ private:
              ", with copyData=" << _copyData() <<
              ", with testDuration=" << _testDuration());
         std::vector<seastar::future<>> reqFuts;
+        _benchStart = k2::Clock::now();
+        _benchAllocs = AllocCounters::now();
         reqFuts.push_back(seastar::sleep(_testDuration()).then([this]{_stopped = true;}));
         for (size_t i = 0; i < _pipelineDepth(); ++i) {
             for (size_t j = 0; j < _multiConn(); ++j) {
@@ -134,7 +163,12 @@ private:
                     req.sessionId = _session.sessionId;
                     auto started = k2::Clock::now();
                     return k2::RPC().callRPC<TXBenchRequest<k2::String>, TXBenchResponse<k2::Payload>>(MsgVerbs::REQUEST_COPY, req, ep, 1s)
-                    .then([this, started] (auto&&) {
+                    .then([this, started] (auto&& result) {
+                        auto& [status, resp] = result;
+                        if (!status.is2xxOK()) {
+                            _session.errorCount++;
+                            return;
+                        }
                         _session.totalCount ++;
                         _session.totalSize += _requestSize() + _responseSize();
                         _requestLatency.add(k2::Clock::now() - started);
@@ -146,7 +180,12 @@ private:
                     req.sessionId = _session.sessionId;
                     auto started = k2::Clock::now();
                     return k2::RPC().callRPC<TXBenchRequest<k2::Payload>, TXBenchResponse<k2::Payload>>(MsgVerbs::REQUEST, req, ep, 1s)
-                    .then([this, started] (auto&&) {
+                    .then([this, started] (auto&& result) {
+                        auto& [status, resp] = result;
+                        if (!status.is2xxOK()) {
+                            _session.errorCount++;
+                            return;
+                        }
                         _session.totalCount ++;
                         _session.totalSize += _requestSize() + _responseSize();
                         _requestLatency.add(k2::Clock::now() - started);
@@ -167,6 +206,8 @@ private:
     BenchSession _session;
     sm::metric_groups _metric_groups;
     k2::ExponentialHistogram _requestLatency;
+    k2::TimePoint _benchStart;
+    AllocCounters _benchAllocs;
     seastar::future<> _benchFut = seastar::make_ready_future();
     bool _stopped = true;
 }; // class Client
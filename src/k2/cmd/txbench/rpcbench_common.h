@@ -46,6 +46,7 @@ struct BenchSession {
     uint64_t sessionId = 0;
     uint64_t totalSize=0;
     uint64_t totalCount=0;
+    uint64_t errorCount=0;
     k2::Payload dataShare{[]{ return k2::Binary(1446);}};
     k2::String dataCopy;
     std::vector<std::unique_ptr<k2::TXEndpoint>> endpoints;
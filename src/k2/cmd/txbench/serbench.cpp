@@ -0,0 +1,158 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Serialization microbenchmark for the K23SI DTOs.
+// Usage: serbench [iterations]
+// For each DTO it reports the serialized size and the average time to write it to and read it back from a Payload,
+// in both the fixed-width and the compact encoding
+
+// stl
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// k2
+#include <k2/common/Chrono.h>
+#include <k2/dto/K23SI.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/RPCHeader.h>
+
+using namespace k2;
+
+// same buffer size as the TCP allocator
+static const size_t bufferSize = 8192;
+
+static dto::Key makeKey(const char* suffix) {
+    return dto::Key{.partitionKey = String("partition_key_") + suffix, .rangeKey = String("range_key_") + suffix};
+}
+
+static dto::K23SI_MTR makeMTR() {
+    // a realistic TAI time, so that the size of the compact encoding is representative
+    return dto::K23SI_MTR{.txnid = 123456789, .timestamp = dto::Timestamp(1600000000000000000ull, 1, 1000), .priority = dto::TxnPriority::Medium};
+}
+
+static Payload makeValue() {
+    Payload value([] { return Binary(bufferSize); });
+    value.write(String(100, 'v'));
+    return value;
+}
+
+// write value into a new payload and read it back, iterations times
+template <typename T>
+static void benchEncoding(const char* name, const T& value, size_t iterations, bool compact) {
+    Duration writeTime(0), readTime(0);
+    size_t size = 0;
+    bool ok = true;
+    for (size_t i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        Payload payload([] { return Binary(bufferSize); });
+        payload.setCompactEncoding(compact);
+        payload.ensureCapacity(txconstants::MAX_HEADER_SIZE + Payload::serializedSize(value));
+        payload.skip(txconstants::MAX_HEADER_SIZE);
+        payload.write(value);
+        auto written = Clock::now();
+
+        payload.seek(txconstants::MAX_HEADER_SIZE);
+        T result{};
+        ok = payload.read(result) && ok;
+        auto read = Clock::now();
+
+        writeTime += written - start;
+        readTime += read - written;
+        size = payload.getSize() - txconstants::MAX_HEADER_SIZE;
+    }
+    std::cout << std::left << std::setw(36) << name
+              << std::setw(8) << (compact ? " compact" : " fixed")
+              << " size=" << std::setw(6) << size
+              << " write=" << std::setw(8) << nsec(writeTime).count() / iterations << "ns"
+              << " read=" << std::setw(8) << nsec(readTime).count() / iterations << "ns"
+              << (ok ? "" : " READ FAILED") << std::endl;
+}
+
+template <typename T>
+static void bench(const char* name, const T& value, size_t iterations) {
+    benchEncoding(name, value, iterations, false);
+    benchEncoding(name, value, iterations, true);
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    if (iterations == 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+    const String collection("benchmark_collection");
+    const dto::Partition::PVID pvid{.id = 1, .rangeVersion = 2, .assignmentVersion = 3};
+
+    bench("K23SI_MTR", makeMTR(), iterations);
+
+    bench("K23SIReadRequest", dto::K23SIReadRequest{
+        .pvid = pvid, .collectionName = collection, .mtr = makeMTR(), .key = makeKey("read")}, iterations);
+
+    dto::K23SIReadResponse<Payload> readResponse;
+    readResponse.value.val = makeValue();
+    bench("K23SIReadResponse<Payload>", readResponse, iterations);
+
+    dto::K23SIWriteRequest<Payload> writeRequest{
+        .pvid = pvid, .collectionName = collection, .mtr = makeMTR(), .trh = makeKey("trh"),
+        .isDelete = false, .designateTRH = true, .key = makeKey("write"), .value = {}};
+    writeRequest.value.val = makeValue();
+    bench("K23SIWriteRequest<Payload>", writeRequest, iterations);
+    bench("K23SIWriteResponse", dto::K23SIWriteResponse{}, iterations);
+
+    bench("K23SITxnHeartbeatRequest", dto::K23SITxnHeartbeatRequest{
+        .pvid = pvid, .collectionName = collection, .key = makeKey("trh"), .mtr = makeMTR()}, iterations);
+    bench("K23SITxnHeartbeatResponse", dto::K23SITxnHeartbeatResponse{}, iterations);
+
+    dto::K23SI_PersistenceRequest<Payload> persistenceRequest;
+    persistenceRequest.value.val = makeValue();
+    bench("K23SI_PersistenceRequest<Payload>", persistenceRequest, iterations);
+    bench("K23SI_PersistenceResponse", dto::K23SI_PersistenceResponse{}, iterations);
+    bench("K23SI_PersistenceRecoveryRequest", dto::K23SI_PersistenceRecoveryRequest{}, iterations);
+    bench("K23SI_PersistencePartialUpdate", dto::K23SI_PersistencePartialUpdate{}, iterations);
+
+    bench("K23SITxnPushRequest", dto::K23SITxnPushRequest{
+        .pvid = pvid, .collectionName = collection, .key = makeKey("trh"),
+        .incumbentMTR = makeMTR(), .challengerMTR = makeMTR()}, iterations);
+    bench("K23SITxnPushResponse", dto::K23SITxnPushResponse{.winnerMTR = makeMTR()}, iterations);
+
+    dto::K23SITxnEndRequest endRequest{
+        .pvid = pvid, .collectionName = collection, .key = makeKey("trh"), .mtr = makeMTR(),
+        .action = dto::EndAction::Commit, .writeKeys = {}, .syncFinalize = false};
+    for (int i = 0; i < 10; ++i) {
+        endRequest.writeKeys.push_back(makeKey(std::to_string(i).c_str()));
+    }
+    bench("K23SITxnEndRequest(10 keys)", endRequest, iterations);
+    bench("K23SITxnEndResponse", dto::K23SITxnEndResponse{}, iterations);
+
+    bench("K23SITxnFinalizeRequest", dto::K23SITxnFinalizeRequest{
+        .pvid = pvid, .collectionName = collection, .trh = makeKey("trh"), .mtr = makeMTR(),
+        .key = makeKey("write"), .action = dto::EndAction::Commit}, iterations);
+    bench("K23SITxnFinalizeResponse", dto::K23SITxnFinalizeResponse{}, iterations);
+
+    // every response is preceded by a status. Only the error messages go on the wire
+    bench("Status(OK)", dto::K23SIStatus::OK("read succeeded"), iterations);
+    bench("Status(error)", dto::K23SIStatus::AbortConflict("incumbent txn won in write push"), iterations);
+    return 0;
+}
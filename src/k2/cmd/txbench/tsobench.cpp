@@ -0,0 +1,274 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <random>
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/transport/Prometheus.h>
+#include <k2/tso/client_lib/tso_clientlib.h>
+
+#include <seastar/core/gate.hh>
+#include <seastar/core/sleep.hh>
+
+// Measures how many timestamps per second the TSO clients on all cores get from the TSO servers, and the latency of each.
+// By default every core runs pipeline_depth sessions, each asking for one timestamp at a time(closed loop).
+// With --arrival_rate, every core asks for timestamps at that rate instead, whether earlier requests came back or not(open loop),
+// and the latency counts from when a request was due, so that a slow server can't hide it by slowing the benchmark down.
+// Core 0 reports the totals of all cores at the end.
+// Run it once with the defaults and once with --enable_udp_rpc --tso_prefer_udp to compare TCP against UDP
+class Client {
+public:  // types
+    // what one core saw
+    struct Result {
+        uint64_t timestamps = 0;
+        uint64_t failedTimestamps = 0;
+        uint64_t droppedArrivals = 0;
+        k2::TSO_ClientLib::Stats tsoStats;
+        k2::ExponentialHistogram latency;
+    };
+
+public:  // application lifespan
+    Client() {
+        K2INFO("ctor");
+    }
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2INFO("stopping");
+        _stopped = true;
+        return std::move(_benchFut);
+    }
+
+    seastar::future<> start() {
+        registerMetrics();
+        if (seastar::engine().cpu_id() != 0) {
+            // core 0 runs the benchmark on all cores
+            return seastar::make_ready_future();
+        }
+        K2INFO("Starting benchmark" <<
+            ", with cores=" << seastar::smp::count <<
+            ", with pipelineDepth=" << _pipelineDepth() <<
+            ", with arrivalRate=" << _arrivalRate() <<
+            ", with testDuration=" << _testDuration() <<
+            ", with preferUDP=" << _preferUDP());
+
+        // give the TSO client time to discover the server workers
+        _benchFut = seastar::sleep(_startDelay())
+        .then([] {
+            return k2::AppBase().getDist<Client>().invoke_on_all(&Client::_run);
+        })
+        .then([] {
+            return k2::AppBase().getDist<Client>().map_reduce0(
+                [](Client& client) { return client._result(); },
+                Result{},
+                [](Result total, Result one) {
+                    total.timestamps += one.timestamps;
+                    total.failedTimestamps += one.failedTimestamps;
+                    total.droppedArrivals += one.droppedArrivals;
+                    total.tsoStats.requests += one.tsoStats.requests;
+                    total.tsoStats.servedWithoutWait += one.tsoStats.servedWithoutWait;
+                    total.tsoStats.batchRequests += one.tsoStats.batchRequests;
+                    total.tsoStats.batchesReceived += one.tsoStats.batchesReceived;
+                    total.tsoStats.timestampsReceived += one.tsoStats.timestampsReceived;
+                    total.tsoStats.expiredBatches += one.tsoStats.expiredBatches;
+                    total.latency.merge(one.latency);
+                    return total;
+                });
+        })
+        .then([this](Result total) {
+            _report(total);
+        })
+        .handle_exception([](auto exc) {
+            K2ERROR_EXC("Unable to execute benchmark", exc);
+        })
+        .finally([] {
+            K2INFO("Done with benchmark");
+            seastar::engine().exit(0);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    // runs the benchmark on this core until the test duration is over
+    seastar::future<> _run() {
+        _stopped = false;
+        _start = k2::Clock::now();
+        _tsoStatsAtStart = k2::AppBase().getDist<k2::TSO_ClientLib>().local().getStats();
+        std::vector<seastar::future<>> futs;
+        futs.push_back(seastar::sleep(_testDuration()).then([this] { _stopped = true; }));
+        if (_arrivalRate() > 0) {
+            futs.push_back(_openLoop());
+        }
+        else {
+            for (size_t i = 0; i < _pipelineDepth(); ++i) {
+                futs.push_back(_startSession());
+            }
+        }
+        return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result()
+        .then([this] {
+            // the requests still outstanding in open loop
+            return _outstandingGate.close();
+        })
+        .then([this] {
+            _end = k2::Clock::now();
+        });
+    }
+
+    seastar::future<> _startSession() {
+        return seastar::do_until(
+            [this] { return _stopped; },
+            [this] {
+                auto start = k2::Clock::now();
+                return _getTimestamp(start, start);
+            });
+    }
+
+    // requests arrive at _arrivalRate per second on average, with exponentially distributed gaps
+    seastar::future<> _openLoop() {
+        return seastar::do_with(std::exponential_distribution<double>(_arrivalRate() / 1e9), std::mt19937_64(std::random_device()()),
+            k2::Clock::now(),
+            [this] (auto& gapNanos, auto& gen, auto& nextArrival) {
+            return seastar::do_until(
+                [this] { return _stopped; },
+                [this, &gapNanos, &gen, &nextArrival] {
+                    // start every request which is due by now. The timer can't wake us up for each one at high rates
+                    auto now = k2::Clock::now();
+                    while (nextArrival <= now) {
+                        if (_outstanding < _maxOutstanding()) {
+                            _outstanding++;
+                            (void) seastar::with_gate(_outstandingGate, [this, due=nextArrival, now] {
+                                return _getTimestamp(due, now).finally([this] { _outstanding--; });
+                            });
+                        }
+                        else {
+                            _droppedArrivals++;
+                        }
+                        nextArrival += std::chrono::nanoseconds(uint64_t(gapNanos(gen)));
+                    }
+                    return seastar::sleep(nextArrival - now);
+                });
+        });
+    }
+
+    // get one timestamp for a request due at the given time, asking for it now
+    seastar::future<> _getTimestamp(k2::TimePoint due, k2::TimePoint now) {
+        return k2::AppBase().getDist<k2::TSO_ClientLib>().local().GetTimestampFromTSO(now)
+            .then([this, due](auto&&) {
+                _latency.add(k2::Clock::now() - due);
+                _totalTimestamps++;
+            })
+            .handle_exception([this](auto exc) {
+                K2WARN_EXC("failed to get timestamp", exc);
+                _failedTimestamps++;
+            });
+    }
+
+    Result _result() {
+        Result result;
+        result.timestamps = _totalTimestamps;
+        result.failedTimestamps = _failedTimestamps;
+        result.droppedArrivals = _droppedArrivals;
+        auto& tsoStats = k2::AppBase().getDist<k2::TSO_ClientLib>().local().getStats();
+        result.tsoStats.requests = tsoStats.requests - _tsoStatsAtStart.requests;
+        result.tsoStats.servedWithoutWait = tsoStats.servedWithoutWait - _tsoStatsAtStart.servedWithoutWait;
+        result.tsoStats.batchRequests = tsoStats.batchRequests - _tsoStatsAtStart.batchRequests;
+        result.tsoStats.batchesReceived = tsoStats.batchesReceived - _tsoStatsAtStart.batchesReceived;
+        result.tsoStats.timestampsReceived = tsoStats.timestampsReceived - _tsoStatsAtStart.timestampsReceived;
+        result.tsoStats.expiredBatches = tsoStats.expiredBatches - _tsoStatsAtStart.expiredBatches;
+        result.latency = _latency;
+        K2INFO("Core " << seastar::engine().cpu_id() << " got " << result.timestamps << " timestamps in "
+                << k2::msec(_end - _start).count() << "ms, p99 latency=" << _latency.percentile(99) << "us");
+        return result;
+    }
+
+    void _report(Result& total) {
+        auto secs = k2::usec(_end - _start).count() / 1'000'000.0;
+        auto& tso = total.tsoStats;
+        K2INFO("Got " << total.timestamps << " timestamps(" << total.failedTimestamps << " failed, "
+                << total.droppedArrivals << " arrivals dropped over max_outstanding) in " << secs << "s on " << seastar::smp::count << " cores"
+                << ", rate=" << (secs > 0 ? total.timestamps / secs : 0) << "/s");
+        auto& hist = total.latency.getHistogram();
+        K2INFO("Latency(us): avg=" << (hist.sample_count ? hist.sample_sum / hist.sample_count : 0)
+                << ", p50=" << total.latency.percentile(50)
+                << ", p90=" << total.latency.percentile(90)
+                << ", p99=" << total.latency.percentile(99)
+                << ", p99.9=" << total.latency.percentile(99.9)
+                << ", max=" << total.latency.percentile(100));
+        K2INFO("Batches: requested=" << tso.batchRequests << ", received=" << tso.batchesReceived
+                << ", avg size=" << (tso.batchesReceived ? double(tso.timestampsReceived) / tso.batchesReceived : 0)
+                << ", timestamps unused=" << (tso.timestampsReceived > total.timestamps ? tso.timestampsReceived - total.timestamps : 0)
+                << ", expired before use=" << tso.expiredBatches
+                << ", requests served without wait=" << tso.servedWithoutWait << "/" << tso.requests);
+        K2INFO("The time requests waited on the TSO workers is in their tso_worker_parked_nanos metric");
+    }
+
+private://metrics
+    void registerMetrics() {
+        _metric_groups.clear();
+        std::vector<sm::label_instance> labels;
+        labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+        _metric_groups.add_group("session",
+        {
+            sm::make_counter("total_timestamps", _totalTimestamps, sm::description("Total number of timestamps received"), labels),
+            sm::make_counter("failed_timestamps", _failedTimestamps, sm::description("Total number of failed timestamp requests"), labels),
+            sm::make_counter("dropped_arrivals", _droppedArrivals, sm::description("Open loop requests not made since max_outstanding were outstanding"), labels),
+            sm::make_histogram("timestamp_latency", [this]{ return _latency.getHistogram();}, sm::description("Latency of getting a timestamp"), labels)
+        });
+    }
+
+    sm::metric_groups _metric_groups;
+    uint64_t _totalTimestamps = 0;
+    uint64_t _failedTimestamps = 0;
+    uint64_t _droppedArrivals = 0;
+    k2::ExponentialHistogram _latency;
+
+    k2::ConfigVar<uint32_t> _pipelineDepth{"pipeline_depth"};
+    k2::ConfigVar<uint64_t> _arrivalRate{"arrival_rate", 0};
+    k2::ConfigVar<uint64_t> _maxOutstanding{"max_outstanding", 10000};
+    k2::ConfigDuration _testDuration{"test_duration", 30s};
+    k2::ConfigDuration _startDelay{"start_delay", 2s};
+    k2::ConfigVar<bool> _preferUDP{"tso_prefer_udp", false};
+
+    seastar::future<> _benchFut = seastar::make_ready_future();
+    seastar::gate _outstandingGate;
+    uint64_t _outstanding = 0;
+    bool _stopped = true;
+    k2::TimePoint _start;
+    k2::TimePoint _end;
+    k2::TSO_ClientLib::Stats _tsoStatsAtStart;
+};  // class Client
+
+int main(int argc, char** argv) {
+    k2::App app("TSOBenchClient");
+    app.addApplet<k2::TSO_ClientLib>(0s);
+    app.addApplet<Client>();
+    app.addOptions()
+        ("pipeline_depth", bpo::value<uint32_t>()->default_value(1), "How many timestamp requests to run concurrently on each core, in closed loop")
+        ("arrival_rate", bpo::value<uint64_t>(), "Timestamp requests per second on each core, in open loop. 0(default) runs in closed loop with pipeline_depth")
+        ("max_outstanding", bpo::value<uint64_t>(), "Most open loop requests outstanding on each core(default 10000). Requests over it are counted and dropped")
+        ("test_duration", bpo::value<k2::ParseableDuration>(), "How long to run")
+        ("start_delay", bpo::value<k2::ParseableDuration>(), "How long to wait for the TSO client to discover the server before starting")
+        ("tso_endpoint", bpo::value<k2::String>(), "URL of Timestamp Oracle (TSO), e.g. 'tcp+k2rpc://192.168.1.2:12345'");
+    return app.start(argc, argv);
+}
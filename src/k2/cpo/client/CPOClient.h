@@ -61,16 +61,37 @@ public:
             auto& [status, k2response] = response;
 
             if (status == Statuses::S403_Forbidden || status.is2xxOK()) {
-                Duration s = std::min(deadline.getRemaining(), cpo_request_backoff());
-                return seastar::sleep(s).then([this, name, deadline]() -> seastar::future<Status> {
-                    return GetAssignedPartitionWithRetry(deadline, name, dto::Key{.partitionKey = "", .rangeKey = ""});
-                });
+                return WaitForCollectionAssignment(deadline, name);
             }
 
             return seastar::make_ready_future<Status>(std::move(status));
         });
     }
 
+    // Gets the collection from the CPO, which replies once it is done assigning the collection. If the partition
+    // for the empty key is still not assigned then, falls back to polling with GetAssignedPartitionWithRetry
+    template<typename ClockT=Clock>
+    seastar::future<Status> WaitForCollectionAssignment(Deadline<ClockT> deadline, const String& name) {
+        dto::CollectionGetRequest request{.name = name, .waitForAssignment = true};
+        K2DEBUG("waiting for the assignment of collection " << name << ", for up to " << deadline.getRemaining());
+        return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>(dto::Verbs::CPO_COLLECTION_GET, request, *cpo, deadline.getRemaining()).then([this, name, deadline](auto&& response) {
+            auto& [status, coll_response] = response;
+            dto::Key key{.partitionKey = "", .rangeKey = ""};
+            if (status.is2xxOK()) {
+                collections[name] = dto::PartitionGetter(std::move(coll_response.collection));
+                dto::Partition* partition = collections[name].getPartitionForKey(key).partition;
+                if (partition && partition->astate == dto::AssignmentState::Assigned) {
+                    return seastar::make_ready_future<Status>(std::move(status));
+                }
+            }
+            if (deadline.isOver()) {
+                return seastar::make_ready_future<Status>(Statuses::S408_Request_Timeout("cpo deadline exceeded"));
+            }
+            K2DEBUG("collection " << name << " not assigned after waiting, status: " << status);
+            return GetAssignedPartitionWithRetry(deadline, name, key);
+        });
+    }
+
     // Get collection info from CPO, and retry if the partition for the given key
     // is not assigned or if there was a retryable error. It allows only one outstanding
     // request for a given collection.
@@ -160,8 +181,9 @@ public:
     // partition map and retries if necessary. The caller must keep the request alive for the
     // duration of the future.
     // RequestT must have a pvid field and a collectionName field
+    // Requests with the same non-zero orderKey arrive at the partition in the order they were sent
     template<class RequestT, typename ResponseT, Verb verb, typename ClockT=Clock>
-    seastar::future<std::tuple<Status, ResponseT>> PartitionRequest(Deadline<ClockT> deadline, RequestT& request, uint8_t retries=1) {
+    seastar::future<std::tuple<Status, ResponseT>> PartitionRequest(Deadline<ClockT> deadline, RequestT& request, uint8_t retries=1, uint64_t orderKey=0) {
         K2DEBUG("making partition request with deadline=" << deadline.getRemaining());
         // If collection is not in cache or partition is not assigned, get collection first
         seastar::future<Status> f = seastar::make_ready_future<Status>(Statuses::S200_OK("default cached response"));
@@ -178,7 +200,7 @@ public:
             }
         }
 
-        return f.then([this, deadline, &request, retries](Status&& status) {
+        return f.then([this, deadline, &request, orderKey, retries](Status&& status) {
             K2DEBUG("Collection get completed with status: " << status << ", request="<< request);
             auto it = collections.find(request.collectionName);
 
@@ -201,8 +223,8 @@ public:
             K2DEBUG("making partition call to " << partition.preferredEndpoint->getURL() << ", with timeout=" << timeout);
 
             // Attempt the request RPC
-            return RPC().callRPC<RequestT, ResponseT>(verb, request, *partition.preferredEndpoint, timeout).
-            then([this, &request, deadline, retries] (auto&& result) {
+            return RPC().callRPC<RequestT, ResponseT>(verb, request, *partition.preferredEndpoint, timeout, orderKey).
+            then([this, &request, deadline, orderKey, retries] (auto&& result) {
                 auto& [status, k2response] = result;
                 K2DEBUG("partition call completed with status " << status);
 
@@ -224,10 +246,10 @@ public:
 
                 // S410_Gone (refresh partition map) or retryable error
                 return GetAssignedPartitionWithRetry(deadline, request.collectionName, request.key, 1)
-                .then([this, &request, deadline, retries] (Status&& status) {
+                .then([this, &request, deadline, orderKey, retries] (Status&& status) {
                     K2DEBUG("retrying partition call after status " << status);
                     (void) status;
-                    return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, retries-1);
+                    return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, retries-1, orderKey);
                 });
             });
         });
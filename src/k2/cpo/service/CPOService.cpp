@@ -30,6 +30,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/dto/MessageVerbs.h> // our DTO
 #include <k2/transport/PayloadFileUtil.h>
 
+#include <seastar/core/semaphore.hh>
+#include <boost/range/irange.hpp>
+
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -52,7 +55,17 @@ seastar::future<> CPOService::gracefulStop() {
         futs.push_back(std::move(v));
     }
     _assignments.clear();
-    return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
+    return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result()
+        .then([this] {
+            // whatever is still waiting gets the collection as it is now
+            std::vector<String> names;
+            for (auto& [k,v]: _assignmentWaiters) {
+                names.push_back(k);
+            }
+            for (auto& name: names) {
+                _notifyAssignmentWaiters(name);
+            }
+        });
 }
 
 seastar::future<> CPOService::start() {
@@ -174,6 +187,15 @@ CPOService::handleCreate(dto::CollectionCreateRequest&& request) {
 seastar::future<std::tuple<Status, dto::CollectionGetResponse>>
 CPOService::handleGet(dto::CollectionGetRequest&& request) {
     K2INFO("Received collection get request for " << request.name);
+    if (request.waitForAssignment && _assignments.find(request.name) != _assignments.end()) {
+        K2DEBUG("waiting for the assignment of collection " << request.name);
+        auto& waiters = _assignmentWaiters[request.name];
+        waiters.emplace_back();
+        return waiters.back().get_future().then([this, request=std::move(request)] () mutable {
+            request.waitForAssignment = false;
+            return handleGet(std::move(request));
+        });
+    }
     auto [status, collection] = _getCollection(request.name);
 
     dto::CollectionGetResponse response;
@@ -190,54 +212,87 @@ String CPOService::_getCollectionPath(String name) {
 void CPOService::_assignCollection(dto::Collection& collection) {
     auto &name = collection.metadata.name;
     K2INFO("Assigning collection " << name << ", to " << collection.partitionMap.partitions.size() << " nodes");
-    std::vector<seastar::future<>> futs;
-    for (auto& part : collection.partitionMap.partitions) {
-        if (part.endpoints.size() == 0) {
-            K2ERROR("empty endpoint for partition assignment: " << part);
-            continue;
-        }
-        auto ep = *part.endpoints.begin();
-        K2INFO("Assigning collection " << name << ", to " << part);
-        auto txep = RPC().getTXEndpoint(ep);
-        if (!txep) {
-            K2WARN("unable to obtain endpoint for " << ep);
-            continue;
-        }
-        dto::AssignmentCreateRequest request;
-        request.collectionMeta = collection.metadata;
-        request.partition = part;
-
-        K2INFO("Sending assignment for partition: " << request.partition);
-        futs.push_back(
-        RPC().callRPC<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
-                (dto::K2_ASSIGNMENT_CREATE, request, *txep, _assignTimeout())
-        .then([this, name, ep](auto&& result) {
-            auto& [status, resp] = result;
-            if (status.is2xxOK()) {
-                K2INFO("assignment successful for collection " << name << ", for partition " << resp.assignedPartition);
-                _handleCompletedAssignment(name, std::move(resp));
+    // The assignments go out concurrently, at most assignment_parallelism at a time. They update this copy of the
+    // collection, which we save once they are all done
+    auto coll = seastar::make_lw_shared<dto::Collection>(collection);
+    auto limit = seastar::make_lw_shared<seastar::semaphore>(std::max(_assignParallelism(), 1u));
+    auto start = Clock::now();
+    auto fut = seastar::parallel_for_each(boost::irange(size_t(0), coll->partitionMap.partitions.size()),
+        [this, coll, limit] (size_t idx) {
+            return seastar::with_semaphore(*limit, 1, [this, coll, idx] {
+                return _assignPartition(coll, idx);
+            });
+        })
+        .then_wrapped([this, name, coll, start] (auto&& fut) {
+            // save whatever got assigned and release the waiters even if some of the assignments failed
+            if (fut.failed()) {
+                K2ERROR("failed to assign collection " << name << ": " << fut.get_exception());
             }
             else {
-                // The node refused to accept the assignment. For now, just ignore this
-                K2WARN("assignment for collection " << name << " was refused by " << ep << ", due to: " << status);
+                fut.ignore_ready_future();
             }
-            return seastar::make_ready_future();
-        })
-        );
-    }
-    _assignments.emplace(name, seastar::when_all_succeed(futs.begin(), futs.end()).discard_result()
-        .then([this, name] {
+            auto status = _saveCollection(*coll);
+            if (!status.is2xxOK()) {
+                K2ERROR("unable to save the assignment of collection " << name << ": " << status);
+            }
+            K2INFO("Assigned collection " << name << ", with " << coll->partitionMap.partitions.size()
+                   << " partitions, in " << (Clock::now() - start));
             _assignments.erase(name);
+            _notifyAssignmentWaiters(name);
             return seastar::make_ready_future();
-        }));
+        });
+    if (!fut.available()) {
+        // gracefulStop() waits for the assignment, and get requests may wait for it too
+        _assignments.emplace(name, std::move(fut));
+    }
 }
 
-void CPOService::_handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request) {
-    auto [status, haveCollection] = _getCollection(cname);
-    if (!status.is2xxOK()) {
-        K2ERROR("unable to find collection which reported assignment " << cname);
+seastar::future<> CPOService::_assignPartition(seastar::lw_shared_ptr<dto::Collection> collection, size_t partitionIdx) {
+    auto& part = collection->partitionMap.partitions[partitionIdx];
+    if (part.endpoints.size() == 0) {
+        K2ERROR("empty endpoint for partition assignment: " << part);
+        return seastar::make_ready_future();
+    }
+    auto ep = *part.endpoints.begin();
+    auto txep = RPC().getTXEndpoint(ep);
+    if (!txep) {
+        K2WARN("unable to obtain endpoint for " << ep);
+        return seastar::make_ready_future();
+    }
+    dto::AssignmentCreateRequest request;
+    request.collectionMeta = collection->metadata;
+    request.partition = part;
+
+    K2INFO("Sending assignment for partition: " << request.partition);
+    return RPC().callRPC<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
+            (dto::K2_ASSIGNMENT_CREATE, request, *txep, _assignTimeout())
+    .then([this, collection, ep](auto&& result) {
+        auto& [status, resp] = result;
+        if (status.is2xxOK()) {
+            K2INFO("assignment successful for collection " << collection->metadata.name << ", for partition " << resp.assignedPartition);
+            _handleCompletedAssignment(*collection, std::move(resp));
+        }
+        else {
+            // The node refused to accept the assignment. For now, just ignore this
+            K2WARN("assignment for collection " << collection->metadata.name << " was refused by " << ep << ", due to: " << status);
+        }
+        return seastar::make_ready_future();
+    });
+}
+
+void CPOService::_notifyAssignmentWaiters(const String& cname) {
+    auto it = _assignmentWaiters.find(cname);
+    if (it == _assignmentWaiters.end()) {
         return;
     }
+    auto waiters = std::move(it->second);
+    _assignmentWaiters.erase(it);
+    for (auto& waiter: waiters) {
+        waiter.set_value();
+    }
+}
+
+void CPOService::_handleCompletedAssignment(dto::Collection& haveCollection, dto::AssignmentCreateResponse&& request) {
     for (auto& part: haveCollection.partitionMap.partitions) {
         if (part.startKey == request.assignedPartition.startKey &&
             part.endKey == request.assignedPartition.endKey &&
@@ -247,7 +302,6 @@ void CPOService::_handleCompletedAssignment(const String& cname, dto::Assignment
                 K2INFO("Assignment received for active partition " << request.assignedPartition);
                 part.astate = request.assignedPartition.astate;
                 part.endpoints = std::move(request.assignedPartition.endpoints);
-                _saveCollection(haveCollection);
                 return;
         }
     }
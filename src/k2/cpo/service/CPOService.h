@@ -26,6 +26,7 @@ Copyright(c) 2020 Futurewei Cloud
 // third-party
 #include <seastar/core/distributed.hh>
 #include <seastar/core/future.hh>  // for future stuff
+#include <seastar/core/shared_ptr.hh>
 
 #include <k2/appbase/AppEssentials.h>
 #include <k2/dto/ControlPlaneOracle.h>
@@ -41,12 +42,18 @@ private:
     ConfigVar<String> _dataDir{"data_dir"};
     String _getCollectionPath(String name);
     void _assignCollection(dto::Collection& collection);
-    ConfigDuration _assignTimeout{"assignment_timeout", 10ms};
+    seastar::future<> _assignPartition(seastar::lw_shared_ptr<dto::Collection> collection, size_t partitionIdx);
+    ConfigDuration _assignTimeout{"assignment_timeout", 1s};
+    // the most partition assignments of a collection we have in flight at a time
+    ConfigVar<uint32_t> _assignParallelism{"assignment_parallelism", 64};
     ConfigDuration _collectionHeartbeatDeadline{"heartbeat_deadline", 100ms};
     std::unordered_map<String, seastar::future<>> _assignments;
+    // get requests waiting for the assignment of a collection to finish
+    std::unordered_map<String, std::vector<seastar::promise<>>> _assignmentWaiters;
+    void _notifyAssignmentWaiters(const String& cname);
     std::tuple<Status, dto::Collection> _getCollection(String name);
     Status _saveCollection(dto::Collection& collection);
-    void _handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request);
+    void _handleCompletedAssignment(dto::Collection& collection, dto::AssignmentCreateResponse&& request);
 
    public:  // application lifespan
     CPOService(DistGetter distGetter);
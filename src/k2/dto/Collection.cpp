@@ -60,14 +60,44 @@ bool Key::operator==(const Key& o) const noexcept {
 size_t Key::hash() const noexcept {
     return std::hash<k2::String>()(partitionKey) + std::hash<k2::String>()(rangeKey);
 }
-size_t Key::partitionHash() const noexcept {
-    uint32_t c32c = crc32c::Crc32c(partitionKey.c_str(), partitionKey.size());
+static size_t _partitionHash(std::string_view partitionKey) {
+    uint32_t c32c = crc32c::Crc32c(partitionKey.data(), partitionKey.size());
     uint64_t hash = c32c;
     // shift the existing hash over to the high 32 bits and add it in to get a 64bit hash
     hash += hash << 32;
     return hash;
 }
 
+size_t Key::partitionHash() const noexcept {
+    return _partitionHash(std::string_view(partitionKey.data(), partitionKey.size()));
+}
+
+int KeyView::compare(const Key& o) const noexcept {
+    auto pkcomp = partitionKey.compare(std::string_view(o.partitionKey.data(), o.partitionKey.size()));
+    if (pkcomp == 0) {
+        // if the partition keys are equal, return the comparison of the range keys
+        return rangeKey.compare(std::string_view(o.rangeKey.data(), o.rangeKey.size()));
+    }
+    return pkcomp;
+}
+
+size_t KeyView::partitionHash() const noexcept {
+    return _partitionHash(partitionKey);
+}
+
+Key KeyView::materialize() const {
+    return Key{.partitionKey = String(partitionKey.data(), partitionKey.size()),
+               .rangeKey = String(rangeKey.data(), rangeKey.size())};
+}
+
+bool operator<(const Key& a, const KeyView& b) noexcept {
+    return b.compare(a) > 0;
+}
+
+bool operator<(const KeyView& a, const Key& b) noexcept {
+    return a.compare(b) < 0;
+}
+
 bool Partition::PVID::operator==(const Partition::PVID& o) const {
     return id == o.id && rangeVersion == o.rangeVersion && assignmentVersion == o.assignmentVersion;
 }
@@ -157,13 +187,20 @@ OwnerPartition::OwnerPartition(Partition&& part, HashScheme scheme) :
 }
 
 bool OwnerPartition::owns(const Key& key) const {
+    return owns(KeyView{.partitionKey = std::string_view(key.partitionKey.data(), key.partitionKey.size()),
+                        .rangeKey = std::string_view(key.rangeKey.data(), key.rangeKey.size())});
+}
+
+bool OwnerPartition::owns(const KeyView& key) const {
     switch (_scheme) {
-        case HashScheme::Range:
+        case HashScheme::Range: {
+            std::string_view startKey(_partition.startKey.data(), _partition.startKey.size());
             if (_partition.endKey == "") {
-                return _partition.startKey.compare(key.partitionKey) <= 0;
+                return startKey.compare(key.partitionKey) <= 0;
             }
-
-            return _partition.startKey.compare(key.partitionKey) <= 0 && key.partitionKey.compare(_partition.endKey) < 0;
+            std::string_view endKey(_partition.endKey.data(), _partition.endKey.size());
+            return startKey.compare(key.partitionKey) <= 0 && key.partitionKey.compare(endKey) < 0;
+        }
         case HashScheme::HashCRC32C: {
             auto phash = key.partitionHash();
             return _hstart <= phash && phash < _hend;
@@ -29,6 +29,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <iostream>
 #include <unordered_map>
 #include <functional>
+#include <string_view>
 // Collection-related DTOs
 
 namespace k2 {
@@ -63,6 +64,27 @@ struct Key {
     }
 };
 
+// A Key whose strings are not copied out of the payload it was read from. It is only valid while
+// that payload is alive. Use materialize() to get a Key which can be stored
+struct KeyView {
+    std::string_view partitionKey;
+    std::string_view rangeKey;
+
+    int compare(const Key& o) const noexcept;
+    size_t partitionHash() const noexcept;
+    Key materialize() const;
+
+    K2_PAYLOAD_FIELDS(partitionKey, rangeKey);
+
+    friend std::ostream& operator<<(std::ostream& os, const KeyView& key) {
+        return os << "{pkey=" << key.partitionKey << ", rkey=" << key.rangeKey << "}";
+    }
+};
+
+// allow lookups with a KeyView in containers ordered by Key(with std::less<>)
+bool operator<(const Key& a, const KeyView& b) noexcept;
+bool operator<(const KeyView& a, const Key& b) noexcept;
+
 // the assignment state of a partition
 enum class AssignmentState: uint8_t {
     NotAssigned,
@@ -257,6 +279,7 @@ class OwnerPartition {
 public:
     OwnerPartition(Partition&& part, HashScheme scheme);
     bool owns(const Key& key) const;
+    bool owns(const KeyView& key) const;
     Partition& operator()() { return _partition; }
     const Partition& operator()() const { return _partition; }
     friend std::ostream& operator<<(std::ostream& os, const OwnerPartition& p) {
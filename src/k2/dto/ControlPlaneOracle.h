@@ -50,7 +50,9 @@ struct CollectionCreateResponse {
 struct CollectionGetRequest {
     // The name of the collection to get
     String name;
-    K2_PAYLOAD_FIELDS(name);
+    // If the collection is being assigned, reply once the assignment is done instead of right away
+    bool waitForAssignment = false;
+    K2_PAYLOAD_FIELDS(name, waitForAssignment);
 };
 
 // Response to CollectionGetRequest
@@ -83,6 +83,20 @@ struct K23SIReadRequest {
     }
 };
 
+// The server-side form of a K23SIReadRequest. The wire format is the same, but the strings are views into
+// the received payload so they are only valid while the request is being handled
+struct K23SIReadRequestView {
+    Partition::PVID pvid;
+    std::string_view collectionName;
+    K23SI_MTR mtr;
+    KeyView key;
+    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key);
+    friend std::ostream& operator<<(std::ostream& os, const K23SIReadRequestView& r) {
+        return os << "{" << "pvid=" << r.pvid << ", colName=" << r.collectionName
+                  << ", mtr=" << r.mtr << ", key=" << r.key << "}";
+    }
+};
+
 // The response for READs
 template<typename ValueType>
 struct K23SIReadResponse {
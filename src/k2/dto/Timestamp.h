@@ -87,6 +87,17 @@ public:
 
 public:
     K2_PAYLOAD_FIELDS(_tEndTSECount, _tsoId, _tStartDelta);
+
+    // In the compact encoding, the end time goes on the wire as the difference from the previous timestamp in the
+    // message. Timestamps in a message tend to be close to each other so this saves most of the bytes
+    struct __K2PayloadCompactTraitTag__ {};
+    void __writeCompactFields(Payload& payload) const {
+        payload.writeDelta(_tEndTSECount);
+        payload.writeMany(_tsoId, _tStartDelta);
+    }
+    bool __readCompactFields(Payload& payload) {
+        return payload.readDelta(_tEndTSECount) && payload.readMany(_tsoId, _tStartDelta);
+    }
 };
 
 } // ns dto
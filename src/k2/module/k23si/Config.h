@@ -41,6 +41,9 @@ struct K23SIConfig {
     // how often to update our retention timestamp from the TSO.
     ConfigDuration retentionTimestampUpdateInterval{"retention_ts_update_interval", 60s};
 
+    // how old the node wide recent TSO timestamp may be for the retention refresh. Older than this and we ask the TSO
+    ConfigDuration retentionTimestampMaxStaleness{"retention_ts_max_staleness", 1s};
+
     // timeout for read requests (including potential PUSH operation)
     ConfigDuration readTimeout{"read_timeout", 100ms};
 
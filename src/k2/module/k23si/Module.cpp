@@ -39,7 +39,7 @@ K23SIPartitionModule::K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::P
     _retentionUpdateTimer([this] {
         K2DEBUG("Partition: " << _partition << ", refreshing retention timestamp");
         _retentionRefresh = _retentionRefresh.then([this]{
-            return getTimeNow();
+            return getRecentTime();
         })
         .then([this](dto::Timestamp&& ts) {
             // set the retention timestamp (the time of the oldest entry we should keep)
@@ -56,12 +56,14 @@ K23SIPartitionModule::K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::P
 
 seastar::future<> K23SIPartitionModule::start() {
     K2DEBUG("Starting for partition: " << _partition);
-    RPC().registerRPCObserver<dto::K23SIReadRequest, dto::K23SIReadResponse<Payload>>(dto::Verbs::K23SI_READ, [this](dto::K23SIReadRequest&& request) {
-        return handleRead(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(_config.readTimeout()));
+    // reads don't copy the key strings out of the received payload. See dto::K23SIReadRequestView
+    RPC().registerRPCObserver<dto::K23SIReadRequestView, dto::K23SIReadResponse<Payload>>(dto::Verbs::K23SI_READ, [this](dto::K23SIReadRequestView&& request) {
+        // inherit the caller's deadline so that nested calls(e.g. push) don't outlive the client request
+        return handleRead(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(RPC().getRequestBudget(_config.readTimeout())));
     });
 
     RPC().registerRPCObserver<dto::K23SIWriteRequest<Payload>, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, [this](dto::K23SIWriteRequest<Payload>&& request) {
-        return handleWrite(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(_config.writeTimeout()));
+        return handleWrite(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(RPC().getRequestBudget(_config.writeTimeout())));
     });
 
     RPC().registerRPCObserver<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse>
@@ -90,8 +92,11 @@ seastar::future<> K23SIPartitionModule::start() {
         _cmeta.retentionPeriod = _config.minimumRetentionPeriod();
     }
 
-    // todo call TSO to get a timestamp
-    return getTimeNow()
+    // the read cache watermark needs the current time, so this one comes from the TSO
+    return AppBase().getDist<TSO_ClientLib>().local().SubscribeRecentTimestamp(_config.retentionTimestampMaxStaleness())
+        .then([this] {
+            return getTimeNow();
+        })
         .then([this](dto::Timestamp&& watermark) {
             K2DEBUG("Cache watermark: " << watermark << ", period=" << _cmeta.retentionPeriod);
             _retentionTimestamp = watermark - _cmeta.retentionPeriod;
@@ -114,7 +119,11 @@ seastar::future<> K23SIPartitionModule::_recovery() {
 seastar::future<> K23SIPartitionModule::gracefulStop() {
     K2INFO("stop for cname=" << _cmeta.name << ", part=" << _partition);
     _retentionUpdateTimer.cancel();
-    return seastar::when_all_succeed(std::move(_retentionRefresh), _txnMgr.gracefulStop()).discard_result().then([]{K2INFO("stopped");});
+    return seastar::when_all_succeed(std::move(_retentionRefresh), _txnMgr.gracefulStop()).discard_result()
+        .then([this] {
+            return AppBase().getDist<TSO_ClientLib>().local().UnsubscribeRecentTimestamp(_config.retentionTimestampMaxStaleness());
+        })
+        .then([]{K2INFO("stopped");});
 }
 
 seastar::future<std::tuple<Status, dto::K23SIReadResponse<Payload>>>
@@ -129,7 +138,7 @@ _makeReadOK(DataRecord* rec) {
 }
 
 seastar::future<std::tuple<Status, dto::K23SIReadResponse<Payload>>>
-K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, dto::K23SI_MTR sitMTR, FastDeadline deadline) {
+K23SIPartitionModule::handleRead(dto::K23SIReadRequestView&& request, dto::K23SI_MTR sitMTR, FastDeadline deadline) {
     K2DEBUG("Partition: " << _partition << ", received read " << request);
     if (!_validateRequestPartition(request)) {
         // tell client their collection partition is gone
@@ -143,7 +152,8 @@ K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, dto::K23SI_MTR
     // update the read cache to lock out any future writers which may attempt to modify the key range
     // before this read's timestamp
     if (sitMTR == dto::K23SI_MTR_ZERO) {
-        _readCache->insertInterval(request.key, request.key, request.mtr.timestamp);
+        // the read cache outlives the request so it needs its own copy of the key
+        _readCache->insertInterval(request.key.materialize(), request.key.materialize(), request.mtr.timestamp);
     }
 
     // find the version deque for the key
@@ -171,7 +181,8 @@ K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, dto::K23SI_MTR
     if (sitMTR == dto::K23SI_MTR_ZERO) {
         // this is a fresh read finding a WI. have to do a push
         sitMTR = viter->txnId.mtr;
-        return _doPush(request.collectionName, viter->txnId, request.mtr, deadline)
+        // the views in the request remain valid here since the payload lives until we respond
+        return _doPush(String(request.collectionName.data(), request.collectionName.size()), viter->txnId, request.mtr, deadline)
             .then([this, sitMTR, request=std::move(request), deadline](auto&& winnerMTR) mutable {
                 if (winnerMTR == sitMTR) {
                     // sitting transaction won. Abort the incoming request
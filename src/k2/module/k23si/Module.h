@@ -56,7 +56,7 @@ public: // lifecycle
     // If this is called after a push, sitMTR will be the mtr of the sitting(and now aborted) WI
     // compKey is the composite key we get from the dto Key
     seastar::future<std::tuple<Status, dto::K23SIReadResponse<Payload>>>
-    handleRead(dto::K23SIReadRequest&& request, dto::K23SI_MTR sitMTR, FastDeadline deadline);
+    handleRead(dto::K23SIReadRequestView&& request, dto::K23SI_MTR sitMTR, FastDeadline deadline);
 
     seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
     handleWrite(dto::K23SIWriteRequest<Payload>&& request, dto::K23SI_MTR sitMTR, FastDeadline deadline);
@@ -125,7 +125,8 @@ private: // members
     // to store data. The deque contains versions of a key, sorted in decreasing order of their ts.end.
     // (newest item is at front of the deque)
     // Duplicates are not allowed
-    std::map<dto::Key, std::deque<DataRecord>> _indexer;
+    // The transparent comparator allows lookups with a dto::KeyView
+    std::map<dto::Key, std::deque<DataRecord>, std::less<>> _indexer;
 
     // to store transactions
     TxnManager _txnMgr;
@@ -139,7 +140,7 @@ private: // members
     // the timestamp of the end of the retention window. We do not allow operations to occur before this timestamp
     dto::Timestamp _retentionTimestamp;
 
-    // timer used to refresh the retention timestamp from the TSO
+    // timer used to refresh the retention timestamp from the node wide recent TSO timestamp
     seastar::timer<> _retentionUpdateTimer;
 
     // used to tell if there is a refresh in progress so that we don't stop() too early
@@ -155,6 +156,12 @@ private: // members
         thread_local TSO_ClientLib& tsoClient = AppBase().getDist<TSO_ClientLib>().local();
         return tsoClient.GetTimestampFromTSO(Clock::now());
     }
+
+    // get a recent Timestamp, no older than retention_ts_max_staleness, usually without a TSO request
+    seastar::future<dto::Timestamp> getRecentTime() {
+        thread_local TSO_ClientLib& tsoClient = AppBase().getDist<TSO_ClientLib>().local();
+        return tsoClient.GetRecentTimestamp(_config.retentionTimestampMaxStaleness());
+    }
 };
 
 } // ns k2
@@ -26,7 +26,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 namespace k2 {
 
-K2TxnHandle::K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time) noexcept : _mtr(std::move(mtr)), _options(std::move(options)), _cpo_client(cpo), _client(client), _started(true), _failed(false), _failed_status(Statuses::S200_OK("default fail status")), _txn_end_deadline(d), _start_time(start_time) {
+K2TxnHandle::K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint commit_wait_until) noexcept : _mtr(std::move(mtr)), _options(std::move(options)), _cpo_client(cpo), _client(client), _started(true), _failed(false), _failed_status(Statuses::S200_OK("default fail status")), _txn_end_deadline(d), _commit_wait_until(commit_wait_until) {
     K2DEBUG("ctor, mtr=" << _mtr);
 }
 
@@ -62,7 +62,7 @@ void K2TxnHandle::makeHeartbeatTimer() {
 
         K2DEBUG("send hb for " << _mtr);
 
-        return _cpo_client->PartitionRequest<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse, dto::Verbs::K23SI_TXN_HEARTBEAT>(Deadline(_heartbeat_interval), *request)
+        return _cpo_client->PartitionRequest<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse, dto::Verbs::K23SI_TXN_HEARTBEAT>(Deadline(_heartbeat_interval), *request, 1, _mtr.txnid)
         .then([this] (auto&& response) {
             auto& [status, k2response] = response;
             checkResponseStatus(status);
@@ -97,8 +97,8 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
 
     return _cpo_client->PartitionRequest
         <dto::K23SITxnEndRequest, dto::K23SITxnEndResponse, dto::Verbs::K23SI_TXN_END>
-        (Deadline<>(_txn_end_deadline), *request).
-        then([this] (auto&& response) {
+        (Deadline<>(_txn_end_deadline), *request, 1, _mtr.txnid).
+        then([this, commit=request->action == dto::EndAction::Commit] (auto&& response) {
             auto& [status, k2response] = response;
             if (status.is2xxOK() && !_failed) {
                 _client->successful_txns++;
@@ -106,11 +106,14 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
                 K2WARN("TxnEndRequest failed: " << status << " mtr: " << _mtr);
             }
 
-            return _heartbeat_timer.stop().then([this, s=std::move(status)] () {
-                // TODO get min transaction time from TSO client
-                auto time_spent = Clock::now() - _start_time;
-                if (time_spent < 10us) {
-                    auto sleep = 10us - time_spent;
+            return _heartbeat_timer.stop().then([this, commit, s=std::move(status)] () {
+                // The commit wait runs concurrently with the TxnEnd request, so we only sleep for what is left of it.
+                // Only a successful commit needs it, and only if the transaction was faster than the MTL
+                auto now = Clock::now();
+                if (commit && s.is2xxOK() && now < _commit_wait_until) {
+                    auto sleep = _commit_wait_until - now;
+                    _client->commit_waits++;
+                    _client->commit_wait_nanos += nsec(sleep).count();
                     return seastar::sleep(sleep).then([s=std::move(s)] () {
                         return seastar::make_ready_future<EndResult>(EndResult(std::move(s)));
                     });
@@ -137,6 +140,8 @@ K23SIClient::K23SIClient(const K23SIClientConfig &) :
         sm::make_counter("abort_conflicts", abort_conflicts, sm::description("Total K23SI transactions aborted due to conflict"), labels),
         sm::make_counter("abort_too_old", abort_too_old, sm::description("Total K23SI transactions aborted due to retention window expiration"), labels),
         sm::make_counter("heartbeats", heartbeats, sm::description("Total K23SI transaction heartbeats sent"), labels),
+        sm::make_counter("commit_waits", commit_waits, sm::description("Total K23SI commits which had to wait for the MTL to pass"), labels),
+        sm::make_counter("commit_wait_nanos", commit_wait_nanos, sm::description("Total time K23SI commits spent waiting for the MTL to pass"), labels),
     });
 }
 
@@ -170,17 +175,19 @@ seastar::future<Status> K23SIClient::makeCollection(const String& collection, st
 }
 
 seastar::future<K2TxnHandle> K23SIClient::beginTxn(const K2TxnOptions& options) {
-    auto start_time = Clock::now();
-    return _tsoClient.GetTimestampFromTSO(start_time)
-    .then([this, start_time, options] (auto&& timestamp) {
+    return _tsoClient.GetTimeStampWithMTLFromTSO(Clock::now())
+    .then([this, options] (auto&& result) {
+        auto& [timestamp, mtl] = result;
         dto::K23SI_MTR mtr{
             _rnd(_gen),
             std::move(timestamp),
             options.priority
         };
 
+        // the timestamp was issued before we got it, so counting the MTL from now is on the safe side
+        auto commit_wait_until = Clock::now() + mtl;
         total_txns++;
-        return seastar::make_ready_future<K2TxnHandle>(K2TxnHandle(std::move(mtr), std::move(options), &_cpo_client, this, txn_end_deadline(), start_time));
+        return seastar::make_ready_future<K2TxnHandle>(K2TxnHandle(std::move(mtr), std::move(options), &_cpo_client, this, txn_end_deadline(), commit_wait_until));
     });
 }
 
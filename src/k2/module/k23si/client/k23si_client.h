@@ -117,6 +117,8 @@ public:
     uint64_t abort_conflicts{0};
     uint64_t abort_too_old{0};
     uint64_t heartbeats{0};
+    uint64_t commit_waits{0};
+    uint64_t commit_wait_nanos{0};
 private:
     sm::metric_groups _metric_groups;
     std::mt19937 _gen;
@@ -134,7 +136,7 @@ public:
     K2TxnHandle() = default;
     K2TxnHandle(K2TxnHandle&& o) noexcept = default;
     K2TxnHandle& operator=(K2TxnHandle&& o) noexcept = default;
-    K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time) noexcept;
+    K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint commit_wait_until) noexcept;
 
     template <typename ValueType>
     seastar::future<ReadResult<ValueType>> read(dto::Key key, const String& collection) {
@@ -157,7 +159,7 @@ public:
 
         return _cpo_client->PartitionRequest
             <dto::K23SIReadRequest, dto::K23SIReadResponse<ValueType>, dto::Verbs::K23SI_READ>
-            (_options.deadline, *request).
+            (_options.deadline, *request, 1, _mtr.txnid).
             then([this] (auto&& response) {
                 auto& [status, k2response] = response;
                 checkResponseStatus(status);
@@ -197,7 +199,7 @@ public:
 
         return _cpo_client->PartitionRequest
             <dto::K23SIWriteRequest<ValueType>, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
-            (_options.deadline, *request).
+            (_options.deadline, *request, 1, _mtr.txnid).
             then([this] (auto&& response) {
                 auto& [status, k2response] = response;
                 checkResponseStatus(status);
@@ -231,7 +233,8 @@ private:
     bool _failed;
     Status _failed_status;
     Duration _txn_end_deadline;
-    TimePoint _start_time;
+    // a commit can't be acknowledged before this time, which is the MTL past the time we got the timestamp
+    TimePoint _commit_wait_until;
 
     Duration _heartbeat_interval;
     PeriodicTimer _heartbeat_timer;
@@ -25,6 +25,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/common/Log.h>
 #include <k2/transport/RPCDispatcher.h>
 #include <k2/transport/RRDMARPCProtocol.h>
+#include <k2/transport/SMPRPCProtocol.h>
 #include <k2/transport/TCPRPCProtocol.h>
 
 namespace k2 {
@@ -73,6 +74,13 @@ PartitionManager::assignPartition(dto::CollectionMetadata meta, dto::Partition p
         if (rdma_ep) {
             partition.endpoints.insert(rdma_ep->getURL());
         }
+        // only usable by clients in this process. Others skip it when selecting an endpoint
+        if (k2::RPC().isSupportedProtocol(k2::SMPRPCProtocol::proto)) {
+            auto smp_ep = k2::RPC().getServerEndpoint(k2::SMPRPCProtocol::proto);
+            if (smp_ep) {
+                partition.endpoints.insert(smp_ep->getURL());
+            }
+        }
 
         _pmodule = std::make_unique<K23SIPartitionModule>(std::move(meta), partition);
         return _pmodule->start().then([partition = std::move(partition)] () mutable {
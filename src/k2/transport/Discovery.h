@@ -33,6 +33,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include "RPCDispatcher.h"  // for RPC
 #include "RPCTypes.h"
 #include "RRDMARPCProtocol.h"
+#include "SMPRPCProtocol.h"
 
 namespace k2 {
 class Discovery {
@@ -46,11 +47,23 @@ public :  // application lifespan
         std::vector<std::unique_ptr<TXEndpoint>> eps;
 
         for(auto& url: urls) {
+            // nodes publish endpoints for all of their protocols, and we may not run some of them(e.g. smp+k2rpc
+            // when enable_smp_rpc is off). Skip those quietly
+            if (!RPC().isSupportedURL(url)) {
+                continue;
+            }
             auto ep = RPC().getTXEndpoint(std::move(url));
             if (ep) {
                 eps.push_back(std::move(ep));
             }
         }
+        // endpoints in this process can be reached without going through the network
+        for (auto& ep: eps) {
+            if (SMPRPCProtocol::isLocal(*ep)) {
+                return std::move(ep);
+            }
+        }
+
         // look for rdma
         if (seastar::engine()._rdma_stack) {
             for (auto& ep: eps) {
@@ -50,6 +50,10 @@ IRPCProtocol::~IRPCProtocol() {
     K2DEBUG("dtor");
 }
 
+seastar::future<> IRPCProtocol::waitForCapacity(TXEndpoint&) {
+    return seastar::make_ready_future();
+}
+
 const String& IRPCProtocol::supportedProtocol() {
     return _protocol;
 }
@@ -101,6 +101,10 @@ public: // API
     // This is an asyncronous API. No guarantees are made on the delivery of the payload after the call returns.
     virtual void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) = 0;
 
+    // Returns a future which completes when the protocol can accept more messages for the given endpoint without
+    // exceeding its send queue budgets. Protocols which don't queue can use the default, which is always ready
+    virtual seastar::future<> waitForCapacity(TXEndpoint& endpoint);
+
     // Returns the endpoint where this protocol accepts incoming connections.
     virtual seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() = 0;
 
@@ -22,6 +22,7 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "Payload.h"
+#include "PayloadPool.h"
 #include <crc32c/crc32c.h>
 
 namespace k2 {
@@ -52,6 +53,14 @@ Payload::Payload():
     _allocator(nullptr) {
 }
 
+void* Payload::operator new(size_t size) {
+    return PayloadPool::allocatePayload(size);
+}
+
+void Payload::operator delete(void* ptr, size_t size) {
+    PayloadPool::releasePayload(ptr, size);
+}
+
 bool Payload::isEmpty() const {
     return _size == 0;
 }
@@ -82,8 +91,18 @@ std::vector<Binary> Payload::release() {
 
 void Payload::clear() {
     _buffers.resize(0);
+    _viewBuffers.resize(0);
     _size = 0;
     _capacity = 0;
+    _deltaBase = 0;
+}
+
+void Payload::setCompactEncoding(bool compact) {
+    _compact = compact;
+}
+
+bool Payload::isCompactEncoding() const {
+    return _compact;
 }
 
 void Payload::appendBinary(Binary&& binary) {
@@ -97,6 +116,7 @@ void Payload::appendBinary(Binary&& binary) {
 void Payload::seek(size_t offset) {
     // grow if needed
     ensureCapacity(offset);
+    _deltaBase = 0;
 
     // set the current position
     if (offset < _currentPosition.offset) {
@@ -174,10 +194,35 @@ bool Payload::read(String& value) {
     return read((void*)value.data(), size);
 }
 
+bool Payload::read(std::string_view& value) {
+    auto pos = getCurrentPosition();
+    _Size size;
+    if (!read(size)) return false;
+    if (size == 0 || getDataRemaining() < size) {
+        seek(pos);
+        return false;
+    }
+    // the string's size includes the '\0' which we don't expose in the view
+    auto& buf = _buffers[_currentPosition.bufferIndex];
+    if (buf.size() - _currentPosition.bufferOffset >= size) {
+        value = std::string_view(buf.get() + _currentPosition.bufferOffset, size - 1);
+        _advancePosition(size);
+        return true;
+    }
+    // the string spans buffers. Copy it into memory owned by this payload
+    Binary joined(size);
+    read(joined.get_write(), size);
+    value = std::string_view(joined.get(), size - 1);
+    _viewBuffers.push_back(std::move(joined));
+    return true;
+}
+
 bool Payload::read(Payload& other) {
-    size_t size;
-    if (!read(size) || getDataRemaining() < size) return false;
+    // the size is fixed-width in all encodings, the same as the size of a SerializeAsPayload value
+    uint64_t size = 0;
+    if (!read((void*)&size, sizeof(size)) || getDataRemaining() < size) return false;
     other.clear();
+    other._compact = _compact;
     other._size = size;
     other._capacity = size;
     other._allocator = nullptr;
@@ -271,12 +316,20 @@ void Payload::write(const String& value) {
     write(value.data(), size);
 }
 
+void Payload::write(std::string_view value) {
+    _Size size = value.size() + 1; // count the null character too
+    write(size);
+    write(value.data(), value.size());
+    write('\0');
+}
+
 void Payload::write(const Payload& other) {
     // we only support this write at the end of an existing payload (append)
     K2ASSERT(getDataRemaining() == 0, "cannot write a payload in the middle of another payload");
 
-    // write out how many bytes are following
-    write(other.getSize());
+    // write out how many bytes are following. Fixed-width in all encodings, the same as for a SerializeAsPayload value
+    uint64_t size = other.getSize();
+    write((const void*)&size, sizeof(size));
 
     // reset ourselves so that we are exactly as big as the data we're currently holding
     // truncate to the current cursor
@@ -297,6 +350,37 @@ void Payload::writeMany() {
     // this is needed for the base case of the recursive template version
 }
 
+char* Payload::_reserveContiguous(size_t size) {
+    ensureCapacity(_currentPosition.offset + size);
+    Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset < size) {
+        return nullptr;
+    }
+    char* result = buffer.get_write() + _currentPosition.bufferOffset;
+    _advancePosition(size);
+    return result;
+}
+
+const char* Payload::_peekContiguous(size_t size) {
+    if (getDataRemaining() < size) {
+        return nullptr;
+    }
+    const Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset < size) {
+        return nullptr;
+    }
+    const char* result = buffer.get() + _currentPosition.bufferOffset;
+    _advancePosition(size);
+    return result;
+}
+
+void Payload::addCapacity(Binary&& buffer) {
+    K2ASSERT(_allocator, "cannot add capacity to a non-allocating payload");
+    K2ASSERT(buffer.size() > 0, "cannot add an empty buffer");
+    _capacity += buffer.size();
+    _buffers.push_back(std::move(buffer));
+}
+
 bool Payload::_allocateBuffer() {
     K2ASSERT(_allocator, "cannot allocate buffer without allocator");
     Binary buf = _allocator();
@@ -383,6 +467,7 @@ Payload Payload::share() {
         toShare -= shareSizeFromCurBuf;
         curBufIndex++;
     }
+    shared._compact = _compact;
     return shared;
 }
 
@@ -402,6 +487,7 @@ Payload Payload::copy() {
         curBufIndex++;
     }
     copied.appendBinary(std::move(b));
+    copied._compact = _compact;
     return copied;
 }
 
@@ -434,4 +520,73 @@ void Payload::write(const Duration& dur) {
     write(dur.count());                 // write the tick count
 }
 
+void Payload::writeDelta(uint64_t value) {
+    if (!_compact) {
+        write(value);
+        return;
+    }
+    // the difference may be negative. Zigzag it so that it stays short either way
+    _writeVarint(_toVarint(int64_t(value - _deltaBase)));
+    _deltaBase = value;
+}
+
+bool Payload::readDelta(uint64_t& value) {
+    if (!_compact) {
+        return read(value);
+    }
+    int64_t delta = 0;
+    if (!read(delta)) return false;
+    value = _deltaBase + uint64_t(delta);
+    _deltaBase = value;
+    return true;
+}
+
+void Payload::_writeVarint(uint64_t value) {
+    uint8_t bytes[MAX_VARINT_BYTES];
+    size_t count = 0;
+    while (value >= 0x80) {
+        bytes[count++] = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+    bytes[count++] = uint8_t(value);
+    write((const void*)bytes, count);
+}
+
+bool Payload::_readVarint(uint64_t& value) {
+    if (getDataRemaining() == 0) return false;
+
+    // decode in place if the varint is in the current buffer, which is almost always the case
+    const Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    const uint8_t* src = (const uint8_t*)buffer.get() + _currentPosition.bufferOffset;
+    size_t avail = std::min(getDataRemaining(), buffer.size() - _currentPosition.bufferOffset);
+    uint64_t result = 0;
+    for (size_t i = 0; i < std::min(avail, MAX_VARINT_BYTES); ++i) {
+        result |= uint64_t(src[i] & 0x7f) << (7 * i);
+        if ((src[i] & 0x80) == 0) {
+            value = result;
+            _advancePosition(i + 1);
+            return true;
+        }
+    }
+    if (avail >= MAX_VARINT_BYTES) {
+        // too long to be a varint
+        return false;
+    }
+
+    // the varint spans buffers
+    auto pos = getCurrentPosition();
+    result = 0;
+    for (size_t i = 0; i < MAX_VARINT_BYTES; ++i) {
+        char byte;
+        if (!read(byte)) break;
+        result |= uint64_t(uint8_t(byte) & 0x7f) << (7 * i);
+        if ((uint8_t(byte) & 0x80) == 0) {
+            value = result;
+            return true;
+        }
+    }
+    seek(pos);
+    return false;
+}
+
 } // namespace k2
@@ -28,6 +28,10 @@ Copyright(c) 2020 Futurewei Cloud
 #include <unordered_set>
 #include <set>
 #include <limits>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <string_view>
 
 #include <k2/common/Common.h>
 #include <k2/common/Log.h>
@@ -69,6 +73,35 @@ constexpr bool isPayloadCopyableType() { return IsPayloadCopyableTypeTrait<T>::v
 template <typename T>  //  Type that need custom serialization to convert to/from payload
 constexpr bool isPayloadSerializableType() { return IsPayloadSerializableTypeTrait<T>::value; }
 
+template <typename T, typename = void>
+struct HasPayloadCompactFieldsTrait : std::false_type {};
+
+template <typename T>
+struct HasPayloadCompactFieldsTrait<T, typename enable_if_type<typename T::__K2PayloadCompactTraitTag__>::type> : std::true_type {};
+
+template <typename T>  //  Serializable type with its own (de)serialization for the compact encoding
+constexpr bool hasPayloadCompactFields() { return HasPayloadCompactFieldsTrait<T>::value; }
+
+// The number of bytes a value of type T always takes on the wire, or 0 if the size depends on the value(e.g. strings).
+// For K2_PAYLOAD_FIELDS types, this is non-zero only if all fields are fixed-size
+template <typename T>
+constexpr size_t fixedWireSize() {
+    if constexpr (isNumericType<T>() || isPayloadCopyableType<T>()) {
+        return sizeof(T);
+    }
+    else if constexpr (isPayloadSerializableType<T>()) {
+        return decltype(std::declval<const T&>().__fixedWireSize())::value;
+    }
+    else {
+        return 0;
+    }
+}
+
+// Used by K2_PAYLOAD_FIELDS(in unevaluated context only) to compute the fixed wire size of a struct from its fields
+template <typename... T>
+std::integral_constant<size_t, ((fixedWireSize<T>() > 0) && ...) ? (fixedWireSize<T>() + ... + 0) : 0>
+fixedWireSizeOf(const T&...);
+
 //  Payload is abstraction representing message content. It allows for very efficient network
 // transportation of bytes, and it allows for allocating the underlying memory in a network-aware way.
 // For that reason, normally payloads are produced by the k2 transport, either when a new message comes in
@@ -97,6 +130,10 @@ public: // Lifecycle
     Payload(Payload&&) = default;
     Payload& operator=(Payload&& other) = default;
 
+    // heap-allocated Payload objects are recycled through the per-core PayloadPool
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+
 public: // memory management
     bool isEmpty() const;
 
@@ -109,6 +146,10 @@ public: // memory management
     // makes sure that the payload has enough total capacity to hold the given totalCapacity
     void ensureCapacity(size_t totalCapacity);
 
+    // Adds the given buffer to the end of this payload's capacity, as if it came from the allocator. This allows
+    // callers which know the size of the message to use a buffer of a different size than the allocator's
+    void addCapacity(Binary&& buffer);
+
     // release the underlying buffers
     std::vector<Binary> release();
 
@@ -125,6 +166,17 @@ public: // memory management
     // clear this payload
     void clear();
 
+public: // wire encoding
+    // Selects the compact encoding for the values (de)serialized through this payload. Integers, enums, sizes and
+    // durations are written as varints(zigzag for signed types) and delta values as the difference to the previous
+    // one. Raw bytes and K2_PAYLOAD_COPYABLE structs are written as-is.
+    // The RPC layer selects the encoding per verb, based on the RPC version of the peer
+    void setCompactEncoding(bool compact);
+    bool isCompactEncoding() const;
+
+    // the most bytes a varint can take on the wire
+    static constexpr size_t MAX_VARINT_BYTES = 10;
+
 public: // read-only API. Used to wrap an external list of buffers into a Payload
     // Wrap the given buffers into the Payload interface. No further allocation will be possible
     Payload(std::vector<Binary>&& externallyAllocatedBuffers, size_t containedDataSize);
@@ -170,27 +222,40 @@ public:  // Read API
     // read a string
     bool read(String& value);
 
+    // read a string without copying it. The view points into this payload's buffers and so it is only valid
+    // while this payload is alive. Use it for fields which don't need to outlive the request being handled
+    bool read(std::string_view& value);
+
     // read into a payload
     bool read(Payload& other);
 
     // read a duration value
     bool read(Duration& dur);
 
+    // read a value written with writeDelta()
+    bool readDelta(uint64_t& value);
+
     template<typename T>
     bool read(SerializeAsPayload<T>& value) {
         // if the embedded type is a Payload, then just use the payload write to write it directly
         if (std::is_same<T, Payload>::value) {
             return read(value.val);
         }
+        // the size is always fixed-width since the writer patches it in after writing the value
         uint64_t size = 0;
-        if (!read(size)) {
+        if (!read((void*)&size, sizeof(size))) {
             return false;
         }
         if (size == 0) {
             return true;
         }
 
-        return read(value.val);
+        // the value starts its own delta chain, the same as if it was read out of a nested Payload
+        auto deltaBase = _deltaBase;
+        _deltaBase = 0;
+        bool result = read(value.val);
+        _deltaBase = deltaBase;
+        return result;
     }
 
     // read a map
@@ -295,18 +360,36 @@ public:  // Read API
     // primitive type read
     template <typename T>
     std::enable_if_t<isPayloadCopyableType<T>() || isNumericType<T>(), bool> read(T& value) {
+        if constexpr (_isVarintType<T>()) {
+            if (_compact) {
+                return _readVarint(value);
+            }
+        }
         return read((void*)&value, sizeof(value));
     }
 
     // serializable type read
     template <typename T>
     std::enable_if_t<isPayloadSerializableType<T>(), bool> read(T& value) {
+        if constexpr (hasPayloadCompactFields<T>()) {
+            if (_compact) {
+                return value.__readCompactFields(*this);
+            }
+        }
         return value.__readFields(*this);
     }
 
     // read many values in series
     template <typename T, typename... ArgsT>
     bool readMany(T& value, ArgsT&... args) {
+        // leading fixed-size values are copied out in one go if they are all in the current buffer
+        // with the compact encoding, the wire size depends on the values so it has to go field by field
+        if constexpr (fixedWireSize<T>() > 0) {
+            constexpr size_t runSize = _fixedRunSize<T, ArgsT...>();
+            if (const char* src = _compact ? nullptr : _peekContiguous(runSize); src != nullptr) {
+                return _readFixedRun(src, value, args...);
+            }
+        }
         return read(value) && readMany(args...);
     }
 
@@ -332,12 +415,19 @@ public: // Write API
     // write a string
     void write(const String& value);
 
+    // write a string view. The wire format is the same as for String
+    void write(std::string_view value);
+
     // write another Payload
     void write(const Payload& other);
 
     // Write a duration value
     void write(const Duration& dur);
 
+    // Write a value which is usually close to the previous value written this way, e.g. a timestamp. With the
+    // compact encoding, only the difference goes on the wire. Seeking to an offset restarts the deltas from 0
+    void writeDelta(uint64_t value);
+
     // write a map
     template <typename KeyT, typename ValueT>
     void write(const std::map<KeyT, ValueT>& m) {
@@ -402,12 +492,14 @@ public: // Write API
             write(value.val);
             return;
         }
-        // 1. write out a dummy size now
+        // 1. write out a dummy size now. It is fixed-width in all encodings so that we can patch it in place
         auto sizePos = getCurrentPosition();
         uint64_t size = 0;
-        write(size);
+        write((const void*)&size, sizeof(size));
 
-        // 2. write the actual value
+        // 2. write the actual value. It starts its own delta chain, so that it can be read as a nested Payload
+        auto deltaBase = _deltaBase;
+        _deltaBase = 0;
         auto valPos = getCurrentPosition();
         write(value.val);
 
@@ -415,14 +507,21 @@ public: // Write API
         auto nowPos = getCurrentPosition();
         size = nowPos.offset - valPos.offset;
         seek(sizePos);
-        write(size);
+        write((const void*)&size, sizeof(size));
         // make sure to place the cursor at end of all the written data
         seek(nowPos);
+        _deltaBase = deltaBase;
     }
 
     // write for primitive types by copy
     template <typename T>
     std::enable_if_t<isNumericType<T>(), void> write(const T value) {
+        if constexpr (_isVarintType<T>()) {
+            if (_compact) {
+                _writeVarint(_toVarint(value));
+                return;
+            }
+        }
         write((const void*)&value, sizeof(value));
     }
 
@@ -435,12 +534,26 @@ public: // Write API
     // write for serializable types
     template <typename T>
     std::enable_if_t<isPayloadSerializableType<T>(), void> write(const T& value) {
+        if constexpr (hasPayloadCompactFields<T>()) {
+            if (_compact) {
+                value.__writeCompactFields(*this);
+                return;
+            }
+        }
         value.__writeFields(*this);
     }
 
     // write out many fields at once
     template <typename T, typename... ArgsT>
     void writeMany(T& value, ArgsT&... args) {
+        // leading fixed-size values are copied in one go if they fit in the current buffer
+        if constexpr (fixedWireSize<std::remove_cv_t<T>>() > 0) {
+            constexpr size_t runSize = _fixedRunSize<std::remove_cv_t<T>, std::remove_cv_t<ArgsT>...>();
+            if (char* dst = _compact ? nullptr : _reserveContiguous(runSize); dst != nullptr) {
+                _writeFixedRun(dst, value, args...);
+                return;
+            }
+        }
         write(value);
         writeMany(args...);
     }
@@ -448,6 +561,100 @@ public: // Write API
     // no-arg version to satisfy the template expansion above in the terminal case
     void writeMany();
 
+public: // serialized size. Useful to allocate the payload for a message in one go
+    // The sizes are exact for the fixed-width encoding. Compact payloads are normally smaller
+    template <typename T>
+    static std::enable_if_t<isNumericType<T>() || isPayloadCopyableType<T>(), size_t> serializedSize(const T&) {
+        return sizeof(T);
+    }
+
+    template <typename T>
+    static std::enable_if_t<isPayloadSerializableType<T>(), size_t> serializedSize(const T& value) {
+        return value.__serializedSize();
+    }
+
+    static size_t serializedSize(const String& value) {
+        return sizeof(_Size) + value.size() + 1;
+    }
+
+    static size_t serializedSize(std::string_view value) {
+        return sizeof(_Size) + value.size() + 1;
+    }
+
+    static size_t serializedSize(const Duration&) {
+        return sizeof(Duration::rep);
+    }
+
+    static size_t serializedSize(const Payload& value) {
+        return sizeof(uint64_t) + value.getSize();
+    }
+
+    template <typename T>
+    static size_t serializedSize(const SerializeAsPayload<T>& value) {
+        if constexpr (std::is_same<std::remove_cv_t<T>, Payload>::value) {
+            return serializedSize(value.val);
+        }
+        else {
+            return sizeof(uint64_t) + serializedSize(value.val);
+        }
+    }
+
+    template <typename KeyT, typename ValueT>
+    static size_t serializedSize(const std::map<KeyT, ValueT>& m) {
+        size_t result = sizeof(_Size);
+        for (auto& kvp : m) result += serializedSize(kvp.first) + serializedSize(kvp.second);
+        return result;
+    }
+
+    template <typename KeyT, typename ValueT>
+    static size_t serializedSize(const std::unordered_map<KeyT, ValueT>& m) {
+        size_t result = sizeof(_Size);
+        for (auto& kvp : m) result += serializedSize(kvp.first) + serializedSize(kvp.second);
+        return result;
+    }
+
+    template <typename ValueT>
+    static size_t serializedSize(const std::vector<ValueT>& vec) {
+        if constexpr (fixedWireSize<ValueT>() > 0) {
+            return sizeof(_Size) + vec.size() * fixedWireSize<ValueT>();
+        }
+        else {
+            size_t result = sizeof(_Size);
+            for (auto& value : vec) result += serializedSize(value);
+            return result;
+        }
+    }
+
+    template <typename T>
+    static size_t serializedSize(const std::set<T>& s) {
+        size_t result = sizeof(_Size);
+        for (auto& key : s) result += serializedSize(key);
+        return result;
+    }
+
+    template <typename T>
+    static size_t serializedSize(const std::unordered_set<T>& s) {
+        size_t result = sizeof(_Size);
+        for (auto& key : s) result += serializedSize(key);
+        return result;
+    }
+
+    template <typename... ArgsT>
+    static size_t serializedSizeMany(const ArgsT&... args) {
+        return (serializedSize(args) + ... + 0);
+    }
+
+public: // bulk copy of fixed-size values, used by K2_PAYLOAD_FIELDS. The caller guarantees the memory is large enough
+    template <typename... ArgsT>
+    static void writeFixedMany(char*& dst, const ArgsT&... args) {
+        (_writeFixed(dst, args), ...);
+    }
+
+    template <typename... ArgsT>
+    static void readFixedMany(const char*& src, ArgsT&... args) {
+        (_readFixed(src, args), ...);
+    }
+
 private:  // types and fields
 
     std::vector<Binary> _buffers;
@@ -455,6 +662,12 @@ private:  // types and fields
     size_t _capacity; // total bytes allocated in the buffers.
     BinaryAllocatorFunctor _allocator;
     PayloadPosition _currentPosition;
+    // copies of strings which were read as views but spanned more than one buffer
+    std::vector<Binary> _viewBuffers;
+    // true if values are (de)serialized in the compact encoding
+    bool _compact = false;
+    // the previous value written/read with writeDelta()/readDelta()
+    uint64_t _deltaBase = 0;
 
 private: // helper methods
     // used to allocate additional space
@@ -463,6 +676,135 @@ private: // helper methods
     // advances the current position by the given number
     void _advancePosition(size_t advance);
 
+    // returns a pointer to the next size bytes and advances past them, if they are contiguous in the current
+    // buffer(allocating if needed). Returns nullptr otherwise and the position is unchanged
+    char* _reserveContiguous(size_t size);
+
+    // returns a pointer to the next size bytes of data and advances past them, if they are all in the current buffer.
+    // Returns nullptr otherwise and the position is unchanged
+    const char* _peekContiguous(size_t size);
+
+    // write/read an unsigned LEB128 varint
+    void _writeVarint(uint64_t value);
+    bool _readVarint(uint64_t& value);
+
+    // integers and enums wider than a byte are varints in the compact encoding
+    template <typename T>
+    static constexpr bool _isVarintType() {
+        if constexpr (std::is_enum<T>::value) {
+            return sizeof(T) > 1;
+        }
+        else {
+            return std::is_integral<T>::value && sizeof(T) > 1;
+        }
+    }
+
+    // the integer type we use to encode T(the underlying type for enums)
+    template <typename T>
+    using _VarintRep = typename std::conditional_t<std::is_enum<T>::value, std::underlying_type<T>, std::common_type<T>>::type;
+
+    template <typename T>
+    static uint64_t _toVarint(T value) {
+        auto rep = static_cast<_VarintRep<T>>(value);
+        if constexpr (std::is_signed<_VarintRep<T>>::value) {
+            // zigzag so that small negative numbers are small on the wire too
+            return (uint64_t(int64_t(rep)) << 1) ^ uint64_t(int64_t(rep) >> 63);
+        }
+        else {
+            return uint64_t(rep);
+        }
+    }
+
+    template <typename T>
+    bool _readVarint(T& value) {
+        using RepT = _VarintRep<T>;
+        auto pos = getCurrentPosition();
+        uint64_t raw = 0;
+        if (!_readVarint(raw)) {
+            return false;
+        }
+        if constexpr (std::is_signed<RepT>::value) {
+            int64_t decoded = int64_t(raw >> 1) ^ -int64_t(raw & 1);
+            if (decoded < std::numeric_limits<RepT>::min() || decoded > std::numeric_limits<RepT>::max()) {
+                seek(pos);
+                return false;
+            }
+            value = static_cast<T>(RepT(decoded));
+        }
+        else {
+            if (raw > std::numeric_limits<RepT>::max()) {
+                seek(pos);
+                return false;
+            }
+            value = static_cast<T>(RepT(raw));
+        }
+        return true;
+    }
+
+    // the total fixed wire size of the leading fixed-size types
+    template <typename T, typename... ArgsT>
+    static constexpr size_t _fixedRunSize() {
+        if constexpr (fixedWireSize<T>() == 0) {
+            return 0;
+        }
+        else if constexpr (sizeof...(ArgsT) == 0) {
+            return fixedWireSize<T>();
+        }
+        else {
+            return fixedWireSize<T>() + _fixedRunSize<ArgsT...>();
+        }
+    }
+
+    // copy the leading fixed-size values to dst and write the rest normally
+    template <typename T, typename... ArgsT>
+    void _writeFixedRun(char* dst, T& value, ArgsT&... args) {
+        if constexpr (fixedWireSize<std::remove_cv_t<T>>() > 0) {
+            _writeFixed(dst, value);
+            _writeFixedRun(dst, args...);
+        }
+        else {
+            writeMany(value, args...);
+        }
+    }
+    void _writeFixedRun(char*) {}
+
+    // copy the leading fixed-size values from src and read the rest normally
+    template <typename T, typename... ArgsT>
+    bool _readFixedRun(const char* src, T& value, ArgsT&... args) {
+        if constexpr (fixedWireSize<T>() > 0) {
+            _readFixed(src, value);
+            return _readFixedRun(src, args...);
+        }
+        else {
+            return readMany(value, args...);
+        }
+    }
+    bool _readFixedRun(const char*) { return true; }
+
+    template <typename T>
+    static void _writeFixed(char*& dst, const T& value) {
+        static_assert(fixedWireSize<T>() > 0, "only fixed-size types can be copied in bulk");
+        if constexpr (isNumericType<T>() || isPayloadCopyableType<T>()) {
+            std::memcpy(dst, (const void*)&value, sizeof(T));
+            dst += sizeof(T);
+        }
+        else {
+            value.__writeFixedFields(dst);
+        }
+    }
+
+    template <typename T>
+    static void _readFixed(const char*& src, T& value) {
+        static_assert(fixedWireSize<T>() > 0, "only fixed-size types can be copied in bulk");
+        if constexpr (isNumericType<T>() || isPayloadCopyableType<T>()) {
+            std::memcpy((void*)&value, src, sizeof(T));
+            src += sizeof(T);
+        }
+        else {
+            value.__readFixedFields(src);
+        }
+    }
+
 private: // deleted
     Payload(const Payload&) = delete;
     Payload& operator=(const Payload&) = delete;
@@ -0,0 +1,188 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "PayloadPool.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace k2 {
+
+namespace {
+// set when the pool of the current thread is destroyed. Memory released after that goes straight to the allocator
+thread_local bool poolDestroyed = false;
+
+constexpr size_t roundUp16(size_t size) { return (size + 15) & ~size_t(15); }
+}
+
+// Placed at the start of each pooled memory block. It is not part of the Block object below, so that it can
+// still be read after seastar has destroyed the Block
+struct alignas(16) PayloadPool::BlockInfo {
+    PayloadPool* owner;
+    size_t sizeClass;
+};
+
+// The deleter for the buffer, placed right after the BlockInfo. The buffer data follows.
+// seastar deletes the deleter once the last Binary sharing the buffer is gone. We take over the deallocation so
+// that the whole block goes back to the pool instead
+struct PayloadPool::Block final : public seastar::deleter::impl {
+    Block() : impl(seastar::deleter()) {}
+    static void operator delete(void* ptr) { PayloadPool::_release(ptr); }
+};
+
+namespace {
+constexpr size_t BLOCK_OFFSET = roundUp16(sizeof(PayloadPool*) + sizeof(size_t));
+// Payload objects are preceded by the pool which allocated them
+constexpr size_t PAYLOAD_OFFSET = roundUp16(sizeof(PayloadPool*));
+}
+
+PayloadPool& PayloadPool::local() {
+    static thread_local PayloadPool pool;
+    return pool;
+}
+
+PayloadPool::~PayloadPool() {
+    poolDestroyed = true;
+    for (auto& freeList : _freeBuffers) {
+        for (auto mem : freeList) {
+            std::free(mem);
+        }
+        freeList.clear();
+    }
+    for (auto mem : _freePayloads) {
+        ::operator delete(mem);
+    }
+    _freePayloads.clear();
+}
+
+size_t PayloadPool::_sizeClass(size_t size) {
+    size_t sc = 0;
+    while (sc < SIZE_CLASSES.size() && SIZE_CLASSES[sc] < size) {
+        ++sc;
+    }
+    return sc;
+}
+
+Binary PayloadPool::getBuffer(size_t size) {
+    auto sc = _sizeClass(size);
+    if (sc == SIZE_CLASSES.size()) {
+        _stats.bufferAllocs++;
+        return Binary(size);
+    }
+
+    static_assert(sizeof(BlockInfo) <= BLOCK_OFFSET);
+    const size_t dataOffset = BLOCK_OFFSET + roundUp16(sizeof(Block));
+    void* mem = nullptr;
+    auto& freeList = _freeBuffers[sc];
+    if (freeList.empty()) {
+        mem = std::malloc(dataOffset + SIZE_CLASSES[sc]);
+        if (mem == nullptr) {
+            throw std::bad_alloc();
+        }
+        _stats.bufferAllocs++;
+    }
+    else {
+        mem = freeList.back();
+        freeList.pop_back();
+        _stats.freeBytes -= SIZE_CLASSES[sc];
+        _stats.bufferReuses++;
+    }
+    ::new (mem) BlockInfo{this, sc};
+    auto block = ::new ((char*)mem + BLOCK_OFFSET) Block();
+    return Binary((char*)mem + dataOffset, size, seastar::deleter(block));
+}
+
+void PayloadPool::_release(void* block) {
+    void* mem = (char*)block - BLOCK_OFFSET;
+    auto info = (BlockInfo*)mem;
+    if (!poolDestroyed) {
+        // blocks released on another core are freed rather than pooled there
+        auto& pool = local();
+        auto classSize = SIZE_CLASSES[info->sizeClass];
+        if (info->owner == &pool && pool._stats.freeBytes + classSize <= pool._maxFreeBytes) {
+            pool._freeBuffers[info->sizeClass].push_back(mem);
+            pool._stats.freeBytes += classSize;
+            return;
+        }
+    }
+    std::free(mem);
+}
+
+BinaryAllocatorFunctor PayloadPool::makeAllocator(size_t bufferSize) {
+    return [bufferSize] {
+        return local().getBuffer(bufferSize);
+    };
+}
+
+void* PayloadPool::allocatePayload(size_t size) {
+    PayloadPool* owner = nullptr;
+    void* mem = nullptr;
+    if (!poolDestroyed) {
+        owner = &local();
+        if (!owner->_freePayloads.empty()) {
+            mem = owner->_freePayloads.back();
+            owner->_freePayloads.pop_back();
+            owner->_stats.payloadReuses++;
+        }
+        else {
+            owner->_stats.payloadAllocs++;
+        }
+    }
+    if (mem == nullptr) {
+        mem = ::operator new(PAYLOAD_OFFSET + size);
+    }
+    *(PayloadPool**)mem = owner;
+    return (char*)mem + PAYLOAD_OFFSET;
+}
+
+void PayloadPool::releasePayload(void* ptr, size_t) {
+    void* mem = (char*)ptr - PAYLOAD_OFFSET;
+    if (!poolDestroyed) {
+        // like buffers, payloads released on another core are freed rather than pooled there
+        auto& pool = local();
+        if (*(PayloadPool**)mem == &pool && pool._freePayloads.size() < MAX_FREE_PAYLOADS) {
+            pool._freePayloads.push_back(mem);
+            return;
+        }
+    }
+    ::operator delete(mem);
+}
+
+void PayloadPool::setMaxFreeBytes(size_t maxFreeBytes) {
+    _maxFreeBytes = maxFreeBytes;
+    // drop what we can't keep anymore
+    for (auto& freeList : _freeBuffers) {
+        auto classSize = SIZE_CLASSES[&freeList - &_freeBuffers[0]];
+        while (!freeList.empty() && _stats.freeBytes > _maxFreeBytes) {
+            std::free(freeList.back());
+            freeList.pop_back();
+            _stats.freeBytes -= classSize;
+        }
+    }
+}
+
+const PayloadPool::Stats& PayloadPool::getStats() const {
+    return _stats;
+}
+
+} // namespace k2
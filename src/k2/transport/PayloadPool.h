@@ -0,0 +1,113 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// third-party
+#include <seastar/core/deleter.hh>
+
+// k2
+#include <k2/common/Common.h>
+
+namespace k2 {
+
+// Per-core pools of payload buffers and Payload objects, so that the transport can reuse the memory from one message
+// to the next instead of going to the allocator for every message.
+// Buffers come in a few size classes. A Binary handed out by the pool carries its own deleter in the pooled memory
+// block, and when the last Binary which shares the buffer goes away, the block goes back to the pool of the core
+// which releases it. Nothing is allocated when a buffer is taken from the pool or returned to it.
+class PayloadPool {
+public: // types
+    // the buffer size classes. Buffers larger than the largest class are not pooled
+    static constexpr std::array<size_t, 4> SIZE_CLASSES{512, 2048, 9216, 16384};
+
+    // payloads which fit in a buffer of this size are served from a single buffer
+    static constexpr size_t SMALL_BUFFER_SIZE = SIZE_CLASSES[0];
+
+    struct Stats {
+        // buffers which had to be allocated, or were too big to pool
+        uint64_t bufferAllocs = 0;
+        // buffers served from the pool
+        uint64_t bufferReuses = 0;
+        // Payload objects which had to be allocated
+        uint64_t payloadAllocs = 0;
+        // Payload objects served from the pool
+        uint64_t payloadReuses = 0;
+        // bytes currently held in the free lists
+        uint64_t freeBytes = 0;
+    };
+
+public: // API
+    // the pool of the current core
+    static PayloadPool& local();
+
+    // Returns a buffer of exactly the given size, backed by memory from the smallest size class which fits
+    Binary getBuffer(size_t size);
+
+    // Returns an allocator which hands out pooled buffers of the given size
+    static BinaryAllocatorFunctor makeAllocator(size_t bufferSize);
+
+    // raw memory for a Payload object. Used by Payload's operator new/delete
+    static void* allocatePayload(size_t size);
+    static void releasePayload(void* ptr, size_t size);
+
+    // Limit the memory kept in the free lists of this pool. Buffers released when the pool is full are freed
+    void setMaxFreeBytes(size_t maxFreeBytes);
+
+    const Stats& getStats() const;
+
+    ~PayloadPool();
+
+private: // types
+    struct BlockInfo;
+    struct Block;
+
+    // the most Payload objects we keep around for reuse
+    static constexpr size_t MAX_FREE_PAYLOADS = 4096;
+
+private: // methods
+    PayloadPool() = default;
+
+    // return the memory block of a released buffer to the pool it came from, or free it
+    static void _release(void* block);
+
+    // the index of the smallest size class which fits the given size, or SIZE_CLASSES.size() if none does
+    static size_t _sizeClass(size_t size);
+
+private: // fields
+    std::array<std::vector<void*>, SIZE_CLASSES.size()> _freeBuffers;
+    std::vector<void*> _freePayloads;
+    size_t _maxFreeBytes = 16 * 1024 * 1024;
+    Stats _stats;
+
+private: // don't need
+    DISABLE_COPY_MOVE(PayloadPool);
+};
+
+} // namespace k2
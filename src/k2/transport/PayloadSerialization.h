@@ -28,7 +28,10 @@ Copyright(c) 2020 Futurewei Cloud
 // General purpose macro for creating serializable structures of any field types.
 // You have to pass your fields here in order for them to be (de)serialized. This macro works for any
 // field types (both primitive/simple as well as nested/complex) but it does the (de)serialization
-// on a field-by-field basis so it may be less efficient than the one-shot macro below
+// on a field-by-field basis so it may be less efficient than the one-shot macro below.
+// Runs of fixed-size fields(numbers, copyable structs, or nested structs made only of such fields) are
+// (de)serialized with a single capacity check. The wire format is the same as field-by-field.
+// The macro has to come after the fields it lists
 #define K2_PAYLOAD_FIELDS(...)                     \
     struct __K2PayloadSerializableTraitTag__ {};   \
     void __writeFields(k2::Payload& payload) const {   \
@@ -36,6 +39,19 @@ Copyright(c) 2020 Futurewei Cloud
     }                                              \
     bool __readFields(k2::Payload& payload) {          \
         return payload.readMany(__VA_ARGS__);      \
+    }                                              \
+    auto __fixedWireSize() const -> decltype(k2::fixedWireSizeOf(__VA_ARGS__)); \
+    template <typename PayloadT = k2::Payload>     \
+    void __writeFixedFields(char*& dst) const {    \
+        PayloadT::writeFixedMany(dst, __VA_ARGS__);    \
+    }                                              \
+    template <typename PayloadT = k2::Payload>     \
+    void __readFixedFields(const char*& src) {     \
+        PayloadT::readFixedMany(src, __VA_ARGS__);     \
+    }                                              \
+    template <typename PayloadT = k2::Payload>     \
+    size_t __serializedSize() const {              \
+        return PayloadT::serializedSizeMany(__VA_ARGS__); \
     }
 
 // This is a macro which can be put on structures which are directly copyable
@@ -92,4 +92,28 @@ void ExponentialHistogram::add(double sample) {
     _histogram.sample_count += 1;           // global count
     _histogram.sample_sum += sample;        // global sum
 }
+
+double ExponentialHistogram::percentile(double pct) const {
+    if (_histogram.sample_count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max(uint64_t(1), uint64_t(std::ceil(_histogram.sample_count * pct / 100.0)));
+    uint64_t total = 0;
+    for (auto& bucket : _histogram.buckets) {
+        total += bucket.count;
+        if (total >= rank) {
+            return bucket.upper_bound;
+        }
+    }
+    return _histogram.buckets.back().upper_bound;
+}
+
+void ExponentialHistogram::merge(const ExponentialHistogram& other) {
+    assert(other._histogram.buckets.size() == _histogram.buckets.size());
+    for (size_t i = 0; i < _histogram.buckets.size(); ++i) {
+        _histogram.buckets[i].count += other._histogram.buckets[i].count;
+    }
+    _histogram.sample_count += other._histogram.sample_count;
+    _histogram.sample_sum += other._histogram.sample_sum;
+}
 }// namespace k2
@@ -127,6 +127,12 @@ public:
         add(sample_usecs.count());
     }
 
+    // the upper bound of the bucket holding the given percentile(0..100) of the samples, 0 if there are no samples
+    double percentile(double pct) const;
+
+    // add the samples of another histogram, created with the same parameters
+    void merge(const ExponentialHistogram& other);
+
 private:
     double _rate;
     double _lograte;
@@ -21,7 +21,10 @@ Copyright(c) 2020 Futurewei Cloud
     SOFTWARE.
 */
 
+#include <algorithm>
 #include <cstdlib>
+#include <string_view>
+#include <seastar/core/metrics.hh>
 #include <seastar/core/sleep.hh>
 
 #include <k2/common/Log.h>
@@ -35,6 +38,11 @@ RPCDispatcher::Dist_t ___RPC___;
 RPCDispatcher::RPCDispatcher() : _msgSequenceID(uint32_t(std::rand())) {
     K2DEBUG("ctor");
     registerLowTransportMemoryObserver(nullptr);
+    _rrWheel.resize(std::max(_rrWheelSlots(), 2u));
+    _rrWheelTimer.set_callback([this] { _wheelTick(); });
+    for (auto verb: _compactVerbsConfig()) {
+        setCompactEncoding(Verb(verb), true);
+    }
 }
 
 RPCDispatcher::~RPCDispatcher() {
@@ -91,6 +99,32 @@ void RPCDispatcher::registerMessageObserver(Verb verb, RequestObserver_t observe
     if (!emplace_pair.second) {
         throw DuplicateRegistrationException();
     }
+    _getVerbStats(verb);
+}
+
+RPCDispatcher::VerbStats& RPCDispatcher::_getVerbStats(Verb verb) {
+    auto& stats = _verbStats[verb];
+    if (stats) {
+        return *stats;
+    }
+    stats = std::make_unique<VerbStats>();
+    namespace sm = seastar::metrics;
+    std::vector<sm::label_instance> labels{sm::label_instance("verb", int(verb))};
+    _metricGroups.add_group("rpc", {
+        sm::make_counter("requests_received", stats->requestsReceived, sm::description("Requests received"), labels),
+        sm::make_counter("request_bytes_received", stats->requestBytesReceived, sm::description("Payload bytes in received requests"), labels),
+        sm::make_counter("reply_bytes_sent", stats->replyBytesSent, sm::description("Payload bytes in sent replies"), labels),
+        sm::make_counter("server_errors", stats->serverErrors, sm::description("Requests which failed to parse, failed in the handler or got a non-2xx status"), labels),
+        sm::make_counter("shed_requests", stats->shedCount, sm::description("Requests dropped since their deadline passed before dispatch"), labels),
+        sm::make_histogram("handler_latency", [&h=stats->handlerLatency] { return h.getHistogram(); }, sm::description("Latency of RPC handlers in usecs"), labels),
+        sm::make_counter("requests_sent", stats->requestsSent, sm::description("Requests sent"), labels),
+        sm::make_counter("request_bytes_sent", stats->requestBytesSent, sm::description("Payload bytes in sent requests"), labels),
+        sm::make_counter("reply_bytes_received", stats->replyBytesReceived, sm::description("Payload bytes in received replies"), labels),
+        sm::make_counter("client_timeouts", stats->clientTimeouts, sm::description("Requests which timed out waiting for a reply"), labels),
+        sm::make_counter("client_errors", stats->clientErrors, sm::description("Requests which failed to send, or got an unparsable or non-2xx reply"), labels),
+        sm::make_histogram("round_trip_latency", [&h=stats->roundTripLatency] { return h.getHistogram(); }, sm::description("Latency from request to reply in usecs"), labels)
+    });
+    return *stats;
 }
 
 void RPCDispatcher::start() {
@@ -105,37 +139,65 @@ seastar::future<> RPCDispatcher::stop() {
         proto.second->setMessageObserver(nullptr);
     }
     _protocols.clear();
+    _endpoints.clear();
+    _metricGroups.clear();
 
     // complete all promises
-    for(auto&& promise: _rrPromises) {
-        promise.second.promise.set_exception(DispatcherShutdown());
+    _rrWheelTimer.cancel();
+    for(auto&& tracker: _rrSlab) {
+        if (tracker.active) {
+            tracker.active = false;
+            tracker.promise.set_exception(DispatcherShutdown());
+        }
+    }
+    _rrSlab.clear();
+    _rrFreeSlots.clear();
+    _rrOutstanding = 0;
+    for (auto& slot: _rrWheel) {
+        slot.clear();
     }
-    _rrPromises.clear();
     return seastar::make_ready_future<>();
 }
 
 // Process new messages received from protocols
 void RPCDispatcher::_handleNewMessage(Request&& request) {
     K2DEBUG("handling request for verb="<< int(request.verb) <<", from ep="<< request.endpoint.getURL());
+    if (request.metadata.isCompactEncodingSet()) {
+        request.payload->setCompactEncoding(true);
+    }
     // see if this is a response
     if (request.metadata.isResponseIDSet()) {
+        // we only send deadlines and compact requests to peers which have replied with a version which can decode them
+        _peerVersions[request.endpoint] = request.metadata.version;
         // process as a response
-        auto nodei = _rrPromises.find(request.metadata.responseID);
-        if (nodei == _rrPromises.end()) {
+        auto tracker = _findTracker(request.metadata.responseID);
+        if (tracker == nullptr) {
             K2DEBUG("no handler for response for msgid: " << request.metadata.responseID )
             // TODO emit metric for RR without msid
             return;
         }
-        // we have a response
-        nodei->second.timer.cancel();
-        nodei->second.promise.set_value(std::move(request.payload));
-        _rrPromises.erase(nodei);
+        auto& stats = _getVerbStats(tracker->verb);
+        stats.roundTripLatency.add(Clock::now() - tracker->sent);
+        stats.replyBytesReceived += request.payload ? request.payload->getDataRemaining() : 0;
+        // we have a response. The wheel entry for this request is dropped lazily when its slot comes up
+        auto prom = std::move(tracker->promise);
+        _releaseTracker(request.metadata.responseID);
+        prom.set_value(std::move(request.payload));
         return;
     }
     auto iter = _observers.find(request.verb);
     if (iter != _observers.end()) {
+        auto& stats = _getVerbStats(request.verb);
+        stats.requestsReceived++;
+        stats.requestBytesReceived += request.payload ? request.payload->getDataRemaining() : 0;
+        if (request.deadline != TimePoint::max() && Clock::now() >= request.deadline) {
+            // the sender has already given up on this request. Don't spend any more resources on it
+            K2DEBUG("Shedding expired request for verb="<< int(request.verb) <<", from ep="<< request.endpoint.getURL());
+            stats.shedCount++;
+            return;
+        }
         K2DEBUG("Dispatching request for verb="<< int(request.verb) <<", from ep="<< request.endpoint.getURL());
-        // TODO emit verb-dimension metric for duration of handling
+        _dispatchDeadline = request.deadline;
         try {
             iter->second(std::move(request));
         } catch (std::exception& exc) {
@@ -143,6 +205,7 @@ void RPCDispatcher::_handleNewMessage(Request&& request) {
         } catch (...) {
             K2ERROR("Caught unknown exception while dispatching request");
         }
+        _dispatchDeadline = TimePoint::max();
     }
     else {
         K2DEBUG("no observer for verb " << request.verb << ", from " << request.endpoint.getURL());
@@ -151,6 +214,9 @@ void RPCDispatcher::_handleNewMessage(Request&& request) {
 }
 
 void RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata meta) {
+    if (payload->isCompactEncoding()) {
+        meta.setCompactEncoding();
+    }
 
     auto protoi = _protocols.find(endpoint.getProtocol());
     if (protoi == _protocols.end()) {
@@ -168,6 +234,8 @@ void RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoin
                     // rewind the payload to the correct position
                     payload->seek(txconstants::MAX_HEADER_SIZE);
                     meta.setPayloadSize(payload->getDataRemaining());
+                    // mark the arrival time for the request deadline, as the transport would
+                    CachedSteadyClock::now(true);
                     disp->_handleNewMessage(Request(verb, endpoint, std::move(meta), std::move(payload)));
                 }
         });
@@ -186,39 +254,217 @@ void RPCDispatcher::sendReply(std::unique_ptr<Payload> payload, Request& forRequ
     K2DEBUG("Reply send for request: " << forRequest.metadata.requestID);
     MessageMetadata metadata;
     metadata.setResponseID(forRequest.metadata.requestID);
+    _getVerbStats(forRequest.verb).replyBytesSent += payload->getSize() - txconstants::MAX_HEADER_SIZE;
     _send(InternalVerbs::NIL, std::move(payload), forRequest.endpoint, std::move(metadata));
 }
 
 seastar::future<std::unique_ptr<Payload>>
-RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout) {
-    uint64_t msgid = _msgSequenceID++;
+RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout, uint64_t orderKey) {
+    if (_rrOutstanding > TRACKER_INDEX_MASK) {
+        K2WARN("too many outstanding requests: " << _rrOutstanding);
+        return seastar::make_exception_future<std::unique_ptr<Payload>>(std::runtime_error("too many outstanding requests"));
+    }
+    uint32_t msgid = _allocTracker();
     K2DEBUG("Request send with msgid=" << msgid << ", timeout=" << timeout << ", ep=" << endpoint.getURL());
 
-    // the promise gets fulfilled when prom for this msgid comes back.
-    PayloadPromise prom;
     // record the promise so that we can fulfil it if we get a response
-    MessageMetadata metadata;
-    metadata.setRequestID(msgid);
-
-    _send(verb, std::move(payload), endpoint, std::move(metadata));
+    auto& tracker = _rrSlab[msgid & TRACKER_INDEX_MASK];
+    tracker.sent = Clock::now();
+    tracker.deadline = tracker.sent + timeout;
+    tracker.verb = verb;
+    auto& stats = _getVerbStats(verb);
+    stats.requestsSent++;
+    stats.requestBytesSent += payload->getSize() - txconstants::MAX_HEADER_SIZE;
+    auto fut = tracker.promise.get_future();
+    _wheelInsert(msgid, timeout);
+
+    auto capacity = waitForCapacity(endpoint);
+    if (capacity.available() && !capacity.failed()) {
+        MessageMetadata metadata;
+        metadata.setRequestID(msgid);
+        // let the server know when we give up on this request
+        if (_peerHasVersion(endpoint, txconstants::K2RPC_DEADLINE_VERSION)) {
+            metadata.setDeadline(timeout);
+        }
+        metadata.orderKey = orderKey;
+        _send(verb, std::move(payload), endpoint, std::move(metadata));
+        return fut;
+    }
 
-    seastar::timer<> timer([this, msgid] {
-        // raise an exception in the promise for this request.
-        K2DEBUG("send request timed out for msgid=" << msgid);
-        // TODO emit metric for timeout
-        auto iter = this->_rrPromises.find(msgid);
-        assert(iter != this->_rrPromises.end());
-        iter->second.promise.set_exception(RequestTimeoutException());
-        this->_rrPromises.erase(iter);
+    // the transport is backed up for this endpoint. Send once there is room, unless we time out first in which
+    // case the caller sees a (retryable) timeout. If the wait itself fails, the caller sees a (retryable) send failure
+    K2DEBUG("waiting for send capacity for msgid=" << msgid << ", ep=" << endpoint.getURL());
+    (void)capacity.then([disp=weak_from_this(), msgid, verb, orderKey, payload=std::move(payload), endpoint=TXEndpoint(endpoint)] () mutable {
+        if (!disp) return;
+        auto tracker = disp->_findTracker(msgid);
+        if (tracker == nullptr) {
+            K2DEBUG("request msgid=" << msgid << " completed while waiting for send capacity");
+            return;
+        }
+        MessageMetadata metadata;
+        metadata.setRequestID(msgid);
+        if (disp->_peerHasVersion(endpoint, txconstants::K2RPC_DEADLINE_VERSION)) {
+            metadata.setDeadline(tracker->deadline - Clock::now());
+        }
+        metadata.orderKey = orderKey;
+        disp->_send(verb, std::move(payload), endpoint, std::move(metadata));
+    }).handle_exception([disp=weak_from_this(), msgid](auto exc) {
+        K2WARN_EXC("failed waiting for send capacity", exc);
+        if (!disp) return;
+        auto tracker = disp->_findTracker(msgid);
+        if (tracker == nullptr) {
+            return;
+        }
+        // fail the request now rather than let the caller wait for the timeout
+        disp->_getVerbStats(tracker->verb).clientErrors++;
+        auto prom = std::move(tracker->promise);
+        disp->_releaseTracker(msgid);
+        prom.set_exception(SendFailedException());
     });
-    timer.arm(timeout);
-
-    auto fut = prom.get_future();
-    _rrPromises.emplace(msgid, ResponseTracker{std::move(prom), std::move(timer)});
 
     return fut;
 }
 
+seastar::future<> RPCDispatcher::waitForCapacity(TXEndpoint& endpoint) {
+    auto protoi = _protocols.find(endpoint.getProtocol());
+    if (protoi == _protocols.end()) {
+        // _send will complain about the protocol
+        return seastar::make_ready_future();
+    }
+    return protoi->second->waitForCapacity(endpoint);
+}
+
+uint32_t RPCDispatcher::_allocTracker() {
+    uint32_t index;
+    if (_rrFreeSlots.empty() || _rrSlab.size() < TRACKER_MIN_SLOTS) {
+        index = uint32_t(_rrSlab.size());
+        _rrSlab.emplace_back();
+        _rrSlab.back().generation = (_msgSequenceID + index) & TRACKER_GENERATION_MASK;
+    }
+    else {
+        // the slot which has been free the longest
+        index = _rrFreeSlots.front();
+        _rrFreeSlots.pop_front();
+    }
+    auto& tracker = _rrSlab[index];
+    tracker.active = true;
+    tracker.promise = PayloadPromise();
+    ++_rrOutstanding;
+    return (tracker.generation << TRACKER_INDEX_BITS) | index;
+}
+
+RPCDispatcher::ResponseTracker* RPCDispatcher::_findTracker(uint32_t msgid) {
+    uint32_t index = msgid & TRACKER_INDEX_MASK;
+    if (index >= _rrSlab.size()) {
+        return nullptr;
+    }
+    auto& tracker = _rrSlab[index];
+    if (!tracker.active || tracker.generation != (msgid >> TRACKER_INDEX_BITS)) {
+        return nullptr;
+    }
+    return &tracker;
+}
+
+void RPCDispatcher::_releaseTracker(uint32_t msgid) {
+    uint32_t index = msgid & TRACKER_INDEX_MASK;
+    auto& tracker = _rrSlab[index];
+    tracker.active = false;
+    tracker.generation = (tracker.generation + 1) & TRACKER_GENERATION_MASK;
+    _rrFreeSlots.push_back(index);
+    --_rrOutstanding;
+}
+
+void RPCDispatcher::_wheelInsert(uint32_t msgid, Duration timeout) {
+    // round up so that we never fire early. Timeouts which don't fit in the wheel get re-inserted on expiry
+    auto tick = _rrWheelTickInterval();
+    size_t ticks = timeout <= tick ? 1 : (timeout.count() + tick.count() - 1) / tick.count();
+    ticks = std::min(ticks, _rrWheel.size() - 1);
+    _rrWheel[(_rrWheelPos + ticks) % _rrWheel.size()].push_back(msgid);
+
+    if (!_rrWheelTimer.armed()) {
+        _rrWheelLastTick = Clock::now();
+        _rrWheelTimer.arm_periodic(tick);
+    }
+}
+
+void RPCDispatcher::_wheelTick() {
+    auto now = Clock::now();
+    auto tick = _rrWheelTickInterval();
+    // catch up on any ticks we missed if the reactor was busy, but don't spin around more than once
+    size_t ticks = std::max(size_t((now - _rrWheelLastTick) / tick), size_t(1));
+    ticks = std::min(ticks, _rrWheel.size());
+    _rrWheelLastTick = now;
+
+    std::vector<uint32_t> expired;
+    for (size_t i = 0; i < ticks; ++i) {
+        _rrWheelPos = (_rrWheelPos + 1) % _rrWheel.size();
+        // swap out the slot since re-insertion may target the same slot
+        expired.clear();
+        expired.swap(_rrWheel[_rrWheelPos]);
+        for (auto msgid: expired) {
+            auto tracker = _findTracker(msgid);
+            if (tracker == nullptr) {
+                // already completed
+                continue;
+            }
+            if (tracker->deadline > now) {
+                _wheelInsert(msgid, tracker->deadline - now);
+                continue;
+            }
+            // raise an exception in the promise for this request.
+            K2DEBUG("send request timed out for msgid=" << msgid);
+            _getVerbStats(tracker->verb).clientTimeouts++;
+            auto prom = std::move(tracker->promise);
+            _releaseTracker(msgid);
+            prom.set_exception(RequestTimeoutException());
+        }
+        // keep the allocated capacity around
+        if (_rrWheel[_rrWheelPos].empty()) {
+            _rrWheel[_rrWheelPos].swap(expired);
+            _rrWheel[_rrWheelPos].clear();
+        }
+    }
+
+    if (_rrOutstanding == 0) {
+        // nothing to track. Any leftover entries in the wheel are stale and will be skipped when re-armed
+        _rrWheelTimer.cancel();
+    }
+}
+
+void RPCDispatcher::setCompactEncoding(Verb verb, bool enabled) {
+    K2DEBUG("compact encoding for verb=" << int(verb) << ": " << enabled);
+    _compactVerbs.set(verb, enabled);
+}
+
+std::unique_ptr<Payload> RPCDispatcher::newReplyPayload(Request& forRequest, size_t sizeHint) {
+    auto payload = forRequest.endpoint.newPayload(sizeHint);
+    payload->setCompactEncoding(forRequest.payload->isCompactEncoding());
+    return payload;
+}
+
+bool RPCDispatcher::_useCompactEncoding(Verb verb, const TXEndpoint& endpoint) const {
+    if (!_compactVerbs.test(verb)) {
+        return false;
+    }
+    return _peerHasVersion(endpoint, txconstants::K2RPC_COMPACT_VERSION);
+}
+
+bool RPCDispatcher::_peerHasVersion(const TXEndpoint& endpoint, uint8_t version) const {
+    auto iter = _peerVersions.find(endpoint);
+    return iter != _peerVersions.end() && iter->second >= version;
+}
+
+Duration RPCDispatcher::getRequestBudget(Duration maxBudget) const {
+    if (_dispatchDeadline == TimePoint::max()) {
+        return maxBudget;
+    }
+    auto now = Clock::now();
+    if (now >= _dispatchDeadline) {
+        return Duration(0);
+    }
+    return std::min(maxBudget, _dispatchDeadline - now);
+}
+
 void RPCDispatcher::registerLowTransportMemoryObserver(LowTransportMemoryObserver_t observer) {
     K2DEBUG("register low mem observer");
     if (observer == nullptr) {
@@ -234,6 +480,9 @@ void RPCDispatcher::registerLowTransportMemoryObserver(LowTransportMemoryObserve
 
 std::unique_ptr<TXEndpoint> RPCDispatcher::getTXEndpoint(String url) {
     K2DEBUG("get endpoint for " << url)
+    if (auto it = _endpoints.find(url); it != _endpoints.end()) {
+        return std::make_unique<TXEndpoint>(it->second);
+    }
     // temporary endpoint just so that we can see what the protocol is supposed to be
     auto ep = TXEndpoint::fromURL(url, nullptr);
     if (!ep) {
@@ -246,7 +495,11 @@ std::unique_ptr<TXEndpoint> RPCDispatcher::getTXEndpoint(String url) {
         K2WARN("Unsupported protocol: "<< ep->getProtocol());
         return nullptr;
     }
-    return protoi->second->getTXEndpoint(std::move(url));
+    auto result = protoi->second->getTXEndpoint(url);
+    if (result) {
+        _endpoints.emplace(std::move(url), *result);
+    }
+    return result;
 }
 
 seastar::lw_shared_ptr<TXEndpoint> RPCDispatcher::getServerEndpoint(const String& protocol) {
@@ -258,6 +511,26 @@ seastar::lw_shared_ptr<TXEndpoint> RPCDispatcher::getServerEndpoint(const String
     return protoi->second->getServerEndpoint();
 }
 
+bool RPCDispatcher::isSupportedProtocol(const String& protocol) const {
+    return _protocols.find(protocol) != _protocols.end();
+}
+
+bool RPCDispatcher::isSupportedURL(const String& url) const {
+    std::string_view view(url.data(), url.size());
+    auto end = view.find("://");
+    if (end == std::string_view::npos) {
+        return false;
+    }
+    // there are only a few protocols, and comparing views doesn't allocate like a lookup by String would
+    auto protocol = view.substr(0, end);
+    for (const auto& kvp: _protocols) {
+        if (std::string_view(kvp.first.data(), kvp.first.size()) == protocol) {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::vector<seastar::lw_shared_ptr<TXEndpoint>> RPCDispatcher::getServerEndpoints() const {
     std::vector<seastar::lw_shared_ptr<TXEndpoint>> result;
     for(const auto& kvp : _protocols) {
@@ -24,19 +24,26 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 // stl
+#include <array>
+#include <deque>
 #include <functional>
 #include <unordered_map>
+#include <vector>
+#include <bitset>
 #include <exception>
 
 // third party
 #include <seastar/core/distributed.hh>
+#include <seastar/core/metrics_registration.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
 #include <seastar/core/weak_ptr.hh>
 #include <seastar/util/reference_wrapper.hh> // for seastar::ref
 
 // k2
 #include <k2/common/Common.h>
 #include <k2/config/Config.h>
+#include "Prometheus.h"
 #include "RPCProtocolFactory.h"
 #include "Request.h"
 #include "Status.h"
@@ -81,6 +88,12 @@ public: // types
         virtual const char* what() const noexcept override{ return "request timed out";}
     };
 
+    // delivered to the promise of a request which we could not send(e.g. the connection failed while the request
+    // was waiting for send capacity). Like a timeout, the request may be retried
+    struct SendFailedException : public std::exception {
+        virtual const char* what() const noexcept override{ return "request could not be sent";}
+    };
+
 public:
     // Construct an RPC dispatcher
     RPCDispatcher();
@@ -124,42 +137,80 @@ public: // message-oriented API
     // 1. obtain protocol-specific payloads
     // 2. send messages.
     // returns blank pointer if we failed to parse the url or if the protocol is not supported
+    // Endpoints are interned per core: each url is parsed once and later calls return a copy which shares
+    // the state of the first endpoint, so getting and copying an endpoint is cheap
     std::unique_ptr<TXEndpoint> getTXEndpoint(String url);
 
     // Returns the listener endpoint for the given protocol (or empty pointer if not supported)
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint(const String& protocol);
 
+    // Returns true if a protocol with the given name has been registered
+    bool isSupportedProtocol(const String& protocol) const;
+
+    // Returns true if the protocol of the given url(the part before "://") has been registered. This doesn't parse
+    // the url, so it is cheap enough to filter the urls of every lookup
+    bool isSupportedURL(const String& url) const;
+
     //  List all server endpoint supported by this dispatcher
     std::vector<seastar::lw_shared_ptr<TXEndpoint>> getServerEndpoints() const;
 
     // Invokes the remote rpc for the given verb with the given payload. This is an asynchronous API. No guarantees
     // are made on the delivery of the payload after the call returns.
     // This is a lower-level API which is useful for sending messages that do not expect replies.
+    // Messages are always queued by the transport. Callers which send a lot of messages should use waitForCapacity()
+    // below to avoid queueing without bounds to a slow peer.
     void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint);
 
+    // Returns a future which completes when the transport has room to queue more messages for the given endpoint.
+    // This is the backpressure signal for the transport's per-channel send budgets.
+    seastar::future<> waitForCapacity(TXEndpoint& endpoint);
+
     // Invokes the remote rpc for the given verb with the given payload. This is an asynchronous API. No guarantees
     // are made on the delivery of the payload.
     // This API is provided to allow users to send requests which expect replies (as opposed to send() above).
     // The method provides a future<> based callback support via the return value.
     // The future will complete with exception if the given timeout is reached before we receive a response.
     // if we receive a response after the timeout is reached, we will ignore it internally.
+    // If the transport is over its send budget for the endpoint, the request is held back until there is room. The
+    // time spent waiting counts towards the timeout.
+    // Transports may spread requests to an endpoint over several connections, so requests can arrive out of order.
+    // Requests with the same non-zero orderKey(e.g. those of one transaction) are kept on one connection
     seastar::future<std::unique_ptr<Payload>>
-    sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout);
+    sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout, uint64_t orderKey=0);
 
     // Use this method to reply to a given Request, with the given payload. This method should be normally used
     // in message observers to respond to clients.
     void sendReply(std::unique_ptr<Payload> payload, Request& forRequest);
 
+    // Returns the time budget left for the request which is currently being dispatched, capped at the given maxBudget.
+    // This should be called synchronously from a message observer so that any nested calls made while handling the
+    // request inherit the deadline of the caller. Outside of an observer call, maxBudget is returned.
+    Duration getRequestBudget(Duration maxBudget) const;
+
+    // Selects the compact payload encoding(varints, delta-encoded timestamps) for the given verb. It applies to
+    // requests sent with callRPC() once the peer has shown it can decode them, and the replies from
+    // registerRPCObserver() handlers use the same encoding as the request.
+    // Verbs can also be selected with the rpc_compact_verbs option
+    void setCompactEncoding(Verb verb, bool enabled);
+
+    // Creates a payload for a reply to the given request, in the same encoding as the request payload.
+    // The sizeHint is the number of bytes the caller is about to write, if known
+    std::unique_ptr<Payload> newReplyPayload(Request& forRequest, size_t sizeHint=0);
+
 public: // RPC-oriented interface. Small convenience so that users don't have to deal with Payloads directly
     // Same as sendRequest but for RPC types, not raw payloads
     template<class Request_t, class Response_t>
-    seastar::future<std::tuple<Status, Response_t>> callRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout) {
-        auto payload = endpoint.newPayload();
+    seastar::future<std::tuple<Status, Response_t>> callRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout, uint64_t orderKey=0) {
+        // allocate all the memory we need up front
+        auto requestSize = Payload::serializedSize(request);
+        auto payload = endpoint.newPayload(requestSize);
+        payload->setCompactEncoding(_useCompactEncoding(verb, endpoint));
+        payload->ensureCapacity(payload->getSize() + requestSize);
         payload->write(request);
         K2DEBUG("RPC Request call to endpoint: " << endpoint.getURL());
 
-        return sendRequest(verb, std::move(payload), endpoint, timeout)
-            .then([](std::unique_ptr<Payload>&& responsePayload) {
+        return sendRequest(verb, std::move(payload), endpoint, timeout, orderKey)
+            .then([disp=weak_from_this(), verb](std::unique_ptr<Payload>&& responsePayload) {
                 // parse status
                 auto result = std::make_tuple<Status, Response_t>(Status(), Response_t());
                 if (!responsePayload->read(std::get<0>(result))) {
@@ -171,22 +222,32 @@ public: // RPC-oriented interface. Small convenience so that users don't have to
                         std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to parse response object");
                     }
                 }
+                if (disp && !std::get<0>(result).is2xxOK()) {
+                    disp->_getVerbStats(verb).clientErrors++;
+                }
                 return result;
             })
-            .handle_exception([](auto exc) {
+            .handle_exception([disp=weak_from_this(), verb](auto exc) {
                 try {
                     std::rethrow_exception(exc);
                 }
                 catch (const RPCDispatcher::RequestTimeoutException&) {
+                    // counted as a timeout when the request expired
                     return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("client timed out"), Response_t());
                 }
+                catch (const RPCDispatcher::SendFailedException&) {
+                    // counted as a client error when the send failed
+                    return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("unable to send request"), Response_t());
+                }
                 catch (const std::exception &e) {
                     K2ERROR("RPC send failed with uncaught exception: " << e.what());
                 }
                 catch (...) {
                     K2ERROR("RPC send failed with unknown exception");
                 }
-
+                if (disp) {
+                    disp->_getVerbStats(verb).clientErrors++;
+                }
                 return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("unknown exception while sending request"), Response_t());
             });
     }
@@ -204,22 +265,32 @@ public: // RPC-oriented interface. Small convenience so that users don't have to
                     if (!disp) return seastar::make_ready_future();
 
                     if (!request.payload->read(rpcRequest)) {
-                        auto reply = request.endpoint.newPayload();
+                        disp->_getVerbStats(request.verb).serverErrors++;
+                        auto reply = disp->newReplyPayload(request);
                         reply->write(Statuses::S400_Bad_Request("unable to parse incoming request"));
                         disp->sendReply(std::move(reply), request);
                         return seastar::make_ready_future();
                     }
-                    // if disp was still alive, it's safe to call observer
+                    // if disp was still alive, it's safe to call observer. The deadline for the request is
+                    // still current here so the observer can use getRequestBudget()
+                    auto start = Clock::now();
                     return observer(std::move(rpcRequest))
-                        .then([&](auto&& result) mutable {
+                        .then([&, start](auto&& result) mutable {
                             if (!disp) {
                                 K2WARN("dispatcher is going down: unable to send response to " << request.endpoint.getURL());
                                 return;
                             }
 
                             auto& [status, response] = result;
+                            auto& stats = disp->_getVerbStats(request.verb);
+                            stats.handlerLatency.add(Clock::now() - start);
+                            if (!status.is2xxOK()) {
+                                stats.serverErrors++;
+                            }
                             // write out the status first
-                            auto reply = request.endpoint.newPayload();
+                            auto replySize = Payload::serializedSizeMany(status, response);
+                            auto reply = disp->newReplyPayload(request, replySize);
+                            reply->ensureCapacity(reply->getSize() + replySize);
                             reply->write(status);
                             // write out the Response_t
                             reply->write(response);
@@ -228,7 +299,8 @@ public: // RPC-oriented interface. Small convenience so that users don't have to
                         .handle_exception([&](auto exc) mutable {
                             K2ERROR_EXC("RPC handler failed with uncaught exception", exc);
                             if (disp) {
-                                auto reply = request.endpoint.newPayload();
+                                disp->_getVerbStats(request.verb).serverErrors++;
+                                auto reply = disp->newReplyPayload(request);
                                 reply->write(Statuses::S500_Internal_Server_Error("server caught exception processing request"));
                                 reply->write(Response_t{});
                                 disp->sendReply(std::move(reply), request);
@@ -245,6 +317,32 @@ private:  // methods
     // Helper method useds to send messages
     void _send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata meta);
 
+    // grab a free tracker slot from the slab and return the request id for it
+    uint32_t _allocTracker();
+
+    // return the tracker for the given request id or nullptr if the id is stale/unknown
+    struct ResponseTracker;
+    ResponseTracker* _findTracker(uint32_t msgid);
+
+    // return the tracker slot for the given request id back to the slab
+    void _releaseTracker(uint32_t msgid);
+
+    // place the given request id into the timer wheel slot which covers the given timeout
+    void _wheelInsert(uint32_t msgid, Duration timeout);
+
+    // called on each wheel tick to expire requests whose deadline has passed
+    void _wheelTick();
+
+    // the stats for the given verb. The stats and their metrics are created on first use
+    struct VerbStats;
+    VerbStats& _getVerbStats(Verb verb);
+
+    // true if a request for the given verb to the given endpoint should use the compact encoding
+    bool _useCompactEncoding(Verb verb, const TXEndpoint& endpoint) const;
+
+    // true if we've had a reply from the given endpoint with at least the given RPC version
+    bool _peerHasVersion(const TXEndpoint& endpoint, uint8_t version) const;
+
 private: // fields
     // the protocols this dispatcher will be able to support
     std::unordered_map<String, seastar::shared_ptr<IRPCProtocol>> _protocols;
@@ -252,21 +350,87 @@ private: // fields
     // the message observers
     std::unordered_map<Verb, RequestObserver_t> _observers;
 
+    // interned endpoints, by the url they were requested with
+    std::unordered_map<String, TXEndpoint> _endpoints;
+
     // to track the request-reply promises and timeouts
     typedef seastar::promise<std::unique_ptr<Payload>> PayloadPromise;
     struct ResponseTracker {
         PayloadPromise promise;
-        seastar::timer<> timer;
+        TimePoint deadline;
+        // when and for which verb the request was sent, for the client-side stats
+        TimePoint sent;
+        Verb verb = InternalVerbs::NIL;
+        // bumped every time the slot is reused so that late replies for a previous request are ignored
+        uint32_t generation = 0;
+        bool active = false;
     };
 
-    // map of all pending request-reply
-    std::unordered_map<uint64_t, ResponseTracker> _rrPromises;
+    // Request ids index directly into the slab of trackers: the low bits are the slot index and
+    // the high bits are the slot generation at the time the request was sent
+    static constexpr uint32_t TRACKER_INDEX_BITS = 16;
+    static constexpr uint32_t TRACKER_INDEX_MASK = (1u << TRACKER_INDEX_BITS) - 1;
+    static constexpr uint32_t TRACKER_GENERATION_MASK = (1u << (32 - TRACKER_INDEX_BITS)) - 1;
+    // Free slots are reused in FIFO order, and the slab grows to at least this many slots before we reuse any.
+    // A slot then comes back at most once every TRACKER_MIN_SLOTS requests, so its generation takes
+    // TRACKER_MIN_SLOTS * 2^16 requests to wrap around. That is minutes at full speed, far longer than any late
+    // reply(or retransmitted reply) can be around
+    static constexpr uint32_t TRACKER_MIN_SLOTS = 4096;
+
+    // slab of all request-reply trackers and the queue of currently free slots in it
+    std::vector<ResponseTracker> _rrSlab;
+    std::deque<uint32_t> _rrFreeSlots;
+    size_t _rrOutstanding = 0;
+
+    // Coarse timer wheel for request timeouts. Each slot holds the request ids which may expire in
+    // that tick. Replies don't touch the wheel - entries for completed requests are skipped lazily
+    // and requests with timeouts longer than the wheel span are re-inserted until they expire
+    std::vector<std::vector<uint32_t>> _rrWheel;
+    size_t _rrWheelPos = 0;
+    TimePoint _rrWheelLastTick;
+    seastar::timer<> _rrWheelTimer;
+    ConfigDuration _rrWheelTickInterval{"rpc_timeout_tick", 1ms};
+    ConfigVar<uint32_t> _rrWheelSlots{"rpc_timeout_wheel_slots", 1024};
 
     // our observer for low memory events
     LowTransportMemoryObserver_t _lowMemObserver;
 
-    // sequence id used for request-reply
-    // TODO use something a bit stronger than simple increment integer
+    // deadline of the request currently being dispatched to an observer
+    TimePoint _dispatchDeadline = TimePoint::max();
+
+    // per-verb stats, reported with a verb label. Latencies are in usecs
+    struct VerbStats {
+        // server side
+        uint64_t requestsReceived = 0;
+        uint64_t requestBytesReceived = 0;
+        uint64_t replyBytesSent = 0;
+        // non-2xx replies, requests we couldn't parse and handler exceptions
+        uint64_t serverErrors = 0;
+        // requests dropped because their deadline had passed before we could dispatch them
+        uint64_t shedCount = 0;
+        // from the start of the RPC handler until its reply is ready
+        ExponentialHistogram handlerLatency;
+
+        // client side
+        uint64_t requestsSent = 0;
+        uint64_t requestBytesSent = 0;
+        uint64_t replyBytesReceived = 0;
+        uint64_t clientTimeouts = 0;
+        // non-2xx replies, replies we couldn't parse and failed sends. Timeouts are counted separately
+        uint64_t clientErrors = 0;
+        // from sending the request until its reply is received
+        ExponentialHistogram roundTripLatency;
+    };
+    // indexed by verb so that the hot path doesn't need a lookup
+    std::array<std::unique_ptr<VerbStats>, std::numeric_limits<Verb>::max() + 1> _verbStats;
+    seastar::metrics::metric_groups _metricGroups;
+
+    // verbs which use the compact encoding, and the RPC versions of the peers we've had replies from
+    std::bitset<std::numeric_limits<Verb>::max() + 1> _compactVerbs;
+    std::unordered_map<TXEndpoint, uint8_t> _peerVersions;
+    ConfigVar<std::vector<int>> _compactVerbsConfig{"rpc_compact_verbs"};
+
+    // starting generation for newly created tracker slots
     uint32_t _msgSequenceID;
 
 private: // don't need
@@ -23,6 +23,8 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "RPCHeader.h"
 
+#include <algorithm>
+
 namespace k2 {
 
 void MessageMetadata::setPayloadSize(uint32_t payloadSize) {
@@ -71,11 +73,57 @@ bool MessageMetadata::isChecksumSet() const {
     return this->features & (1 << 3);  // bit3
 }
 
+void MessageMetadata::setDeadline(Duration budget) {
+    K2DEBUG("Set deadline=" << budget);
+    // saturate for very long budgets(~71min)
+    int64_t count = usec(budget).count();
+    this->deadline = count <= 0 ? 0 : uint32_t(std::min<int64_t>(count, UINT32_MAX));
+    this->features |= (1 << 4);  // bit4
+}
+
+bool MessageMetadata::isDeadlineSet() const {
+    K2DEBUG("is deadline set=" << (this->features & (1 << 4)));
+    return this->features & (1 << 4);  // bit4
+}
+
+Duration MessageMetadata::getDeadline() const {
+    return std::chrono::microseconds(this->deadline);
+}
+
+void MessageMetadata::setCompressed(uint32_t uncompressedSize) {
+    K2DEBUG("Set compressed, uncompressedSize=" << uncompressedSize);
+    this->uncompressedSize = uncompressedSize;
+    this->features |= (1 << 5);  // bit5
+}
+
+bool MessageMetadata::isCompressedSet() const {
+    K2DEBUG("is compressed set=" << (this->features & (1 << 5)));
+    return this->features & (1 << 5);  // bit5
+}
+
+void MessageMetadata::setAcceptsCompression() {
+    this->features |= (1 << 6);  // bit6
+}
+
+bool MessageMetadata::isAcceptsCompressionSet() const {
+    return this->features & (1 << 6);  // bit6
+}
+
+void MessageMetadata::setCompactEncoding() {
+    this->features |= (1 << 7);  // bit7
+}
+
+bool MessageMetadata::isCompactEncodingSet() const {
+    return this->features & (1 << 7);  // bit7
+}
+
 size_t MessageMetadata::wireByteCount() {
     return isPayloadSizeSet() * sizeof(payloadSize) +
             isRequestIDSet() * sizeof(requestID) +
             isResponseIDSet() * sizeof(responseID) +
-            isChecksumSet() * sizeof(checksum);
+            isChecksumSet() * sizeof(checksum) +
+            isDeadlineSet() * sizeof(deadline) +
+            isCompressedSet() * sizeof(uncompressedSize);
 }
 
 } // namespace k2
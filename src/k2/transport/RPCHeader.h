@@ -28,6 +28,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <cstring> // for size_t types
 
 // k2
+#include <k2/common/Chrono.h>
 #include <k2/common/Log.h>
 #include "Payload.h"
 #include "RPCTypes.h"
@@ -40,15 +41,24 @@ static const char K2RPCMAGIC = char('K') ^ char('2');
 // No header of ours would ever exceed this size
 static const uint8_t MAX_HEADER_SIZE = 128;
 
+// The RPC version we send in the fixed header of every message
+static const uint8_t K2RPC_VERSION = 0x2;
+
+// The first RPC version which can decode payloads in the compact encoding
+static const uint8_t K2RPC_COMPACT_VERSION = 0x2;
+
+// The first RPC version which knows about the Deadline field
+static const uint8_t K2RPC_DEADLINE_VERSION = 0x2;
+
 } // namespace txconstants
 
-// Header format (RPC Version = 0x1)
+// Header format (RPC Version = 0x2)
 // | size(byte) | Description     | Comments
 // |------------|-----------------|------------------------------------------------------------------
 
 // fixed fields:
 // | 1          | Magic           | Magic byte: 'K' ^ '2' = '01111001' = 0x79
-// | 1          | Version         | RPC version. Indicates version of RPC used
+// | 1          | Version         | RPC version. Indicates version of RPC used by the sender
 // | 1          | Features        | Feature bitmap
 // | 1          | Verb            | The message verb
 
@@ -57,6 +67,15 @@ static const uint8_t MAX_HEADER_SIZE = 128;
 // | 4          | RequestID       | The request message ID - short-term unique number
 // | 4          | ResponseID      | The response message ID - repeat from a previous msg.RequestID
 // | 4          | Checksum        | The optional checksum for the message
+// | 4          | Deadline        | The remaining time budget(usec) the sender has for this request. Needs RPC version >= 0x2
+// | 4          | Compressed      | The payload is LZ4-compressed. The field holds the uncompressed payload size
+// | 0          | AcceptsCompr    | Flag only: the sender can decode compressed payloads
+// | 0          | CompactEncoding | Flag only: the payload uses the compact encoding. Needs RPC version >= 0x2
+//
+// Version 0x1 peers ignore the version byte, so we always send our own version. They don't know about the
+// Deadline field either and would misparse a header which has it, so a peer only sends deadlines(and compact
+// payloads) in its requests once it has seen a reply with version >= K2RPC_DEADLINE_VERSION(K2RPC_COMPACT_VERSION)
+// from the other side.
 //
 // Note that since the message is likely to be binaried, the payload will be stored and presented as
 // a Payload, which is basically an iovec which exposes the binaries for the payload.
@@ -65,7 +84,7 @@ static const uint8_t MAX_HEADER_SIZE = 128;
 class FixedHeader {
 public:
     char magic = txconstants::K2RPCMAGIC;
-    uint8_t version = 0x1;
+    uint8_t version = txconstants::K2RPC_VERSION;
     // bitmap which indicates which variable fields below are set. The bitmap should be used to initialize
     // a MessageMetadata, and then use the API from MessageMetadata to determine what fields are set and
     // what their values are
@@ -92,6 +111,26 @@ public: // API
     void setChecksum(uint32_t checksum);
     bool isChecksumSet() const;
 
+    // deadline at position 4. Clocks aren't synchronized across nodes so we carry the time budget
+    // remaining at the time of sending and the receiver converts it to a local deadline
+    void setDeadline(Duration budget);
+    bool isDeadlineSet() const;
+    Duration getDeadline() const;
+
+    // compressed payload at position 5. The payloadSize is the size on the wire and this field
+    // is the size of the payload once decompressed
+    void setCompressed(uint32_t uncompressedSize);
+    bool isCompressedSet() const;
+
+    // flag at position 6, no wire bytes. Set by senders which can decode compressed payloads, so that
+    // peers learn it from the regular traffic on the channel
+    void setAcceptsCompression();
+    bool isAcceptsCompressionSet() const;
+
+    // flag at position 7, no wire bytes. The payload was written with the compact encoding
+    void setCompactEncoding();
+    bool isCompactEncodingSet() const;
+
     // this method is used to determine how many wire bytes are needed given the set features
     size_t wireByteCount();
 
@@ -101,6 +140,12 @@ public: // fields
     uint32_t requestID = 0;
     uint32_t responseID = 0;
     uint32_t checksum = 0;
+    uint32_t deadline = 0;
+    uint32_t uncompressedSize = 0;
+    // not part of the variable header: the RPC version from the fixed header of a received message
+    uint8_t version = txconstants::K2RPC_VERSION;
+    // not sent: requests with the same non-zero key are sent on the same connection so that they arrive in order
+    uint64_t orderKey = 0;
     // MAYBE TODO  crypto, sender endpoint
 };
 } // k2
@@ -22,6 +22,11 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "RPCParser.h"
+
+// third-party
+#include <crc32c/crc32c.h>
+#include <lz4.h>
+
 namespace k2 {
 
 bool RPCParser::append(Binary& binary, size_t& writeOffset, const void* data, size_t size) {
@@ -39,9 +44,11 @@ void RPCParser::_setParserFailure(std::exception&& exc) {
     _parserFailureException = std::move(exc);
 }
 
-RPCParser::RPCParser(std::function<bool()> preemptor, bool useChecksum) :
+RPCParser::RPCParser(std::function<bool()> preemptor, bool useChecksum, uint32_t compressionThreshold) :
         _shouldParse(false),
         _useChecksum(useChecksum),
+        _compressionThreshold(compressionThreshold),
+        _peerAcceptsCompression(false),
         _pState(ParseState::WAIT_FOR_FIXED_HEADER),
         _preemptor(preemptor) {
     K2DEBUG("ctor");
@@ -104,6 +111,16 @@ bool RPCParser::writeHeader(Binary& binary, Verb verb, MessageMetadata meta) {
         if (!appendRaw(binary, writeOffset, meta.checksum))
             return false;
     }
+    if (meta.isDeadlineSet()) {
+        K2DEBUG("have deadline=" << meta.deadline);
+        if (!appendRaw(binary, writeOffset, meta.deadline))
+            return false;
+    }
+    if (meta.isCompressedSet()) {
+        K2DEBUG("have uncompressed size=" << meta.uncompressedSize);
+        if (!appendRaw(binary, writeOffset, meta.uncompressedSize))
+            return false;
+    }
     // all done.
     K2DEBUG("Write offset after writing header: " << writeOffset);
 
@@ -136,6 +153,10 @@ void RPCParser::registerParserFailureObserver(ParserFailureObserver_t parserFail
     }
 }
 
+const RPCParser::CompressionStats& RPCParser::getCompressionStats() const {
+    return _compressionStats;
+}
+
 void RPCParser::feed(Binary&& binary) {
     K2DEBUG("feed bytes" << binary.size());
     assert(_currentBinary.empty());
@@ -144,6 +165,8 @@ void RPCParser::feed(Binary&& binary) {
     // previous parsing round, it would be in the _partialBinary binary.
     _currentBinary = std::move(binary);
     _shouldParse = true;  // signal the parser that we should continue/start parsing data
+    // mark the arrival time for the messages in this binary. Requests use it to compute their local deadline
+    CachedSteadyClock::now(true);
 }
 
 void RPCParser::dispatchSome() {
@@ -160,6 +183,10 @@ void RPCParser::dispatchSome() {
 }
 
 void RPCParser::_parseAndDispatchOne() {
+    // most of the time the next message is wholly contained in the current binary
+    if (_pState == ParseState::WAIT_FOR_FIXED_HEADER && _fastDispatchOne()) {
+        return;
+    }
     // keep going through the motions while we can still keep parsing data
     // or we've dispatched a message
     K2DEBUG("Pado : " << _pState);
@@ -204,6 +231,82 @@ void RPCParser::_parseAndDispatchOne() {
     }
 }
 
+bool RPCParser::_fastDispatchOne() {
+    auto size = _currentBinary.size();
+    if (size < sizeof(FixedHeader)) {
+        return false;
+    }
+    const char* data = _currentBinary.get();
+    FixedHeader fixedHeader;
+    std::memcpy((char*)&fixedHeader, data, sizeof(fixedHeader));
+    if (fixedHeader.magic != txconstants::K2RPCMAGIC) {
+        // let the state machine deal with the failure
+        return false;
+    }
+    MessageMetadata metadata;
+    metadata.features = fixedHeader.features;
+    metadata.version = fixedHeader.version;
+    size_t headerSize = sizeof(fixedHeader) + metadata.wireByteCount();
+    if (headerSize > size) {
+        return false;
+    }
+    _readVariableHeader(metadata, data + sizeof(fixedHeader));
+    size_t payloadSize = metadata.isPayloadSizeSet() ? metadata.payloadSize : 0;
+    if (payloadSize > size - headerSize) {
+        return false;
+    }
+    K2DEBUG("fast path: header=" << headerSize << ", payload=" << payloadSize);
+
+    // we have the whole message. The payload is a view into the current binary
+    _fixedHeader = fixedHeader;
+    _metadata = std::move(metadata);
+    _payload.reset();
+    uint32_t checksum = 0;
+    if (_metadata.isPayloadSizeSet()) {
+        _payload = std::make_unique<Payload>();
+        if (payloadSize > 0) {
+            auto payloadBinary = _currentBinary.share(headerSize, payloadSize);
+            if (_useChecksum) {
+                checksum = crc32c::Crc32c(payloadBinary.get(), payloadSize);
+            }
+            _payload->appendBinary(std::move(payloadBinary));
+        }
+    }
+    _currentBinary.trim_front(headerSize + payloadSize);
+    _dispatch(checksum);
+    return true;
+}
+
+void RPCParser::_readVariableHeader(MessageMetadata& metadata, const char* data) {
+    if (metadata.isPayloadSizeSet()) {
+        std::memcpy((char*)&metadata.payloadSize, data, sizeof(metadata.payloadSize));
+        data += sizeof(metadata.payloadSize);
+    }
+    if (metadata.isRequestIDSet()) {
+        std::memcpy((char*)&metadata.requestID, data, sizeof(metadata.requestID));
+        data += sizeof(metadata.requestID);
+    }
+    if (metadata.isResponseIDSet()) {
+        std::memcpy((char*)&metadata.responseID, data, sizeof(metadata.responseID));
+        data += sizeof(metadata.responseID);
+    }
+    if (metadata.isChecksumSet()) {
+        std::memcpy((char*)&metadata.checksum, data, sizeof(metadata.checksum));
+        data += sizeof(metadata.checksum);
+    }
+    if (metadata.isDeadlineSet()) {
+        std::memcpy((char*)&metadata.deadline, data, sizeof(metadata.deadline));
+        data += sizeof(metadata.deadline);
+    }
+    if (metadata.isCompressedSet()) {
+        std::memcpy((char*)&metadata.uncompressedSize, data, sizeof(metadata.uncompressedSize));
+        data += sizeof(metadata.uncompressedSize);
+    }
+    K2DEBUG("var header: payload size=" << metadata.payloadSize << ", request id=" << metadata.requestID
+            << ", response id=" << metadata.responseID << ", checksum=" << metadata.checksum
+            << ", deadline=" << metadata.deadline << ", uncompressed size=" << metadata.uncompressedSize);
+}
+
 void RPCParser::_stWAIT_FOR_FIXED_HEADER() {
     // we come to this state when we think we have enough data to parse a new message from
     // the current binary.
@@ -280,6 +383,7 @@ void RPCParser::_stIN_PARTIAL_FIXED_HEADER() {
 void RPCParser::_stWAIT_FOR_VARIABLE_HEADER() {
     // set the feature vector so that we can use the API
     _metadata.features = _fixedHeader.features;
+    _metadata.version = _fixedHeader.version;
 
     // how many bytes we need off the wire
     size_t needBytes = _metadata.wireByteCount();
@@ -301,28 +405,8 @@ void RPCParser::_stWAIT_FOR_VARIABLE_HEADER() {
         return;
     }
     // if we came here, we either don't need any bytes, or we have all the bytes we need in _currentBinary
-
-    // now for variable stuff
-    if (_metadata.isPayloadSizeSet()) {
-        std::memcpy((char*)&_metadata.payloadSize, _currentBinary.get_write(), sizeof(_metadata.payloadSize));
-        K2DEBUG("wait_for_var_header: have payload size: " << _metadata.payloadSize);
-        _currentBinary.trim_front(sizeof(_metadata.payloadSize));
-    }
-    if (_metadata.isRequestIDSet()) {
-        std::memcpy((char*)&_metadata.requestID, _currentBinary.get_write(), sizeof(_metadata.requestID));
-        K2DEBUG("wait_for_var_header: have request id: " << _metadata.requestID);
-        _currentBinary.trim_front(sizeof(_metadata.requestID));
-    }
-    if (_metadata.isResponseIDSet()) {
-        std::memcpy((char*)&_metadata.responseID, _currentBinary.get_write(), sizeof(_metadata.responseID));
-        K2DEBUG("wait_for_var_header: have response id: " << _metadata.responseID);
-        _currentBinary.trim_front(sizeof(_metadata.responseID));
-    }
-    if (_metadata.isChecksumSet()) {
-        std::memcpy((char*)&_metadata.checksum, _currentBinary.get_write(), sizeof(_metadata.checksum));
-        K2DEBUG("wait_for_var_header: have checksum: " << _metadata.checksum);
-        _currentBinary.trim_front(sizeof(_metadata.checksum));
-    }
+    _readVariableHeader(_metadata, _currentBinary.get());
+    _currentBinary.trim_front(needBytes);
     _pState = ParseState::WAIT_FOR_PAYLOAD;  // onto getting the payload
     K2DEBUG("wait_for_var_header: parsed");
 }
@@ -362,26 +446,7 @@ void RPCParser::_stIN_PARTIAL_VARIABLE_HEADER() {
     _currentBinary.trim_front(totalNeed - partSize);
 
     // now set the variable fields
-    if (_metadata.isPayloadSizeSet()) {
-        std::memcpy((char*)&_metadata.payloadSize, data, sizeof(_metadata.payloadSize));
-        K2DEBUG("partial_var_header: have payload size: " << _metadata.payloadSize);
-        data += sizeof(_metadata.payloadSize);
-    }
-    if (_metadata.isRequestIDSet()) {
-        std::memcpy((char*)&_metadata.requestID, data, sizeof(_metadata.requestID));
-        K2DEBUG("partial_var_header: have request id: " << _metadata.requestID);
-        data += sizeof(_metadata.requestID);
-    }
-    if (_metadata.isResponseIDSet()) {
-        std::memcpy((char*)&_metadata.responseID, data, sizeof(_metadata.responseID));
-        K2DEBUG("partial_var_header: have response id: " << _metadata.responseID);
-        data += sizeof(_metadata.responseID);
-    }
-    if (_metadata.isChecksumSet()) {
-        std::memcpy((char*)&_metadata.checksum, data, sizeof(_metadata.checksum));
-        K2DEBUG("partial_var_header: have checksum: " << _metadata.checksum);
-        data += sizeof(_metadata.checksum);
-    }
+    _readVariableHeader(_metadata, data);
     _pState = ParseState::WAIT_FOR_PAYLOAD;  // onto getting the payload
     K2DEBUG("partial_var_header: parsed");
 }
@@ -427,19 +492,30 @@ void RPCParser::_stWAIT_FOR_PAYLOAD() {
 
 void RPCParser::_stREADY_TO_DISPATCH() {
     K2DEBUG("ready_to_dispatch: cursize=" << _currentBinary.size());
+    _dispatch(_useChecksum && _payload ? _payload->computeCrc32c() : 0);
+}
+
+void RPCParser::_dispatch(uint32_t checksum) {
     if (_useChecksum && _payload) {
         if (!_metadata.isChecksumSet()) {
             K2DEBUG("metadata doesn't have crc checksum");
             _setParserFailure(ChecksumValidationException());
             return;
         }
-        auto checksum = _payload->computeCrc32c();
         if (checksum != _metadata.checksum) {
             K2DEBUG("checksum doesn't match: have=" << _metadata.checksum << ", received=" << checksum);
             _setParserFailure(ChecksumValidationException());
             return;
         }
     }
+    if (_metadata.isAcceptsCompressionSet()) {
+        _peerAcceptsCompression = true;
+    }
+    // the checksum covers the bytes on the wire so we only decompress after validating it
+    if (_metadata.isCompressedSet() && !_decompressPayload()) {
+        _setParserFailure(DecompressionException());
+        return;
+    }
     _messageObserver(_fixedHeader.verb, std::move(_metadata), std::move(_payload));
 
     // only now we're ready to process the next message
@@ -456,6 +532,68 @@ void RPCParser::_stFAILED_STREAM() {
     _parserFailureObserver(std::make_exception_ptr(_parserFailureException));
 }
 
+size_t RPCParser::_compressPayload(std::unique_ptr<Payload>& payload, size_t dataSize, MessageMetadata& metadata) {
+    if (dataSize > size_t(LZ4_MAX_INPUT_SIZE)) {
+        return dataSize;
+    }
+    auto start = Clock::now();
+    // LZ4 needs the input in contiguous memory
+    Binary input(dataSize);
+    payload->seek(txconstants::MAX_HEADER_SIZE);
+    payload->read(input.get_write(), dataSize);
+
+    // keep the same headroom for the header as the original payload had
+    int bound = LZ4_compressBound(int(dataSize));
+    Binary output(txconstants::MAX_HEADER_SIZE + bound);
+    int compressedSize = LZ4_compress_default(input.get(), output.get_write() + txconstants::MAX_HEADER_SIZE, int(dataSize), bound);
+    _compressionStats.compressNanos += nsec(Clock::now() - start).count();
+
+    if (compressedSize <= 0 || size_t(compressedSize) >= dataSize) {
+        K2DEBUG("payload not compressible: size=" << dataSize);
+        return dataSize;
+    }
+    output.trim(txconstants::MAX_HEADER_SIZE + compressedSize);
+    std::vector<Binary> buffers;
+    buffers.push_back(std::move(output));
+    payload = std::make_unique<Payload>(std::move(buffers), txconstants::MAX_HEADER_SIZE + compressedSize);
+    metadata.setCompressed(uint32_t(dataSize));
+
+    _compressionStats.compressedMessages++;
+    _compressionStats.bytesSaved += dataSize - compressedSize;
+    K2DEBUG("compressed payload: size=" << dataSize << ", compressed=" << compressedSize);
+    return compressedSize;
+}
+
+bool RPCParser::_decompressPayload() {
+    if (!_payload) {
+        K2WARN("compressed message without payload");
+        return false;
+    }
+    auto compressedSize = _payload->getSize();
+    // LZ4 can't expand data by more than ~255x. Don't let a bad header make us allocate huge buffers
+    if (compressedSize > size_t(LZ4_MAX_INPUT_SIZE) || _metadata.uncompressedSize > compressedSize * 255 + 16) {
+        K2WARN("invalid compressed payload: size=" << compressedSize << ", uncompressed=" << _metadata.uncompressedSize);
+        return false;
+    }
+    auto start = Clock::now();
+    Binary input(compressedSize);
+    _payload->seek(0);
+    _payload->read(input.get_write(), compressedSize);
+
+    Binary output(_metadata.uncompressedSize);
+    int size = LZ4_decompress_safe(input.get(), output.get_write(), int(compressedSize), int(_metadata.uncompressedSize));
+    _compressionStats.decompressNanos += nsec(Clock::now() - start).count();
+    if (size < 0 || uint32_t(size) != _metadata.uncompressedSize) {
+        K2WARN("unable to decompress payload: size=" << compressedSize << ", uncompressed=" << _metadata.uncompressedSize << ", result=" << size);
+        return false;
+    }
+    _payload = std::make_unique<Payload>();
+    _payload->appendBinary(std::move(output));
+    _metadata.payloadSize = _metadata.uncompressedSize;
+    _compressionStats.decompressedMessages++;
+    return true;
+}
+
 std::unique_ptr<Payload>
 RPCParser::serializeMessage(Payload&& message, Verb verb, MessageMetadata metadata) {
     K2DEBUG("serializing message");
@@ -477,7 +615,13 @@ RPCParser::serializeMessage(Payload&& message, Verb verb, MessageMetadata metada
 std::vector<Binary>
 RPCParser::prepareForSend(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata metadata) {
     assert(payload->getSize() >= txconstants::MAX_HEADER_SIZE);
-    auto dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
+    size_t dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
+    if (_compressionThreshold > 0) {
+        metadata.setAcceptsCompression();
+        if (_peerAcceptsCompression && dataSize >= _compressionThreshold) {
+            dataSize = _compressPayload(payload, dataSize, metadata);
+        }
+    }
     metadata.setPayloadSize(dataSize);
     K2DEBUG("send: verb=" << int(verb) << ", payloadSize=" << dataSize);
     if (_useChecksum) {
@@ -55,10 +55,25 @@ public: // types
     // the segment we received did not have enough data.
     class NonContinuationSegmentException : public std::exception {};
 
+    // indicates that a compressed payload could not be decompressed
+    class DecompressionException : public std::exception {};
+
+    // counters for the payload compression done by a parser
+    struct CompressionStats {
+        uint64_t compressedMessages = 0;
+        uint64_t decompressedMessages = 0;
+        // payload bytes we didn't have to put on the wire
+        uint64_t bytesSaved = 0;
+        uint64_t compressNanos = 0;
+        uint64_t decompressNanos = 0;
+    };
+
    public:
     // creates an RPC parser with the given preemptor function. Users can request that we validate/generate checksums
-    // at the expense of extra read pass over the data
-    RPCParser(std::function<bool()> preemptor, bool useChecksum);
+    // at the expense of extra read pass over the data.
+    // With a non-zero compressionThreshold, outgoing payloads of at least that many bytes are compressed once the
+    // peer has told us(via any message) that it can decompress them. Compressed incoming payloads are always decoded.
+    RPCParser(std::function<bool()> preemptor, bool useChecksum, uint32_t compressionThreshold=0);
 
     // destructor. Any incomplete messages are dropped
     ~RPCParser();
@@ -108,6 +123,9 @@ public: // types
     // Call this method with a callback to observe parsing failure
     void registerParserFailureObserver(ParserFailureObserver_t parserFailureObserver);
 
+    // Returns the compression counters for this parser
+    const CompressionStats& getCompressionStats() const;
+
 private: // types
     enum ParseState: uint8_t {
         WAIT_FOR_FIXED_HEADER, // we're waiting for a header for a new message
@@ -123,6 +141,17 @@ private: // methods
     // parses and dispatches one message if possible
     void _parseAndDispatchOne();
 
+    // parses and dispatches the next message if it is wholly contained in the current binary, without going
+    // through the state machine. Returns false, with nothing consumed, if the message isn't all there
+    bool _fastDispatchOne();
+
+    // reads the variable header fields flagged in the given metadata from the given contiguous bytes
+    static void _readVariableHeader(MessageMetadata& metadata, const char* data);
+
+    // validates the current message and hands it to the message observer. The checksum is the one we computed
+    // over the received payload. On failure, the parser goes into the FAILED_STREAM state
+    void _dispatch(uint32_t checksum);
+
     // state machine handlers
     void _stWAIT_FOR_FIXED_HEADER();
     void _stIN_PARTIAL_FIXED_HEADER();
@@ -134,6 +163,12 @@ private: // methods
 
     void _setParserFailure(std::exception&& exc);
 
+    // compress the data part of the given outgoing payload if it is worth it. Returns the new data size
+    size_t _compressPayload(std::unique_ptr<Payload>& payload, size_t dataSize, MessageMetadata& metadata);
+
+    // replace the current incoming payload with its decompressed version. Returns false on failure
+    bool _decompressPayload();
+
     static bool append(Binary& binary, size_t& writeOffset, const void* data, size_t size);
 
     template <typename T>
@@ -159,6 +194,14 @@ private: // methods
     // flag used to determine if we should compute/validate checksums
     bool _useChecksum;
 
+    // the smallest payload we compress. 0 disables compression of outgoing payloads
+    uint32_t _compressionThreshold;
+
+    // set once we see a message from a peer which can decode compressed payloads
+    bool _peerAcceptsCompression;
+
+    CompressionStats _compressionStats;
+
     // the parser state
     ParseState _pState;
 
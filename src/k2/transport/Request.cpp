@@ -30,7 +30,9 @@ Request::Request(Verb verb, TXEndpoint& endpoint, MessageMetadata metadata, std:
     verb(verb),
     endpoint(endpoint),
     metadata(std::move(metadata)),
-    payload(std::move(payload)) {
+    payload(std::move(payload)),
+    // the cached clock is refreshed when the transport receives data so this is the time of arrival(or later)
+    deadline(this->metadata.isDeadlineSet() ? CachedSteadyClock::now() + this->metadata.getDeadline() : TimePoint::max()) {
     K2DEBUG("ctor Request @" << ((void*)this)<< ", with verb=" << int(verb) << ", from " << endpoint.getURL());
 }
 
@@ -42,7 +44,8 @@ Request::Request(Request&& o):
     verb(o.verb),
     endpoint(std::move(o.endpoint)),
     metadata(std::move(o.metadata)),
-    payload(std::move(o.payload)) {
+    payload(std::move(o.payload)),
+    deadline(o.deadline) {
     o.verb = InternalVerbs::NIL;
     K2DEBUG("move Request @" << ((void*)this)<< ", with verb=" << int(verb) << ", from " << endpoint.getURL());
 }
@@ -57,6 +57,10 @@ public: // fields
     // the payload of this request
     std::unique_ptr<Payload> payload;
 
+    // the local deadline for this request, derived from the time budget the sender put in the metadata.
+    // TimePoint::max() if the sender didn't specify a deadline
+    TimePoint deadline;
+
 private: // don't need
     Request() = delete;
     Request(const Request& o) = delete;
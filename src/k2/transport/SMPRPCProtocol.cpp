@@ -0,0 +1,163 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "SMPRPCProtocol.h"
+
+// stl
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+// third-party
+#include <seastar/core/smp.hh>
+
+//k2
+#include <k2/common/Log.h>
+
+namespace k2 {
+const String SMPRPCProtocol::proto("smp+k2rpc");
+
+const String& SMPRPCProtocol::processID() {
+    // pid alone isn't unique across hosts/containers, so add some randomness. Initialized once per process
+    static const String pid = [] {
+        std::random_device rd;
+        std::ostringstream os;
+        os << ::getpid() << "-" << std::hex << ((uint64_t(rd()) << 32) | rd());
+        return String(os.str());
+    }();
+    return pid;
+}
+
+bool SMPRPCProtocol::isLocal(const TXEndpoint& endpoint) {
+    return endpoint.getProtocol() == proto && endpoint.getIP() == processID() && endpoint.getPort() < seastar::smp::count;
+}
+
+SMPRPCProtocol::SMPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, RPCProtocolFactory::Dist_t& smpProto):
+    IRPCProtocol(vnet, proto),
+    _smpProto(smpProto) {
+    K2DEBUG("ctor");
+}
+
+SMPRPCProtocol::~SMPRPCProtocol() {
+    K2DEBUG("dtor");
+}
+
+void SMPRPCProtocol::start() {
+    K2DEBUG("start");
+    for (uint32_t core = 0; core < seastar::smp::count; ++core) {
+        _coreEndpoints.emplace_back(String(proto), String(processID()), core, _vnet.local().getTCPAllocator());
+    }
+    _svrEndpoint = seastar::make_lw_shared<TXEndpoint>(_coreEndpoints[seastar::engine().cpu_id()]);
+    K2INFO("Starting SMP Proto on: " << _svrEndpoint->getURL());
+    _stopped = false;
+}
+
+RPCProtocolFactory::BuilderFunc_t SMPRPCProtocol::builder(VirtualNetworkStack::Dist_t& vnet, RPCProtocolFactory::Dist_t& smpProto) {
+    K2DEBUG("builder creating");
+    return [&vnet, &smpProto]() mutable -> seastar::shared_ptr<IRPCProtocol> {
+        K2DEBUG("builder running");
+        return seastar::static_pointer_cast<IRPCProtocol>(
+            seastar::make_shared<SMPRPCProtocol>(vnet, smpProto));
+    };
+}
+
+seastar::future<> SMPRPCProtocol::stop() {
+    K2DEBUG("stop");
+    // messages which arrive from now on are dropped
+    _stopped = true;
+    return seastar::make_ready_future();
+}
+
+std::unique_ptr<TXEndpoint> SMPRPCProtocol::getTXEndpoint(String url) {
+    if (_stopped) {
+        K2WARN("Unable to create endpoint since we're stopped for url " << url);
+        return nullptr;
+    }
+    K2DEBUG("get endpoint for " << url);
+    auto ep = TXEndpoint::fromURL(url, _vnet.local().getTCPAllocator());
+    if (!ep || ep->getProtocol() != proto) {
+        K2WARN("Cannot construct non-`" << proto << "` endpoint");
+        return nullptr;
+    }
+    return ep;
+}
+
+seastar::lw_shared_ptr<TXEndpoint> SMPRPCProtocol::getServerEndpoint() {
+    return _svrEndpoint;
+}
+
+void SMPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) {
+    if (_stopped) {
+        K2WARN("Dropping message since we're stopped: verb=" << int(verb) << ", url=" << endpoint.getURL());
+        return;
+    }
+    if (!isLocal(endpoint)) {
+        K2WARN("Dropping message for endpoint which isn't in this process: verb=" << int(verb) << ", url=" << endpoint.getURL());
+        return;
+    }
+    uint32_t srcCore = seastar::engine().cpu_id();
+    auto payloadSize = payload->getSize();
+    // the buffers must be released on this core, so hand them over as a foreign pointer
+    auto buffers = seastar::make_foreign(std::make_unique<std::vector<Binary>>(payload->release()));
+
+    (void)seastar::smp::submit_to(endpoint.getPort(),
+        [&smpProto=_smpProto, srcCore, verb, metadata=std::move(metadata), payloadSize, buffers=std::move(buffers)] () mutable {
+            if (!smpProto.local_is_initialized() || !smpProto.local().instance()) {
+                K2DEBUG("SMP proto not running on target core. Dropping message for verb=" << int(verb));
+                return;
+            }
+            auto proto = seastar::static_pointer_cast<SMPRPCProtocol>(smpProto.local().instance());
+            proto->_deliver(srcCore, verb, std::move(metadata), payloadSize, std::move(buffers));
+        })
+        .handle_exception([](auto exc) {
+            K2WARN_EXC("failed to deliver cross-core message", exc);
+        });
+}
+
+void SMPRPCProtocol::_deliver(uint32_t srcCore, Verb verb, MessageMetadata metadata, size_t payloadSize, ForeignBuffers_t buffers) {
+    if (_stopped) {
+        K2DEBUG("Dropping message since we're stopped: verb=" << int(verb));
+        return;
+    }
+    // wrap the sender's buffers without copying. They are all released together, on the sender's core, once the
+    // last Binary referencing them goes away
+    auto& remote = *buffers;
+    std::vector<Binary> local;
+    local.reserve(remote.size());
+    seastar::deleter owner = seastar::make_object_deleter(std::move(buffers));
+    for (auto& buf : remote) {
+        local.push_back(Binary(buf.get_write(), buf.size(), owner.share()));
+    }
+
+    auto payload = std::make_unique<Payload>(std::move(local), payloadSize);
+    // skip the space reserved for the header, as the TCP loopback path does
+    payload->seek(txconstants::MAX_HEADER_SIZE);
+    metadata.setPayloadSize(payload->getDataRemaining());
+    // mark the arrival time for the request deadline, as the other transports do
+    CachedSteadyClock::now(true);
+
+    K2DEBUG("Delivering message with verb=" << int(verb) << ", from core " << srcCore);
+    _messageObserver(Request(verb, _coreEndpoints[srcCore], std::move(metadata), std::move(payload)));
+}
+
+} // namespace k2
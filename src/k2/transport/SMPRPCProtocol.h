@@ -0,0 +1,119 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+// stl
+#include <vector>
+
+// third-party
+#include <seastar/core/sharded.hh>
+
+// k2
+#include "IRPCProtocol.h"
+#include "VirtualNetworkStack.h"
+#include "RPCProtocolFactory.h"
+#include "RPCHeader.h"
+
+namespace k2 {
+
+// SMPRPCProtocol delivers messages between cores of the same process without going through a network stack.
+// Payloads are handed over to the target core via seastar::smp::submit_to without copying or framing. The
+// receiving core reads the sender's buffers in place, and they are released back on the sender's core when
+// the receiver is done with them.
+// Endpoints for this protocol look like "smp+k2rpc://<processID>:<core>", where processID is unique to each
+// process. Endpoints from other processes are not reachable via this protocol.
+// NB, the class is meant to be used as a distributed<> container
+class SMPRPCProtocol: public IRPCProtocol {
+public: // types
+    // Convenience builder. The protocol needs access to its own distributed container to reach other cores
+    static RPCProtocolFactory::BuilderFunc_t builder(VirtualNetworkStack::Dist_t& vnet, RPCProtocolFactory::Dist_t& smpProto);
+
+    // The official protocol name supported for communications over SMPRPC
+    static const String proto;
+
+    // The unique ID of this process, used as the address portion of our endpoints
+    static const String& processID();
+
+    // Returns true if the given endpoint can be reached from this process via SMPRPC
+    static bool isLocal(const TXEndpoint& endpoint);
+
+public: // lifecycle
+    // Construct the protocol
+    SMPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, RPCProtocolFactory::Dist_t& smpProto);
+
+    // Destructor
+    virtual ~SMPRPCProtocol();
+
+public: // API
+    // This method creates an endpoint for a given URL. The endpoint is needed in order to
+    // 1. obtain protocol-specific payloads
+    // 2. send messages.
+    // returns blank pointer if we failed to parse the url or if the protocol is not supported
+    std::unique_ptr<TXEndpoint> getTXEndpoint(String url) override;
+
+    // Invokes the remote rpc for the given verb with the given payload. This is an asyncronous API. No guarantees
+    // are made on the delivery of the payload after the call returns.
+    // The RPC message is configured with the given metadata
+    void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
+
+    // Returns the endpoint for this core
+    seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
+
+public: // distributed<> interface
+    // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
+    seastar::future<> stop() override;
+
+    // Should be called by user when all distributed objects have been created
+    void start() override;
+
+private: // types
+    // the buffers of a payload, owned by the sending core
+    typedef seastar::foreign_ptr<std::unique_ptr<std::vector<Binary>>> ForeignBuffers_t;
+
+private: // methods
+    // called on the target core to deliver a message from the given source core
+    void _deliver(uint32_t srcCore, Verb verb, MessageMetadata metadata, size_t payloadSize, ForeignBuffers_t buffers);
+
+private: // fields
+    // our distributed container. Used to find the protocol instance on other cores
+    RPCProtocolFactory::Dist_t& _smpProto;
+
+    // the endpoint for this core
+    seastar::lw_shared_ptr<TXEndpoint> _svrEndpoint;
+
+    // the endpoints for all cores. We use these as the sender endpoints for incoming messages
+    std::vector<TXEndpoint> _coreEndpoints;
+
+    // we use this flag to signal exit
+    bool _stopped = true;
+
+private: // not needed
+    SMPRPCProtocol() = delete;
+    SMPRPCProtocol(const SMPRPCProtocol& o) = delete;
+    SMPRPCProtocol(SMPRPCProtocol&& o) = delete;
+    SMPRPCProtocol &operator=(const SMPRPCProtocol& o) = delete;
+    SMPRPCProtocol &operator=(SMPRPCProtocol&& o) = delete;
+
+}; // class SMPRPCProtocol
+
+} // namespace k2
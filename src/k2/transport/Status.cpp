@@ -22,6 +22,10 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "Status.h"
+
+#include <array>
+#include <utility>
+
 namespace k2 {
 
 bool Status::operator==(const Status& o) { return code == o.code; }
@@ -29,7 +33,7 @@ bool Status::operator==(const Status& o) { return code == o.code; }
 bool Status::operator!=(const Status& o) { return !(code == o.code); }
 
 Status Status::operator()(String message) const {
-    return Status{this->code, message};
+    return Status{this->code, std::move(message)};
 }
 
 bool Status::is1xxInProgress() const { return code >= 100 && code <= 199; }
@@ -42,190 +46,162 @@ bool Status::is4xxNonRetryable() const { return code >= 400 && code <= 499; }
 
 bool Status::is5xxRetryable() const { return code >= 500 && code <= 599; }
 
-String Status::getDescription() const {
-    switch (code) {
-        case 100:
-            return "Continue";
-        case 101:
-            return "Switching Protocols";
-        case 102:
-            return "Processing";
-        case 103:
-            return "Early Hints";
-
-        case 200:
-            return "OK";
-        case 201:
-            return "Created";
-        case 202:
-            return "Accepted";
-        case 203:
-            return "Non-Authoritative Information";
-        case 204:
-            return "No Content";
-        case 205:
-            return "Reset Content";
-        case 206:
-            return "Partial Content";
-        case 207:
-            return "Multi-Status";
-        case 208:
-            return "Already Reported";
-        case 218:
-            return "This is fine";
-        case 226:
-            return "IM Used";
-
-        case 300:
-            return "Multiple Choices";
-        case 301:
-            return "Moved Permanently";
-        case 302:
-            return "Found";
-        case 303:
-            return "See Other";
-        case 304:
-            return "Not Modified";
-        case 305:
-            return "Use Proxy";
-        case 306:
-            return "Switch Proxy";
-        case 307:
-            return "Temporary Redirect";
-        case 308:
-            return "Permanent Redirect";
-
-        case 400:
-            return "Bad Request";
-        case 401:
-            return "Unauthorized";
-        case 402:
-            return "Payment Required";
-        case 403:
-            return "Forbidden";
-        case 404:
-            return "Not Found";
-        case 405:
-            return "Method Not Allowed";
-        case 406:
-            return "Not Acceptable";
-        case 407:
-            return "Proxy Authentication Required";
-        case 408:
-            return "Request Timeout";
-        case 409:
-            return "Conflict";
-        case 410:
-            return "Gone";
-        case 411:
-            return "Length Required";
-        case 412:
-            return "Precondition Failed";
-        case 413:
-            return "Payload Too Large";
-        case 414:
-            return "URI Too Long";
-        case 415:
-            return "Unsupported Media Type";
-        case 416:
-            return "Range Not Satisfiable";
-        case 417:
-            return "Expectation Failed";
-        case 418:
-            return "I'm a teapot";
-        case 419:
-            return "Page Expired";
-        case 420:
-            return "Enhance Your Calm";
-        case 421:
-            return "Misdirected Request";
-        case 422:
-            return "Unprocessable Entity";
-        case 423:
-            return "Locked";
-        case 424:
-            return "Failed Dependency";
-        case 425:
-            return "Too Early";
-        case 426:
-            return "Upgrade Required";
-        case 428:
-            return "Precondition Required";
-        case 429:
-            return "Too Many Requests";
-        case 440:
-            return "Login Time-out";
-        case 444:
-            return "No Response";
-        case 449:
-            return "Retry With";
-        case 450:
-            return "Blocked by Windows Parental Controls";
-        case 451:
-            return "Unavailable For Legal Reasons";
-        case 460:
-            return "LB Client Connection Closed";
-        case 463:
-            return "LB Request Too Large";
-        case 494:
-            return "Request header too large";
-        case 495:
-            return "SSL Certificate Error";
-        case 496:
-            return "SSL Certificate Required";
-        case 497:
-            return "HTTP Request Sent to HTTPS Port";
-        case 499:
-            return "Client Closed Request";
-
-        case 500:
-            return "Internal Server Error";
-        case 501:
-            return "Not Implemented";
-        case 502:
-            return "Bad Gateway";
-        case 503:
-            return "Service Unavailable";
-        case 504:
-            return "Gateway Timeout";
-        case 505:
-            return "HTTP Version Not Supported";
-        case 506:
-            return "Variant Also Negotiates";
-        case 507:
-            return "Insufficient Storage";
-        case 508:
-            return "Loop Detected";
-        case 509:
-            return "Bandwidth Limit Exceeded";
-        case 510:
-            return "Not Extended";
-        case 511:
-            return "Network Authentication Required";
-        case 520:
-            return "Web Server Returned an Unknown Error";
-        case 521:
-            return "Web Server Is Down";
-        case 522:
-            return "Connection Timed Out";
-        case 523:
-            return "Origin Is Unreachable";
-        case 524:
-            return "A Timeout Occurred";
-        case 525:
-            return "SSL Handshake Failed";
-        case 526:
-            return "Invalid SSL Certificate";
-        case 527:
-            return "Railgun Error";
-        case 529:
-            return "Site is overloaded";
-        case 598:
-            return "Network read timeout error";
-
-        default:
-            return "Unknown";
+namespace {
+// The standard descriptions for the known status codes
+const std::pair<int, const char*> _knownCodes[] = {
+    {100, "Continue"},
+    {101, "Switching Protocols"},
+    {102, "Processing"},
+    {103, "Early Hints"},
+
+    {200, "OK"},
+    {201, "Created"},
+    {202, "Accepted"},
+    {203, "Non-Authoritative Information"},
+    {204, "No Content"},
+    {205, "Reset Content"},
+    {206, "Partial Content"},
+    {207, "Multi-Status"},
+    {208, "Already Reported"},
+    {218, "This is fine"},
+    {226, "IM Used"},
+
+    {300, "Multiple Choices"},
+    {301, "Moved Permanently"},
+    {302, "Found"},
+    {303, "See Other"},
+    {304, "Not Modified"},
+    {305, "Use Proxy"},
+    {306, "Switch Proxy"},
+    {307, "Temporary Redirect"},
+    {308, "Permanent Redirect"},
+
+    {400, "Bad Request"},
+    {401, "Unauthorized"},
+    {402, "Payment Required"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {406, "Not Acceptable"},
+    {407, "Proxy Authentication Required"},
+    {408, "Request Timeout"},
+    {409, "Conflict"},
+    {410, "Gone"},
+    {411, "Length Required"},
+    {412, "Precondition Failed"},
+    {413, "Payload Too Large"},
+    {414, "URI Too Long"},
+    {415, "Unsupported Media Type"},
+    {416, "Range Not Satisfiable"},
+    {417, "Expectation Failed"},
+    {418, "I'm a teapot"},
+    {419, "Page Expired"},
+    {420, "Enhance Your Calm"},
+    {421, "Misdirected Request"},
+    {422, "Unprocessable Entity"},
+    {423, "Locked"},
+    {424, "Failed Dependency"},
+    {425, "Too Early"},
+    {426, "Upgrade Required"},
+    {428, "Precondition Required"},
+    {429, "Too Many Requests"},
+    {440, "Login Time-out"},
+    {444, "No Response"},
+    {449, "Retry With"},
+    {450, "Blocked by Windows Parental Controls"},
+    {451, "Unavailable For Legal Reasons"},
+    {460, "LB Client Connection Closed"},
+    {463, "LB Request Too Large"},
+    {494, "Request header too large"},
+    {495, "SSL Certificate Error"},
+    {496, "SSL Certificate Required"},
+    {497, "HTTP Request Sent to HTTPS Port"},
+    {499, "Client Closed Request"},
+
+    {500, "Internal Server Error"},
+    {501, "Not Implemented"},
+    {502, "Bad Gateway"},
+    {503, "Service Unavailable"},
+    {504, "Gateway Timeout"},
+    {505, "HTTP Version Not Supported"},
+    {506, "Variant Also Negotiates"},
+    {507, "Insufficient Storage"},
+    {508, "Loop Detected"},
+    {509, "Bandwidth Limit Exceeded"},
+    {510, "Not Extended"},
+    {511, "Network Authentication Required"},
+    {520, "Web Server Returned an Unknown Error"},
+    {521, "Web Server Is Down"},
+    {522, "Connection Timed Out"},
+    {523, "Origin Is Unreachable"},
+    {524, "A Timeout Occurred"},
+    {525, "SSL Handshake Failed"},
+    {526, "Invalid SSL Certificate"},
+    {527, "Railgun Error"},
+    {529, "Site is overloaded"},
+    {598, "Network read timeout error"},
+};
+
+// Statuses are resolved by indexing into this table, built once from the list above
+struct DescriptionTable {
+    std::array<const char*, Status::MAX_CODE> descriptions;
+    DescriptionTable() {
+        descriptions.fill(nullptr);
+        for (auto& [code, description] : _knownCodes) {
+            descriptions[code] = description;
+        }
+    }
+};
+const DescriptionTable _descriptionTable;
+}
+
+const char* Status::getDescription() const {
+    const char* description = isKnownCode(code) ? _descriptionTable.descriptions[code] : nullptr;
+    return description == nullptr ? "Unknown" : description;
+}
+
+bool Status::isKnownCode(int code) {
+    return code >= 0 && code < MAX_CODE && _descriptionTable.descriptions[code] != nullptr;
+}
+
+bool Status::_sendsMessage() const {
+#if K2_DEBUG_LOGGING == 1
+    return !message.empty();
+#else
+    return !message.empty() && !is2xxOK();
+#endif
+}
+
+void Status::__writeFields(Payload& payload) const {
+    if (!payload.isCompactEncoding()) {
+        // the payload may be going to a peer older than K2RPC_COMPACT_VERSION, which only knows the original
+        // int code + string message. The message is still left out where we don't need it, as an empty string
+        payload.write(code);
+        payload.write(_sendsMessage() ? message : String());
+        return;
+    }
+    K2ASSERT(code >= 0 && code < MAX_CODE, "status code out of range: " << code);
+    if (_sendsMessage()) {
+        payload.write(uint16_t(code | _MESSAGE_FLAG));
+        payload.write(message);
+    }
+    else {
+        payload.write(uint16_t(code));
+    }
+}
+
+bool Status::__readFields(Payload& payload) {
+    if (!payload.isCompactEncoding()) {
+        return payload.read(code) && payload.read(message);
+    }
+    uint16_t wireCode = 0;
+    if (!payload.read(wireCode)) return false;
+    code = wireCode & ~_MESSAGE_FLAG;
+    if (wireCode & _MESSAGE_FLAG) {
+        return payload.read(message);
     }
+    message = String();
+    return true;
 }
 
 } // namespace k2
@@ -36,7 +36,25 @@ namespace k2 {
 struct Status {
     int code;
     String message;
-    K2_PAYLOAD_FIELDS(code, message);
+
+    // codes must be below this value so that they fit in the wire encoding
+    static constexpr int MAX_CODE = 1000;
+
+    // The message is sent only for non-2xx statuses(or any status in debug builds) so that the common OK responses
+    // don't carry a string. A received status without a message has an empty message, same as the Statuses
+    // constants below.
+    // In compact payloads, a status is a 16-bit code with a flag bit for the message. Compact payloads only go to
+    // peers with RPC version >= K2RPC_COMPACT_VERSION, so everywhere else we keep the original int code + string
+    // message, with an empty string in place of a message we don't send
+    struct __K2PayloadSerializableTraitTag__ {};
+    void __writeFields(Payload& payload) const;
+    bool __readFields(Payload& payload);
+    std::integral_constant<size_t, 0> __fixedWireSize() const;
+    template <typename PayloadT = Payload>
+    size_t __serializedSize() const {
+        return sizeof(code) + PayloadT::serializedSize(_sendsMessage() ? message : String());
+    }
+
     // two Statuses are equal if they have the same code
     bool operator==(const Status& o);
     bool operator!=(const Status& o);
@@ -56,7 +74,15 @@ struct Status {
     // 5xx retryable error codes
     bool is5xxRetryable() const;
 
-    String getDescription() const;
+    // the standard description for the code, from a static table
+    const char* getDescription() const;
+
+    // true if the code is one of the Statuses below
+    static bool isKnownCode(int code);
+
+private:
+    static constexpr uint16_t _MESSAGE_FLAG = 0x8000;
+    bool _sendsMessage() const;
 };
 
 struct Statuses {
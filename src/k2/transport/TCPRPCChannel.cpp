@@ -24,16 +24,20 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "TCPRPCChannel.h"
 
+#include <utility>
+
 #include <k2/config/Config.h>
 
 // third-party
+#include <seastar/core/future-util.hh>
 #include <seastar/net/inet_address.hh>
 
 namespace k2 {
 
 TCPRPCChannel::TCPRPCChannel(seastar::future<seastar::connected_socket> futureSocket, TXEndpoint endpoint,
                   RequestObserver_t requestObserver, FailureObserver_t failureObserver):
-    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>()),
+    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>(),
+               Config()["tx_compression_threshold"].as<uint32_t>()),
     _endpoint(std::move(endpoint)),
     _fdIsSet(false),
     _closingInProgress(false),
@@ -80,6 +84,8 @@ void TCPRPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageMet
     for (auto& buf : _rpcParser.prepareForSend(verb, std::move(payload), std::move(metadata))) {
         packet = seastar::net::packet(std::move(packet), std::move(buf));
     }
+    _queuedBytes += packet.len();
+    _queuedMessages++;
     if (!_fdIsSet) {
         // we don't have a connected socket yet. Queue up the request
         K2DEBUG("send: not connected yet. Buffering the write, have buffered already " << _pendingWrites.size());
@@ -89,11 +95,90 @@ void TCPRPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageMet
     _sendPacket(std::move(packet));
 }
 
+bool TCPRPCChannel::hasCapacity() const {
+    return _queuedBytes < _maxQueuedBytes() && _queuedMessages < _maxQueuedMessages();
+}
+
+size_t TCPRPCChannel::getQueuedMessages() const {
+    return _queuedMessages;
+}
+
+size_t TCPRPCChannel::getQueuedBytes() const {
+    return _queuedBytes;
+}
+
+size_t TCPRPCChannel::getCapacityWaiters() const {
+    return _capacityWaiters.size();
+}
+
+const RPCParser::CompressionStats& TCPRPCChannel::getCompressionStats() const {
+    return _rpcParser.getCompressionStats();
+}
+
+seastar::future<> TCPRPCChannel::waitForCapacity() {
+    if (hasCapacity() || _closingInProgress) {
+        return seastar::make_ready_future();
+    }
+    _capacityWaiters.emplace_back();
+    return _capacityWaiters.back().get_future();
+}
+
+void TCPRPCChannel::_releaseQueued(size_t bytes, size_t messages) {
+    _queuedBytes -= bytes;
+    _queuedMessages -= messages;
+    if (!hasCapacity() && !_closingInProgress) {
+        return;
+    }
+    // wake everyone up. Waiters queue their messages after this so we may temporarily go over budget
+    while (!_capacityWaiters.empty()) {
+        _capacityWaiters.front().set_value();
+        _capacityWaiters.pop_front();
+    }
+}
+
 void TCPRPCChannel::_sendPacket(seastar::net::packet&& packet) {
-    _sendFuture = _sendFuture->then([packet = std::move(packet), this]() mutable {
-        return _out.write(std::move(packet));
-    }).then([this]() {
+    _batchBytes += packet.len();
+    _batchMessages++;
+    _batch.append(std::move(packet));
+    if (_batchBytes >= _maxBatchBytes()) {
+        // the batch is full. Close it and chain its write now so that it doesn't keep growing while earlier
+        // writes are in flight. A scheduled write which hasn't started yet will find its batch gone and do nothing
+        _writeScheduled = false;
+        auto batchBytes = std::exchange(_batchBytes, 0);
+        auto batchMessages = std::exchange(_batchMessages, 0);
+        _batchId++;
+        _sendFuture = _sendFuture->then([this, batch=std::exchange(_batch, seastar::net::packet()), batchBytes, batchMessages]() mutable {
+            return _writeBatch(std::move(batch), batchBytes, batchMessages);
+        });
+        return;
+    }
+    if (_writeScheduled) {
+        // the pending write hasn't started yet and will pick up this packet
+        return;
+    }
+    _writeScheduled = true;
+    _sendFuture = _sendFuture->then([]() {
+        // yield so that any messages produced in the rest of the task quota make it into this batch
+        return seastar::later();
+    }).then([this, batchId=_batchId]() {
+        if (batchId != _batchId) {
+            // the batch filled up and was written out on its own
+            return seastar::make_ready_future();
+        }
+        _writeScheduled = false;
+        auto batchBytes = std::exchange(_batchBytes, 0);
+        auto batchMessages = std::exchange(_batchMessages, 0);
+        _batchId++;
+        return _writeBatch(std::exchange(_batch, seastar::net::packet()), batchBytes, batchMessages);
+    });
+}
+
+seastar::future<> TCPRPCChannel::_writeBatch(seastar::net::packet&& batch, size_t bytes, size_t messages) {
+    K2DEBUG("writing batch of " << bytes << " bytes");
+    return _out.write(std::move(batch)).then([this]() {
         return _out.flush();
+    }).finally([this, bytes, messages]() {
+        _releaseQueued(bytes, messages);
     });
 }
 
@@ -203,6 +288,8 @@ void TCPRPCChannel::_closeSocket() {
     K2DEBUG("Closing socket: ipr=" << _closingInProgress <<", fdIsSet=" << _fdIsSet);
     if (!_closingInProgress) {
         _closingInProgress = true;
+        // nothing else will be written by this channel. Let any waiters through so they can find a new channel
+        _releaseQueued(0, 0);
 
         // shutdown protocol
         // 1. close input sink (to break any potential read promises)
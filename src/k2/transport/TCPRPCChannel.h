@@ -24,6 +24,9 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+// stl
+#include <deque>
+
 // third-party
 #include <seastar/net/api.hh> // seastar's network stuff
 #include <seastar/util/std-compat.hh>
@@ -31,6 +34,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/config/Config.h>
 #include "BaseTypes.h"
 #include "RPCHeader.h"
 #include "RPCParser.h"
@@ -63,6 +67,26 @@ public: // API
     // The RPC message is configured with the given metadata
     void send(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata meta);
 
+    // Returns true if the channel has room to queue more messages without exceeding its byte/message budgets
+    bool hasCapacity() const;
+
+    // Returns a future which completes once the channel has room to queue more messages.
+    // Messages sent to a channel which is over budget are still queued - this is the backpressure signal
+    // that senders should use to slow down
+    seastar::future<> waitForCapacity();
+
+    // Returns the number of messages which have been sent to the channel but not yet written to the socket
+    size_t getQueuedMessages() const;
+
+    // Returns the number of bytes which have been sent to the channel but not yet written to the socket
+    size_t getQueuedBytes() const;
+
+    // Returns the number of senders waiting for the channel to have room for more messages
+    size_t getCapacityWaiters() const;
+
+    // Returns the compression counters for the messages sent and received on this channel
+    const RPCParser::CompressionStats& getCompressionStats() const;
+
     // Call this method with a callback to observe incoming RPC messages
     void registerMessageObserver(RequestObserver_t observer);
 
@@ -83,9 +107,17 @@ private: // methods
     // helper method to setup an incoming connected socket
     seastar::future<> _setConnectedSocket(seastar::connected_socket sock);
 
-    // helper method used to send a packet
+    // called when queued data has been written out to notify any senders waiting for capacity
+    void _releaseQueued(size_t bytes, size_t messages);
+
+    // helper method used to send a packet. The packet is added to the current write batch, which is written out
+    // and flushed as a single scatter-gather write at the end of the current task quota. A batch which reaches
+    // tcp_max_batch_bytes is closed and its write is chained right away
     void _sendPacket(seastar::net::packet&& packet);
 
+    // writes and flushes a batch of messages, then releases their queued capacity
+    seastar::future<> _writeBatch(seastar::net::packet&& batch, size_t bytes, size_t messages);
+
 private: // fields
     // this is the RPC message parser
     RPCParser _rpcParser;
@@ -135,6 +167,31 @@ private: // fields
     // used to properly chain sends
     seastar::compat::optional<seastar::future<>> _sendFuture;
 
+    // outgoing messages which haven't been handed to the output stream yet
+    seastar::net::packet _batch;
+    size_t _batchBytes = 0;
+    size_t _batchMessages = 0;
+
+    // incremented every time a batch is taken for writing. A scheduled write uses it to tell if its batch was
+    // already written out because it filled up
+    uint64_t _batchId = 0;
+
+    // set if there is a write in the send chain which hasn't started yet. That write will pick up the current batch
+    bool _writeScheduled = false;
+
+    // once a batch reaches this size it is closed and chained for writing without waiting for the end of the
+    // task quota, even if earlier writes are still in flight
+    ConfigVar<uint32_t> _maxBatchBytes{"tcp_max_batch_bytes", 64*1024};
+
+    // data sent to this channel which hasn't been written to the socket yet(pending connect, batched or in-flight)
+    size_t _queuedBytes = 0;
+    size_t _queuedMessages = 0;
+    ConfigVar<uint64_t> _maxQueuedBytes{"tcp_max_queued_bytes", 32*1024*1024};
+    ConfigVar<uint32_t> _maxQueuedMessages{"tcp_max_queued_messages", 64*1024};
+
+    // senders waiting for the queue to drain below the budgets
+    std::deque<seastar::promise<>> _capacityWaiters;
+
 private: // Not needed
     TCPRPCChannel(const TCPRPCChannel& o) = delete;
     TCPRPCChannel(TCPRPCChannel&& o) = delete;
@@ -24,7 +24,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include "TCPRPCProtocol.h"
 
 // third-party
+#include <algorithm>
 #include <seastar/core/future-util.hh>
+#include <seastar/core/metrics.hh>
 #include <seastar/net/api.hh>
 #include <arpa/inet.h> // for inet_ntop
 #include <seastar/net/inet_address.hh> // for inet_address
@@ -56,6 +58,8 @@ TCPRPCProtocol::~TCPRPCProtocol() {
 void TCPRPCProtocol::start() {
     K2DEBUG("start");
     _stopped = false;
+    _leastQueued = _stripePolicy() == "least_queued";
+    _registerMetrics();
     if (_svrEndpoint) {
         K2INFO("Starting listening TCP Proto on: " << _svrEndpoint->getURL());
 
@@ -136,7 +140,9 @@ seastar::future<> TCPRPCProtocol::stop() {
     // place all channels in a list so that we can clear the map
     std::vector<seastar::lw_shared_ptr<TCPRPCChannel>> channels;
     for (auto&& iter: _channels) {
-        channels.push_back(iter.second);
+        for (auto& chan: iter.second.channels) {
+            channels.push_back(chan);
+        }
     }
     _channels.clear();
 
@@ -181,7 +187,8 @@ void TCPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoin
         return;
     }
 
-    auto&& chan = _getOrMakeChannel(endpoint);
+    // only requests may be striped: responses and one-way messages must keep their order
+    auto&& chan = _getOrMakeChannel(endpoint, metadata.isRequestIDSet(), metadata.orderKey);
     if (!chan) {
         K2WARN("Dropping message: Unable to create connection for endpoint " << endpoint.getURL());
         return;
@@ -189,14 +196,60 @@ void TCPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoin
     chan->send(verb, std::move(payload), std::move(metadata));
 }
 
-seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint) {
+seastar::future<> TCPRPCProtocol::waitForCapacity(TXEndpoint& endpoint) {
+    auto iter = _channels.find(endpoint);
+    if (_stopped || iter == _channels.end()) {
+        // no channel means nothing is queued
+        return seastar::make_ready_future();
+    }
+    auto& chans = iter->second.channels;
+    for (auto& chan: chans) {
+        if (chan->hasCapacity()) {
+            return seastar::make_ready_future();
+        }
+    }
+    // all connections are over budget. Wait for the one with the least work left to drain
+    auto chan = *std::min_element(chans.begin(), chans.end(), [](const auto& a, const auto& b) {
+        return a->getQueuedMessages() < b->getQueuedMessages();
+    });
+    // hold on to the channel while we're waiting
+    return chan->waitForCapacity().finally([chan] {});
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint, bool striped, uint64_t orderKey) {
     // look for an existing channel
     K2DEBUG("get or make channel: " << endpoint.getURL());
+    size_t conns = std::max(1u, _connsPerEndpoint());
     auto iter = _channels.find(endpoint);
     if (iter != _channels.end()) {
-        K2DEBUG("found existing channel");
-        return iter->second;
+        auto& stripe = iter->second;
+        if (!striped) {
+            K2DEBUG("found existing channel");
+            return stripe.channels[0];
+        }
+        if (stripe.channels.size() >= conns) {
+            return orderKey == 0 ? _pickChannel(stripe) : stripe.channels[orderKey % stripe.channels.size()];
+        }
+        // the stripe is still growing. Open another connection lazily
+    }
+    auto chan = _connect(endpoint);
+    if (!chan) {
+        // the conn failed immediately. Keep using the connections we already have, if any
+        return iter != _channels.end() ? _pickChannel(iter->second) : nullptr;
     }
+    if (orderKey == 0) {
+        return chan;
+    }
+    // ordered requests pick their connection by position in the stripe. Open the rest of it now, rather than let
+    // the positions change under the key as the stripe grows. Positions only change again if a connection fails,
+    // and the requests in flight on it are lost then anyway
+    auto& stripe = _channels[endpoint];
+    while (stripe.channels.size() < conns && _connect(endpoint)) {
+    }
+    return stripe.channels[orderKey % stripe.channels.size()];
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_connect(TXEndpoint& endpoint) {
     K2DEBUG("creating new channel");
 
     // TODO support for IPv6?
@@ -205,16 +258,27 @@ seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoi
     // we can only get a future for a connection at some point.
     auto futureConn = _vnet.local().connectTCP(address);
     if (futureConn.failed()) {
-        // the conn failed immediately
+        futureConn.ignore_ready_future();
         return nullptr;
     }
     // wrap the connection into a TCPChannel
     return _handleNewChannel(std::move(futureConn), endpoint);
 }
 
+seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_pickChannel(Stripe& stripe) {
+    if (_leastQueued) {
+        return *std::min_element(stripe.channels.begin(), stripe.channels.end(), [](const auto& a, const auto& b) {
+            return a->getQueuedMessages() < b->getQueuedMessages();
+        });
+    }
+    stripe.next = (stripe.next + 1) % stripe.channels.size();
+    return stripe.channels[stripe.next];
+}
+
 seastar::lw_shared_ptr<TCPRPCChannel>
 TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint) {
     K2DEBUG("processing channel: "<< endpoint.getURL());
+    auto& stripe = _channels[endpoint];
     auto chan = seastar::make_lw_shared<TCPRPCChannel>(std::move(futureSocket), endpoint,
         [this] (Request&& request) {
             K2DEBUG("Message " << request.verb << " received from " << request.endpoint.getURL());
@@ -227,21 +291,58 @@ TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> fut
                 if (exc) {
                     K2WARN("Channel " << endpoint.getURL() << ", failed due to " << exc);
                 }
-                auto chanIter = _channels.find(endpoint);
-                if (chanIter != _channels.end()) {
-                    auto chan = chanIter->second;
-                    _channels.erase(chanIter);
-                    return chan->gracefulClose().then([chan] {});
+                auto stripeIter = _channels.find(endpoint);
+                if (stripeIter != _channels.end()) {
+                    // the endpoint we're given is owned by the failed channel
+                    auto& chans = stripeIter->second.channels;
+                    auto chanIter = std::find_if(chans.begin(), chans.end(), [&endpoint](const auto& c) {
+                        return &c->getTXEndpoint() == &endpoint;
+                    });
+                    if (chanIter != chans.end()) {
+                        auto chan = *chanIter;
+                        chans.erase(chanIter);
+                        auto& stats = chan->getCompressionStats();
+                        _closedChannelStats.compressedMessages += stats.compressedMessages;
+                        _closedChannelStats.decompressedMessages += stats.decompressedMessages;
+                        _closedChannelStats.bytesSaved += stats.bytesSaved;
+                        _closedChannelStats.compressNanos += stats.compressNanos;
+                        _closedChannelStats.decompressNanos += stats.decompressNanos;
+                        if (chans.empty()) {
+                            _channels.erase(stripeIter);
+                        }
+                        return chan->gracefulClose().then([chan] {});
+                    }
                 }
             }
             return seastar::make_ready_future();
         });
     assert(chan->getTXEndpoint().canAllocate());
-    _channels.emplace(chan->getTXEndpoint(), chan);
+    stripe.channels.push_back(chan);
     chan->run();
     return chan;
 }
 
+void TCPRPCProtocol::_registerMetrics() {
+    // connections come and go(and inbound ones are from ephemeral ports) so we only report totals for the shard
+    namespace sm = seastar::metrics;
+    using Stats = RPCParser::CompressionStats;
+    _metricGroups.add_group("transport", {
+        sm::make_gauge("tcp_channels", [this]{ return _sumChannels([](auto&) { return 1; });}, sm::description("Open TCP connections")),
+        sm::make_gauge("tcp_queued_bytes", [this]{ return _sumChannels([](auto& c) { return c.getQueuedBytes(); });}, sm::description("Bytes sent to the channels but not yet written to the socket")),
+        sm::make_gauge("tcp_queued_messages", [this]{ return _sumChannels([](auto& c) { return c.getQueuedMessages(); });}, sm::description("Messages sent to the channels but not yet written to the socket")),
+        sm::make_gauge("tcp_capacity_waiters", [this]{ return _sumChannels([](auto& c) { return c.getCapacityWaiters(); });}, sm::description("Senders waiting for a channel queue to drain")),
+        sm::make_counter("tcp_compressed_messages", [this]{ return _compressionTotal(&Stats::compressedMessages);}, sm::description("Outgoing messages sent with a compressed payload")),
+        sm::make_counter("tcp_decompressed_messages", [this]{ return _compressionTotal(&Stats::decompressedMessages);}, sm::description("Incoming messages received with a compressed payload")),
+        sm::make_counter("tcp_compression_bytes_saved", [this]{ return _compressionTotal(&Stats::bytesSaved);}, sm::description("Payload bytes saved on the wire by compression")),
+        sm::make_counter("tcp_compress_nanos", [this]{ return _compressionTotal(&Stats::compressNanos);}, sm::description("Time spent compressing outgoing payloads")),
+        sm::make_counter("tcp_decompress_nanos", [this]{ return _compressionTotal(&Stats::decompressNanos);}, sm::description("Time spent decompressing incoming payloads"))
+    });
+}
+
+uint64_t TCPRPCProtocol::_compressionTotal(uint64_t RPCParser::CompressionStats::* field) {
+    return _closedChannelStats.*field + _sumChannels([field](auto& c) { return c.getCompressionStats().*field; });
+}
+
 TXEndpoint TCPRPCProtocol::_endpointFromAddress(SocketAddress addr) {
     const size_t bufsize = 64;
     char buffer[bufsize];
@@ -23,8 +23,11 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 #include <seastar/core/future.hh>
+#include <seastar/core/metrics_registration.hh>
 #include <seastar/core/shared_ptr.hh>
+
 // k2
+#include <k2/config/Config.h>
 #include "IRPCProtocol.h"
 #include "VirtualNetworkStack.h"
 #include "RPCProtocolFactory.h"
@@ -75,6 +78,9 @@ public: // API
     // The RPC message is configured with the given metadata
     void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
 
+    // Completes when some channel for the given endpoint has room for more messages
+    seastar::future<> waitForCapacity(TXEndpoint& endpoint) override;
+
     // Returns the endpoint where this protocol accepts incoming connections.
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
 
@@ -86,17 +92,52 @@ public: // distributed<> interface
     // Should be called by user when all distributed objects have been created
     void start() override;
 
+private: // types
+    // the connections to a remote endpoint
+    struct Stripe {
+        std::vector<seastar::lw_shared_ptr<TCPRPCChannel>> channels;
+        // round-robin position
+        size_t next = 0;
+    };
+
 private: // methods
-    // utility method which ew use to obtain a connection(either existing or new) for the given endpoint
-    seastar::lw_shared_ptr<TCPRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint);
+    // utility method which ew use to obtain a connection(either existing or new) for the given endpoint.
+    // Requests(striped=true) are spread over up to tcp_conns_per_endpoint connections. Other messages always use
+    // the first connection so that their relative order is preserved. Requests with a non-zero orderKey always
+    // use the same connection of the stripe, picked by the key, so that they keep their order too
+    seastar::lw_shared_ptr<TCPRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint, bool striped, uint64_t orderKey);
+
+    // opens a new connection to the given endpoint. Returns an empty pointer if the connect fails immediately
+    seastar::lw_shared_ptr<TCPRPCChannel> _connect(TXEndpoint& endpoint);
 
     // process a new channel creation
     seastar::lw_shared_ptr<TCPRPCChannel>
     _handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint);
 
+    // pick a channel from the given stripe according to the configured policy
+    seastar::lw_shared_ptr<TCPRPCChannel> _pickChannel(Stripe& stripe);
+
     // Helper method to create an TXEndpoint from a socket address
     TXEndpoint _endpointFromAddress(SocketAddress addr);
 
+    // registers the transport metrics, which are summed over all of our channels
+    void _registerMetrics();
+
+    // sums the given value over all open channels
+    template <typename Func>
+    uint64_t _sumChannels(Func&& func) {
+        uint64_t total = 0;
+        for (auto& [ep, stripe]: _channels) {
+            for (auto& chan: stripe.channels) {
+                total += func(*chan);
+            }
+        }
+        return total;
+    }
+
+    // the compression counter for the given field, over the closed and open channels
+    uint64_t _compressionTotal(uint64_t RPCParser::CompressionStats::* field);
+
 private: // fields
     // the address we're listening on
     SocketAddress _addr;
@@ -111,7 +152,18 @@ private: // fields
     seastar::future<> _listenerClosed = seastar::make_ready_future();
 
     // the underlying TCP channels we're dealing with
-    std::unordered_map<TXEndpoint, seastar::lw_shared_ptr<TCPRPCChannel>> _channels;
+    std::unordered_map<TXEndpoint, Stripe> _channels;
+
+    // how many connections we open to each remote endpoint, and how we pick among them for requests:
+    // "round_robin" or "least_queued"(fewest messages waiting to be written)
+    ConfigVar<uint32_t> _connsPerEndpoint{"tcp_conns_per_endpoint", 1};
+    ConfigVar<String> _stripePolicy{"tcp_stripe_policy", "round_robin"};
+    bool _leastQueued = false;
+
+    // the compression counters of channels which have been closed, so that our counters don't go backwards
+    RPCParser::CompressionStats _closedChannelStats;
+
+    seastar::metrics::metric_groups _metricGroups;
 
 private: // not needed
     TCPRPCProtocol() = delete;
@@ -29,6 +29,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 // k2tx
 #include "TXEndpoint.h"
+#include "PayloadPool.h"
 #include <k2/common/Log.h>
 
 namespace k2 {
@@ -80,71 +81,61 @@ TXEndpoint::~TXEndpoint() {
     K2DEBUG("dtor");
 }
 
-TXEndpoint::TXEndpoint(String&& protocol, String&& ip, uint32_t port, BinaryAllocatorFunctor&& allocator):
-    _protocol(std::move(protocol)),
-    _ip(std::move(ip)),
-    _port(port),
-    _allocator(std::move(allocator)) {
-    bool isIpv6 = _ip.find(":") != String::npos;
-    _url = _protocol + "://" + (isIpv6?"[":"") + _ip + (isIpv6?"]":"");
-    _url += ":" + std::to_string(_port);
-    _hash = std::hash<String>()(_url);
-
-    K2DEBUG("Created endpoint " << _url);
+TXEndpoint::TXEndpoint(String&& protocol, String&& ip, uint32_t port, BinaryAllocatorFunctor&& allocator) {
+    auto data = std::make_shared<_Data>();
+    bool isIpv6 = ip.find(":") != String::npos;
+    data->url = protocol + "://" + (isIpv6?"[":"") + ip + (isIpv6?"]":"");
+    data->url += ":" + std::to_string(port);
+    data->hash = std::hash<String>()(data->url);
+    data->protocol = std::move(protocol);
+    data->ip = std::move(ip);
+    data->port = port;
+    data->allocator = std::move(allocator);
+    _data = std::move(data);
+
+    K2DEBUG("Created endpoint " << _data->url);
 }
 
-TXEndpoint::TXEndpoint(const TXEndpoint& o) {
-    _protocol = o._protocol;
-    _ip = o._ip;
-    _port = o._port;
-    _url = o._url;
-    _hash = o._hash;
-    _allocator = o._allocator;
-    K2DEBUG("Copy endpoint " << _url);
+TXEndpoint::TXEndpoint(const TXEndpoint& o): _data(o._data) {
+    K2DEBUG("Copy endpoint " << getURL());
 }
 
-TXEndpoint::TXEndpoint(TXEndpoint&& o) {
-    K2DEBUG("move ctor");
-    if (&o == this) {
-        K2DEBUG("move ctor on self");
-        return;
-    }
-    K2DEBUG("");
-    _protocol = std::move(o._protocol);
-    _ip = std::move(o._ip);
-    _port = o._port; o._port = 0;
-    _url = std::move(o._url);
-    _hash = o._hash; o._hash = 0;
-    _allocator = std::move(o._allocator);
-    o._allocator = nullptr;
-
-    K2DEBUG("move ctor done");
+TXEndpoint::TXEndpoint(TXEndpoint&& o): _data(std::move(o._data)) {
+    K2DEBUG("move ctor " << getURL());
+}
+
+const TXEndpoint::_Data& TXEndpoint::_get() const {
+    static const _Data empty{};
+    return _data ? *_data : empty;
 }
 
-const String& TXEndpoint::getURL() const { return _url; }
+const String& TXEndpoint::getURL() const { return _get().url; }
 
-const String& TXEndpoint::getProtocol() const { return _protocol; }
+const String& TXEndpoint::getProtocol() const { return _get().protocol; }
 
-const String& TXEndpoint::getIP() const { return _ip; }
+const String& TXEndpoint::getIP() const { return _get().ip; }
 
-uint32_t TXEndpoint::getPort() const { return _port; }
+uint32_t TXEndpoint::getPort() const { return _get().port; }
 
 bool TXEndpoint::operator==(const TXEndpoint& other) const {
-    return _url == other._url;
+    return _data == other._data || _get().url == other._get().url;
 }
 
-size_t TXEndpoint::hash() const { return _hash; }
+size_t TXEndpoint::hash() const { return _get().hash; }
 
-std::unique_ptr<Payload> TXEndpoint::newPayload() {
-    K2ASSERT(_allocator != nullptr, "asked to create payload from non-allocating endpoint");
-    auto result = std::make_unique<Payload>(_allocator);
+std::unique_ptr<Payload> TXEndpoint::newPayload(size_t sizeHint) {
+    K2ASSERT(canAllocate(), "asked to create payload from non-allocating endpoint");
+    auto result = std::make_unique<Payload>(_data->allocator);
+    if (sizeHint > 0 && txconstants::MAX_HEADER_SIZE + sizeHint <= PayloadPool::SMALL_BUFFER_SIZE) {
+        result->addCapacity(PayloadPool::local().getBuffer(PayloadPool::SMALL_BUFFER_SIZE));
+    }
     // rewind enough bytes to write out a header when we're sending
     result->skip(txconstants::MAX_HEADER_SIZE);
     return result;
 }
 
 bool TXEndpoint::canAllocate() const {
-    return _allocator != nullptr;
+    return _data && _data->allocator != nullptr;
 }
 
 }
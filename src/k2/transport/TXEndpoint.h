@@ -79,26 +79,37 @@ public: // API
     // get the port for this endpoint
     uint32_t getPort() const;
 
-    // Comparison
+    // Comparison. Copies of the same endpoint compare without looking at the URL
     bool operator==(const TXEndpoint &other) const;
 
     // the stored hash value for this endpoint.
     size_t hash() const;
 
     // This method should be used to create new payloads. The payloads are allocated in a manner consistent
-    // with the transport for the protocol of this endpoint
-    std::unique_ptr<Payload> newPayload();
+    // with the transport for the protocol of this endpoint.
+    // If the caller knows how many bytes it is about to write, small messages are served from a single small buffer
+    std::unique_ptr<Payload> newPayload(size_t sizeHint=0);
 
     // Use to determine if this endpoint can allocate
     bool canAllocate() const;
 
+private: // types
+    // The state of an endpoint never changes after construction. Copies of an endpoint share it so that copying
+    // an endpoint(e.g. into every incoming Request) doesn't allocate
+    struct _Data {
+        String url;
+        String protocol;
+        String ip;
+        uint32_t port = 0;
+        size_t hash = 0;
+        BinaryAllocatorFunctor allocator;
+    };
+
+    // the shared state, or an empty state for default-constructed and moved-from endpoints
+    const _Data& _get() const;
+
 private: // fields
-    String _url;
-    String _protocol;
-    String _ip;
-    uint32_t _port;
-    size_t _hash;
-    BinaryAllocatorFunctor _allocator;
+    std::shared_ptr<const _Data> _data;
 
 }; // class TXEndpoint
 
@@ -0,0 +1,283 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "UDPRPCProtocol.h"
+
+// third-party
+#include <arpa/inet.h> // for inet_ntop
+#include <seastar/core/future-util.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/net/inet_address.hh> // for inet_address
+
+//k2
+#include <k2/common/Log.h>
+
+namespace k2 {
+const String UDPRPCProtocol::proto("udp+k2rpc");
+
+UDPRPCProtocol::UDPRPCProtocol(VirtualNetworkStack::Dist_t& vnet):
+    IRPCProtocol(vnet, proto),
+    _stopped(true),
+    _useChecksum(Config()["enable_tx_checksum"].as<bool>()),
+    _sendParser([]{return false;}, _useChecksum) {
+    K2DEBUG("ctor");
+}
+
+UDPRPCProtocol::UDPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, SocketAddress addr):
+    IRPCProtocol(vnet, proto),
+    _addr(addr),
+    _svrEndpoint(seastar::make_lw_shared<TXEndpoint>(_endpointFromAddress(_addr))),
+    _stopped(true),
+    _useChecksum(Config()["enable_tx_checksum"].as<bool>()),
+    _sendParser([]{return false;}, _useChecksum) {
+    K2DEBUG("ctor");
+}
+
+UDPRPCProtocol::~UDPRPCProtocol() {
+    K2DEBUG("dtor");
+}
+
+RPCProtocolFactory::BuilderFunc_t UDPRPCProtocol::builder(VirtualNetworkStack::Dist_t& vnet) {
+    K2DEBUG("builder creating non-listening udp protocol");
+    return [&vnet]() mutable -> seastar::shared_ptr<IRPCProtocol> {
+        K2DEBUG("builder running");
+        return seastar::static_pointer_cast<IRPCProtocol>(
+            seastar::make_shared<UDPRPCProtocol>(vnet));
+    };
+}
+
+RPCProtocolFactory::BuilderFunc_t UDPRPCProtocol::builder(VirtualNetworkStack::Dist_t& vnet, IAddressProvider& addrProvider) {
+    K2DEBUG("builder creating multi-address udp protocol");
+    return [&vnet, &addrProvider]() mutable -> seastar::shared_ptr<IRPCProtocol> {
+        auto myID = seastar::engine().cpu_id() % seastar::smp::count;
+        K2DEBUG("builder created");
+
+        return seastar::static_pointer_cast<IRPCProtocol>(
+            seastar::make_shared<UDPRPCProtocol>(vnet, addrProvider.getAddress(myID)));
+    };
+}
+
+void UDPRPCProtocol::start() {
+    K2DEBUG("start");
+    _stopped = false;
+    if (_svrEndpoint) {
+        K2INFO("Starting listening UDP Proto on: " << _svrEndpoint->getURL());
+        _channel = seastar::make_lw_shared<seastar::net::udp_channel>(_vnet.local().bindUDP(_addr));
+    }
+    else {
+        K2INFO("Starting non-listening UDP Proto...");
+        _channel = seastar::make_lw_shared<seastar::net::udp_channel>(_vnet.local().bindUDP(SocketAddress{}));
+    }
+    _retransmitTimer.set_callback([this] { _retransmit(); });
+
+    namespace sm = seastar::metrics;
+    _metricGroups.add_group("transport", {
+        sm::make_counter("udp_sent_messages", _stats.sentMessages, sm::description("Messages sent over UDP, including retransmits")),
+        sm::make_counter("udp_received_messages", _stats.receivedMessages, sm::description("Messages received over UDP")),
+        sm::make_counter("udp_oversized_messages", _stats.oversizedMessages, sm::description("Outgoing messages dropped since they don't fit in a datagram")),
+        sm::make_counter("udp_bad_datagrams", _stats.badDatagrams, sm::description("Incoming datagrams dropped since they didn't hold exactly one valid message")),
+        sm::make_counter("udp_retransmits", _stats.retransmits, sm::description("Requests sent again since they had no reply yet")),
+        sm::make_gauge("udp_pending_requests", [this] { return _pending.size(); }, sm::description("Requests waiting for a reply which may be retransmitted"))
+    });
+
+    // a closed channel fails the outstanding receive, which ends the loop
+    _receiveLoopDone = seastar::do_until(
+        [this] { return _stopped; },
+        [this] {
+            return _channel->receive().then([this](seastar::net::udp_datagram&& datagram) {
+                if (!_stopped) {
+                    _handleDatagram(std::move(datagram));
+                }
+            });
+        })
+        .handle_exception([this](auto exc) {
+            if (!_stopped) {
+                K2WARN_EXC("UDP receive loop failed", exc);
+            }
+        });
+}
+
+seastar::future<> UDPRPCProtocol::stop() {
+    K2DEBUG("stop");
+    _stopped = true;
+    _retransmitTimer.cancel();
+    _pending.clear();
+    _metricGroups.clear();
+    if (!_channel) {
+        return seastar::make_ready_future();
+    }
+    _channel->shutdown_input();
+    return seastar::when_all_succeed(std::move(_receiveLoopDone), _sendGate.close()).discard_result()
+        .finally([chan=_channel] {
+            chan->close();
+        });
+}
+
+std::unique_ptr<TXEndpoint> UDPRPCProtocol::getTXEndpoint(String url) {
+    if (_stopped) {
+        K2WARN("Unable to create endpoint since we're stopped for url " << url);
+        return nullptr;
+    }
+    K2DEBUG("get endpoint for " << url);
+    auto ep = TXEndpoint::fromURL(url, _vnet.local().getUDPAllocator());
+    if (!ep || ep->getProtocol() != proto) {
+        K2WARN("Cannot construct non-`" << proto << "` endpoint");
+        return nullptr;
+    }
+    return ep;
+}
+
+seastar::lw_shared_ptr<TXEndpoint> UDPRPCProtocol::getServerEndpoint() {
+    return _svrEndpoint;
+}
+
+void UDPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) {
+    if (_stopped) {
+        K2WARN("Dropping message since we're stopped: verb=" << int(verb) << ", url=" << endpoint.getURL());
+        return;
+    }
+    bool retransmit = metadata.isRequestIDSet() && metadata.isDeadlineSet();
+    auto requestID = metadata.requestID;
+    auto deadline = Clock::now() + metadata.getDeadline();
+
+    auto datagram = _sendParser.prepareForSend(verb, std::move(payload), std::move(metadata));
+    size_t size = 0;
+    for (auto& buf: datagram) {
+        size += buf.size();
+    }
+    if (size > _maxDatagramSize()) {
+        K2WARN("Dropping message of " << size << " bytes which doesn't fit in a datagram: verb=" << int(verb) << ", url=" << endpoint.getURL());
+        _stats.oversizedMessages++;
+        return;
+    }
+
+    // TODO support for IPv6?
+    auto address = seastar::make_ipv4_address({endpoint.getIP().c_str(), uint16_t(endpoint.getPort())});
+    _sendDatagram(address, datagram);
+    if (retransmit) {
+        auto now = Clock::now();
+        _pending[requestID] = PendingRequest{
+            .address = address, .datagram = std::move(datagram), .nextSend = now + _retransmitInterval(), .deadline = deadline};
+        if (!_retransmitTimer.armed()) {
+            _retransmitTimer.arm_periodic(_retransmitInterval());
+        }
+    }
+}
+
+void UDPRPCProtocol::_sendDatagram(const SocketAddress& address, const std::vector<Binary>& datagram) {
+    seastar::net::packet packet;
+    for (auto& buf: datagram) {
+        packet = seastar::net::packet(std::move(packet), buf.share());
+    }
+    _stats.sentMessages++;
+    (void)seastar::with_gate(_sendGate, [this, address, packet=std::move(packet)] () mutable {
+        return _channel->send(address, std::move(packet));
+    }).handle_exception([this](auto exc) {
+        if (!_stopped) {
+            K2WARN_EXC("UDP send failed", exc);
+        }
+    });
+}
+
+void UDPRPCProtocol::_retransmit() {
+    auto now = Clock::now();
+    for (auto it = _pending.begin(); it != _pending.end();) {
+        auto& req = it->second;
+        if (now >= req.deadline) {
+            // the dispatcher times out the request
+            it = _pending.erase(it);
+            continue;
+        }
+        if (now >= req.nextSend) {
+            K2DEBUG("retransmitting request " << it->first);
+            _stats.retransmits++;
+            _sendDatagram(req.address, req.datagram);
+            req.nextSend = now + _retransmitInterval();
+        }
+        ++it;
+    }
+    if (_pending.empty()) {
+        _retransmitTimer.cancel();
+    }
+}
+
+void UDPRPCProtocol::_handleDatagram(seastar::net::udp_datagram&& datagram) {
+    TXEndpoint& endpoint = _getEndpoint(datagram.get_src());
+    // every datagram gets its own parser so that a bad datagram can't affect the next one
+    bool dispatched = false;
+    bool failed = false;
+    RPCParser parser([]{return false;}, _useChecksum);
+    parser.registerParserFailureObserver([&failed](std::exception_ptr) {
+        failed = true;
+    });
+    parser.registerMessageObserver([this, &endpoint, &dispatched, &failed](Verb verb, MessageMetadata metadata, std::unique_ptr<Payload> payload) {
+        if (dispatched || failed) {
+            // only one message per datagram
+            failed = true;
+            return;
+        }
+        dispatched = true;
+        if (metadata.isResponseIDSet()) {
+            _pending.erase(metadata.responseID);
+        }
+        _stats.receivedMessages++;
+        K2DEBUG("Message " << int(verb) << " received from " << endpoint.getURL());
+        _messageObserver(Request(verb, endpoint, std::move(metadata), std::move(payload)));
+    });
+    for (auto& buf: datagram.get_data().release()) {
+        if (failed) {
+            break;
+        }
+        parser.feed(std::move(buf));
+        while (parser.canDispatch()) {
+            parser.dispatchSome();
+        }
+    }
+    if (failed || !dispatched) {
+        K2WARN("Dropping bad datagram from " << endpoint.getURL());
+        _stats.badDatagrams++;
+    }
+}
+
+TXEndpoint& UDPRPCProtocol::_getEndpoint(const SocketAddress& addr) {
+    auto& in = addr.as_posix_sockaddr_in();
+    uint64_t key = (uint64_t(in.sin_addr.s_addr) << 16) | in.sin_port;
+    auto it = _endpoints.find(key);
+    if (it != _endpoints.end()) {
+        return it->second;
+    }
+    if (_endpoints.size() >= 64*1024) {
+        // we've heard from too many peers. Start over rather than grow without bound
+        _endpoints.clear();
+    }
+    return _endpoints.emplace(key, _endpointFromAddress(addr)).first->second;
+}
+
+TXEndpoint UDPRPCProtocol::_endpointFromAddress(const SocketAddress& addr) {
+    const size_t bufsize = 64;
+    char buffer[bufsize];
+    auto inetaddr=addr.addr();
+    String ip(::inet_ntop(int(inetaddr.in_family()), inetaddr.data(), buffer, bufsize));
+    return TXEndpoint(String(proto), std::move(ip), addr.port(), _vnet.local().getUDPAllocator());
+}
+
+} // namespace k2
@@ -0,0 +1,173 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+// stl
+#include <unordered_map>
+#include <vector>
+
+// third-party
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/metrics_registration.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/net/api.hh>
+
+// k2
+#include <k2/config/Config.h>
+#include "IRPCProtocol.h"
+#include "VirtualNetworkStack.h"
+#include "RPCProtocolFactory.h"
+#include "RPCParser.h"
+#include "RPCHeader.h"
+
+namespace k2 {
+
+// UDPRPCProtocol sends every RPC message as a single UDP datagram. It is meant for small idempotent messages
+// (e.g. heartbeats, timestamp batch requests) which don't need a connection and shouldn't be stuck behind other
+// messages as they would on a TCP connection.
+// - each core binds one UDP channel, either on the given address or on an ephemeral port(client-mode only)
+// - messages are framed with the RPCParser. A datagram must hold exactly one message. Messages which don't fit in
+//   udp_max_datagram_size bytes are dropped, so the sender sees a timeout
+// - requests are sent again every udp_retransmit_interval until a reply arrives or the deadline the dispatcher
+//   put in the request passes. A server may therefore see the same request more than once: only use this
+//   protocol for verbs whose handlers are idempotent
+// NB, the class is meant to be used as a distributed<> container
+class UDPRPCProtocol: public IRPCProtocol {
+public: // types
+    // Convenience builder which binds each core to an ephemeral port(client-mode only)
+    static RPCProtocolFactory::BuilderFunc_t builder(VirtualNetworkStack::Dist_t& vnet);
+
+    // Allow building of protocols with an address provider. Each core needs its own address
+    static RPCProtocolFactory::BuilderFunc_t builder(VirtualNetworkStack::Dist_t& vnet, IAddressProvider& addrProvider);
+
+    // The official protocol name supported for communications over UDPRPC
+    static const String proto;
+
+public: // lifecycle
+    // Construct the protocol with a vnet which supports UDP and listens on the given address
+    UDPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, SocketAddress addr);
+
+    // Construct the protocol with a vnet which supports UDP and no listening address
+    UDPRPCProtocol(VirtualNetworkStack::Dist_t& vnet);
+
+    // Destructor
+    virtual ~UDPRPCProtocol();
+
+public: // API
+    // This method creates an endpoint for a given URL. The endpoint is needed in order to
+    // 1. obtain protocol-specific payloads
+    // 2. send messages.
+    // returns blank pointer if we failed to parse the url or if the protocol is not supported
+    std::unique_ptr<TXEndpoint> getTXEndpoint(String url) override;
+
+    // Sends the message as one datagram. This is an asyncronous API. No guarantees are made on the delivery of the
+    // payload after the call returns.
+    void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
+
+    // Returns the endpoint where this protocol receives requests(empty pointer in client-mode)
+    seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
+
+public: // distributed<> interface
+    // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
+    // The returned future completes once the receive loop and all sends are done
+    seastar::future<> stop() override;
+
+    // Should be called by user when all distributed objects have been created
+    void start() override;
+
+private: // types
+    // a request which we send again until it is answered or it expires
+    struct PendingRequest {
+        SocketAddress address;
+        std::vector<Binary> datagram;
+        TimePoint nextSend;
+        TimePoint deadline;
+    };
+
+    struct Stats {
+        uint64_t sentMessages = 0;
+        uint64_t receivedMessages = 0;
+        uint64_t oversizedMessages = 0;
+        uint64_t badDatagrams = 0;
+        uint64_t retransmits = 0;
+    };
+
+private: // methods
+    // parse the message in the given datagram and pass it on to the message observer
+    void _handleDatagram(seastar::net::udp_datagram&& datagram);
+
+    // write out the given datagram. The buffers are shared so that the caller can keep them
+    void _sendDatagram(const SocketAddress& address, const std::vector<Binary>& datagram);
+
+    // called periodically while there are pending requests
+    void _retransmit();
+
+    // the endpoint for a remote address. Endpoints are cached as we get one for every incoming message
+    TXEndpoint& _getEndpoint(const SocketAddress& addr);
+
+    // Helper method to create an TXEndpoint from a socket address
+    TXEndpoint _endpointFromAddress(const SocketAddress& addr);
+
+private: // fields
+    // the address we're bound to
+    SocketAddress _addr;
+
+    // the endpoint version of the address we're listening on
+    seastar::lw_shared_ptr<TXEndpoint> _svrEndpoint;
+
+    // we use this flag to signal exit
+    bool _stopped;
+
+    seastar::lw_shared_ptr<seastar::net::udp_channel> _channel;
+    seastar::future<> _receiveLoopDone = seastar::make_ready_future();
+    seastar::gate _sendGate;
+
+    // used to frame outgoing messages
+    bool _useChecksum;
+    RPCParser _sendParser;
+
+    // requests we may have to send again, by request id
+    std::unordered_map<uint32_t, PendingRequest> _pending;
+    seastar::timer<> _retransmitTimer;
+
+    // remote endpoints, by ipv4 address and port
+    std::unordered_map<uint64_t, TXEndpoint> _endpoints;
+
+    ConfigVar<uint32_t> _maxDatagramSize{"udp_max_datagram_size", 8192};
+    ConfigDuration _retransmitInterval{"udp_retransmit_interval", 10ms};
+
+    Stats _stats;
+    seastar::metrics::metric_groups _metricGroups;
+
+private: // not needed
+    UDPRPCProtocol() = delete;
+    UDPRPCProtocol(const UDPRPCProtocol& o) = delete;
+    UDPRPCProtocol(UDPRPCProtocol&& o) = delete;
+    UDPRPCProtocol &operator=(const UDPRPCProtocol& o) = delete;
+    UDPRPCProtocol &operator=(UDPRPCProtocol&& o) = delete;
+
+}; // class UDPRPCProtocol
+
+} // namespace k2
@@ -24,11 +24,13 @@ Copyright(c) 2020 Futurewei Cloud
 #include "VirtualNetworkStack.h"
 
 // third-party
+#include <seastar/core/metrics.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/net/net.hh>
 
 // k2
 #include <k2/common/Log.h>
+#include "PayloadPool.h"
 
 // determine the packet size we should allocate: mtu - tcp_header_size - ip_header_size - ethernet_header_size
 const uint16_t tcpsegsize = seastar::net::hw_features().mtu
@@ -63,8 +65,37 @@ VirtualNetworkStack::connectTCP(SocketAddress remoteAddress, SocketAddress sourc
     return seastar::engine().net().connect(std::move(remoteAddress), std::move(sourceAddress));
 }
 
+seastar::net::udp_channel VirtualNetworkStack::bindUDP(SocketAddress sa) {
+    K2DEBUG("bind udp on: " << sa);
+    // TODO For now, just use the engine's global network
+    return seastar::engine().net().make_udp_channel(sa);
+}
+
+BinaryAllocatorFunctor VirtualNetworkStack::getUDPAllocator() {
+    // A message has to fit in one datagram, so there is no point in allocating more than a segment at a time
+    return []() {
+        K2DEBUG("udp allocating binary with size=" << tcpsegsize);
+        return PayloadPool::local().getBuffer(tcpsegsize);
+    };
+}
+
 void VirtualNetworkStack::start(){
     K2DEBUG("start");
+    PayloadPool::local().setMaxFreeBytes(_payloadPoolMaxBytes());
+
+    namespace sm = seastar::metrics;
+    _metricGroups.add_group("payload_pool", {
+        sm::make_counter("buffer_allocs", [] { return PayloadPool::local().getStats().bufferAllocs; },
+            sm::description("Payload buffers which had to be allocated")),
+        sm::make_counter("buffer_reuses", [] { return PayloadPool::local().getStats().bufferReuses; },
+            sm::description("Payload buffers served from the pool")),
+        sm::make_counter("payload_allocs", [] { return PayloadPool::local().getStats().payloadAllocs; },
+            sm::description("Payload objects which had to be allocated")),
+        sm::make_counter("payload_reuses", [] { return PayloadPool::local().getStats().payloadReuses; },
+            sm::description("Payload objects served from the pool")),
+        sm::make_gauge("free_bytes", [] { return PayloadPool::local().getStats().freeBytes; },
+            sm::description("Bytes held in the free lists of the pool"))
+    });
 }
 
 BinaryAllocatorFunctor VirtualNetworkStack::getTCPAllocator() {
@@ -76,10 +107,9 @@ BinaryAllocatorFunctor VirtualNetworkStack::getTCPAllocator() {
 
         // TODO: it seems only ipv4 is supported via the seastar's network_stack, so just use ipv6 header size here
 
-        // NB, there is no performance benefit of allocating smaller chunks. Chunks up to 16384 are allocated from
-        // seastar pool allocator and overhead is the same regardless of size(~10ns per allocation)
+        // Segments come from the per-core PayloadPool so that their memory is reused from message to message
         K2DEBUG("allocating binary with size=" << tcpsegsize);
-        return Binary(tcpsegsize);
+        return PayloadPool::local().getBuffer(tcpsegsize);
     };
 }
 
@@ -97,6 +127,7 @@ void VirtualNetworkStack::registerLowTCPMemoryObserver(LowMemoryObserver_t obser
 
 seastar::future<> VirtualNetworkStack::stop() {
     K2DEBUG("stop");
+    _metricGroups.clear();
     return seastar::make_ready_future<>();
 }
 
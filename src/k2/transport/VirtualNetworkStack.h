@@ -28,9 +28,11 @@ Copyright(c) 2020 Futurewei Cloud
 #include <seastar/net/api.hh> // socket/network stuff
 #include <seastar/core/future.hh> // future stuff
 #include <seastar/net/rdma.hh>
+#include <seastar/core/metrics_registration.hh>
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/config/Config.h>
 #include "BaseTypes.h"
 
 namespace k2 {
@@ -78,7 +80,12 @@ public: // TCP API
     void registerLowTCPMemoryObserver(LowMemoryObserver_t observer);
 
 public: // UDP API
-    // TODO add UDP support
+    // Create a UDP channel bound to the given address. A default-constructed address binds to an ephemeral port
+    // It is up to caller to close the channel when it is no longer needed
+    seastar::net::udp_channel bindUDP(SocketAddress sa);
+
+    // Create a payload from the UDP provider
+    BinaryAllocatorFunctor getUDPAllocator();
 
 public: // RDMA API
     // Create a server(listening) RRDMA socket on the local interface.
@@ -111,6 +118,10 @@ private: // fields
     LowMemoryObserver_t _lowTCPMemObserver;
     LowMemoryObserver_t _lowRRDMAMemObserver;
 
+    // the most memory the per-core PayloadPool keeps in its free lists
+    ConfigVar<uint64_t> _payloadPoolMaxBytes{"payload_pool_max_bytes", 16*1024*1024};
+    seastar::metrics::metric_groups _metricGroups;
+
 private: // Not needed
     VirtualNetworkStack(const VirtualNetworkStack& o) = delete;
     VirtualNetworkStack(VirtualNetworkStack&& o) = delete;
@@ -24,6 +24,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <random>
 #include <algorithm>
+#include <cmath>
 
 #include <seastar/core/sleep.hh>
 
@@ -40,10 +41,60 @@ seastar::future<> TSO_ClientLib::start()
     K2INFO("start with server url: " << TSOServerURL());
     _stopped = false;
 
-    _tSOServerURLs.emplace_back(TSOServerURL());
-    // for now we use the first server URL only, in the future, allow to check other server in case first one is not available
+    if (!TSOServerURL().empty())
+    {
+        _tSOServerURLs.emplace_back(TSOServerURL());
+    }
+    for (auto& url : _moreTSOServerURLs())
+    {
+        if (std::find(_tSOServerURLs.begin(), _tSOServerURLs.end(), url) == _tSOServerURLs.end())
+        {
+            _tSOServerURLs.emplace_back(url);
+        }
+    }
+    _registerMetrics();
+
+    if (_proxyGroupSize() > 1 && _proxyCore() != seastar::engine().cpu_id())
+    {
+        // this core gets its batches from the proxy core, which is the only one talking to the TSO servers
+        K2INFO("Getting timestamp batches through the proxy on core " << _proxyCore());
+        return seastar::make_ready_future<>();
+    }
+
+    // we use the workers of all the servers we can reach. A server which is down now is simply left out
     return seastar::sleep(_startDelay)
-        .then([this] () mutable { return DiscoverServerWorkerEndPoints(_tSOServerURLs[0]); });
+        .then([this] () mutable
+        {
+            std::vector<seastar::future<>> futs;
+            for (auto& url : _tSOServerURLs)
+            {
+                futs.push_back(DiscoverServerWorkerEndPoints(url)
+                    .handle_exception([url] (auto exc)
+                    {
+                        K2WARN_EXC("Unable to discover the workers of TSO server " << url, exc);
+                    }));
+            }
+            return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
+        })
+        .then([this] () mutable
+        {
+            if (_stopped)
+            {
+                return seastar::make_ready_future<>();
+            }
+            if (_tsoWorkers.empty())
+            {
+                K2ERROR("No TSO worker found on any of the " << _tSOServerURLs.size() << " TSO servers");
+                return seastar::make_exception_future<>(std::runtime_error("no TSO workers"));
+            }
+
+            // shuffle the workers so that clients which don't have latency data yet spread their load
+            std::random_device rd;
+            std::mt19937 ranAlg(rd());
+            std::shuffle(_tsoWorkers.begin(), _tsoWorkers.end(), ranAlg);
+            K2INFO("Using " << _tsoWorkers.size() << " TSO workers from " << _tSOServerURLs.size() << " TSO servers");
+            return seastar::make_ready_future<>();
+        });
 }
 
 seastar::future<> TSO_ClientLib::gracefulStop() {
@@ -53,6 +104,8 @@ seastar::future<> TSO_ClientLib::gracefulStop() {
     }
 
     _stopped = true;
+    _metricGroups.clear();
+    _recentTimestampTimer.cancel();
 
     for (auto&& clientRequest : _pendingClientRequests)
     {
@@ -60,11 +113,119 @@ seastar::future<> TSO_ClientLib::gracefulStop() {
     }
     _pendingClientRequests.clear();
 
-    //TODO: consider gracefully record outgoing batch request to TSO server and set exception to them as well.
-    //currently, only in its continuation do nothing if stop is called. Should be ok except if this object is quickly deleted.
+    for (auto&& waiter : _proxyWaiters)
+    {
+        waiter.promise.set_exception(TSOClientLibShutdownException());
+    }
+    _proxyWaiters.clear();
+
+    // wait for the outstanding batch requests and hedge delays. Their continuations see _stopped and don't go on
+    return seastar::when_all_succeed(std::move(_recentTimestampRefresh), _batchRequestGate.close()).discard_result();
+}
 
+seastar::future<std::tuple<Timestamp, Duration>> TSO_ClientLib::GetTimeStampWithMTLFromTSO(const TimePoint& requestLocalTime)
+{
+    return GetTimestampFromTSO(requestLocalTime)
+        .then([] (Timestamp&& ts)
+        {
+            // the timestamps of a batch keep its TsDelta as the distance between their start and end
+            Duration mtl = 1ns * (ts.tEndTSECount() - ts.tStartTSECount());
+            return std::make_tuple(std::move(ts), mtl);
+        });
+}
+
+seastar::future<Timestamp> TSO_ClientLib::GetRecentTimestamp(Duration maxStaleness)
+{
+    auto now = Clock::now();
+    if (_recentTimestampTime != TimePoint{} && now - _recentTimestampTime <= maxStaleness)
+    {
+        _stats.recentTimestampHits++;
+        return seastar::make_ready_future<Timestamp>(_recentTimestamp);
+    }
+
+    _stats.recentTimestampMisses++;
+    return GetTimestampFromTSO(now)
+        .then([this, now] (Timestamp&& ts)
+        {
+            _updateRecentTimestamp(ts, now);
+            return std::move(ts);
+        });
+}
+
+seastar::future<> TSO_ClientLib::SubscribeRecentTimestamp(Duration maxStaleness)
+{
+    return AppBase().getDist<TSO_ClientLib>().invoke_on(0, [maxStaleness] (TSO_ClientLib& client)
+    {
+        bool tighter = client._recentTimestampSubscribers.empty() || maxStaleness < *client._recentTimestampSubscribers.begin();
+        client._recentTimestampSubscribers.insert(maxStaleness);
+        // refresh now for a subscriber which needs a fresher timestamp than what we have been refreshing for.
+        // The next refresh then goes by the new interval
+        if (tighter && !client._recentTimestampRefreshing && !client._stopped)
+        {
+            client._recentTimestampTimer.cancel();
+            client._refreshRecentTimestamp();
+        }
+    });
+}
+
+seastar::future<> TSO_ClientLib::UnsubscribeRecentTimestamp(Duration maxStaleness)
+{
+    return AppBase().getDist<TSO_ClientLib>().invoke_on(0, [maxStaleness] (TSO_ClientLib& client)
+    {
+        auto iter = client._recentTimestampSubscribers.find(maxStaleness);
+        if (iter != client._recentTimestampSubscribers.end())
+        {
+            client._recentTimestampSubscribers.erase(iter);
+        }
+        // a pending refresh re-arms the timer with the interval of the remaining subscribers, if any
+        if (client._recentTimestampSubscribers.empty())
+        {
+            client._recentTimestampTimer.cancel();
+        }
+    });
+}
+
+Duration TSO_ClientLib::_recentTimestampRefreshInterval() const
+{
+    // half the smallest tolerated staleness, so that a timestamp is always there for a subscriber, even with
+    // a slow TSO round trip
+    return *_recentTimestampSubscribers.begin() / 2;
+}
+
+void TSO_ClientLib::_refreshRecentTimestamp()
+{
+    _recentTimestampRefreshing = true;
+    auto requestTime = Clock::now();
+    _recentTimestampRefresh = GetTimestampFromTSO(requestTime)
+        .then([requestTime] (Timestamp&& ts)
+        {
+            return AppBase().getDist<TSO_ClientLib>().invoke_on_all([ts, requestTime] (TSO_ClientLib& client)
+            {
+                client._updateRecentTimestamp(ts, requestTime);
+            });
+        })
+        .handle_exception([] (auto exc)
+        {
+            K2WARN_EXC("Unable to refresh the recent timestamp", exc);
+        })
+        .finally([this]
+        {
+            _recentTimestampRefreshing = false;
+            if (!_stopped && !_recentTimestampSubscribers.empty())
+            {
+                _recentTimestampTimer.arm(_recentTimestampRefreshInterval());
+            }
+        });
+}
 
-    return seastar::make_ready_future<>();
+void TSO_ClientLib::_updateRecentTimestamp(const Timestamp& ts, TimePoint requestTime)
+{
+    // a timestamp requested later is not older, whichever TSO worker it came from
+    if (requestTime >= _recentTimestampTime)
+    {
+        _recentTimestamp = ts;
+        _recentTimestampTime = requestTime;
+    }
 }
 
 seastar::future<> TSO_ClientLib::DiscoverServerWorkerEndPoints(const k2::String& serverURL)
@@ -101,39 +262,46 @@ seastar::future<> TSO_ClientLib::DiscoverServerWorkerEndPoints(const k2::String&
             payload->read(workerURLs);
             K2ASSERT(!workerURLs.empty(), "TSO server should have workers");
 
-            _curTSOServerWorkerEndPoints.clear();
             // each worker may have mulitple endPoints URLs, we only pick the fastest supported one, currently RDMA, if no RDMA, pick TCPIP
+            // UDP is picked over both when tso_prefer_udp is set and we support it
             for (auto& singleWorkerURLs : workerURLs)
             {
                 k2::TXEndpoint endPointToAdd;
                 for (auto& url : singleWorkerURLs)
                 {
-                    auto tempEndPoint = *(k2::RPC().getTXEndpoint(url));
+                    auto ep = k2::RPC().getTXEndpoint(url);
+                    if (!ep)
+                    {
+                        // a protocol we don't support
+                        K2INFO("Skipping unsupported remote data endpoint: " << url);
+                        continue;
+                    }
+                    auto tempEndPoint = *ep;
                     K2INFO("Found remote data endpoint: " << url);
-                    if (tempEndPoint.getProtocol() == RRDMARPCProtocol::proto)
+                    if (tempEndPoint.getProtocol() == UDPRPCProtocol::proto)
+                    {
+                        if (_preferUDP())
+                        {
+                            endPointToAdd = tempEndPoint;
+                            break;
+                        }
+                    }
+                    else if (tempEndPoint.getProtocol() == RRDMARPCProtocol::proto)
                     {
-                        // if found RDMA, use it and break out
+                        // if found RDMA, use it, unless a UDP endpoint comes later and we prefer it
                         endPointToAdd = tempEndPoint;
-                        break;
                     }
-                    else if (tempEndPoint.getProtocol() == TCPRPCProtocol::proto)
+                    else if (tempEndPoint.getProtocol() == TCPRPCProtocol::proto && endPointToAdd.getProtocol() != RRDMARPCProtocol::proto)
                     {
                         // keep it to enPointToAdd, maybe replaced by RDMA endpoint later
                         endPointToAdd = tempEndPoint;
                     }
                 }
-                _curTSOServerWorkerEndPoints.emplace_back(endPointToAdd);
+                WorkerInfo worker;
+                worker.endpoint = endPointToAdd;
+                _tsoWorkers.emplace_back(std::move(worker));
             }
 
-            K2ASSERT(!_curTSOServerWorkerEndPoints.empty(), "workers should property configured")
-
-            // to reduce run-time computation, we shuffle the _curTSOServerWorkerEndPoints here
-            // to simulate random pick of workers(load balance) in run time by increment a moded index
-            std::random_device rd;
-            std::mt19937 ranAlg(rd());
-
-            std::shuffle(_curTSOServerWorkerEndPoints.begin(), _curTSOServerWorkerEndPoints.end(), ranAlg);
-
             return seastar::make_ready_future<>();
         })
         .then_wrapped([this](auto&& fut) {
@@ -169,8 +337,15 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
     }
     else
     {
+        // keep track of the request rate, which drives the batch size and the prefetching
+        if (_lastSeenRequestTime != TimePoint{})
+        {
+            double gap = nsec_count(requestLocalTime) - nsec_count(_lastSeenRequestTime);
+            _avgRequestGapNanos = _avgRequestGapNanos == 0 ? gap : _avgRequestGapNanos + (gap - _avgRequestGapNanos) / 8;
+        }
         _lastSeenRequestTime = requestLocalTime;
     }
+    _stats.requests++;
 
     // step 2/4 - if we have timestamp from existing available batch, and they can be issued, directly get that and return
     //          note, need to remove obsolete batch(s) from begining of deque if any
@@ -191,6 +366,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             if (headBatch.ExpirationTime() < requestLocalTime)
             {
                 K2WARN("Detected and discarded existing obsolete batch when issuing TS. headBatch.ExpirationTime() < requestLocalTime.");
+                _stats.expiredBatches++;
                 _timestampBatchQue.pop_front();
                 continue;
             }
@@ -206,6 +382,8 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             {
                 _timestampBatchQue.pop_front();
             }
+            _stats.servedWithoutWait++;
+            _maybePrefetch();
 
             return seastar::make_ready_future<Timestamp>(result);
         }
@@ -220,8 +398,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
     ClientRequest curRequest;
     curRequest._requestTime = requestLocalTime;
     curRequest._promise = seastar::make_lw_shared<seastar::promise<Timestamp>>();
-    // TODO: get config from appBase and use min batch size, default 4
-    uint16_t batchSizeToRequest = 4;
+    uint16_t batchSizeToRequest = _adaptiveBatchSize();
 
     // step 3/4 - there was no ready timestamp to issue. First check if there is already outgoing batch request and we can piggy back
     //        - If not, issue a new batch request and return a promise.
@@ -260,14 +437,14 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             // in this case, we double the size of next batch from last one
             if (pendingRequestCountForBackBatch >= backBatch._expectedBatchSize)
             {
-                // TODO: get config from appBase and use max batch size, default 32
-                batchSizeToRequest = std::min(backBatch._expectedBatchSize * 2, 32);
+                batchSizeToRequest = std::min(backBatch._expectedBatchSize * 2, int(_maxBatchSize()));
             }
         }
 
         if (canPiggyBack)
         {
             curRequest._triggeredBatchRequest = false; // no op, just for readability
+            _stats.waited++;
             _pendingClientRequests.push_back(std::move(curRequest));
             K2DEBUG("Piggy Back on outgoing batch.");
             return _pendingClientRequests.back()._promise->get_future();
@@ -276,29 +453,12 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
 
     // step 4/4 - we are here as _timestampBatchQue.empty() or we can't PiggyBack the last batch request,
     //          issue a new batch request to TSO server and return the future for the request.
-    TimestampBatchInfo newBatchRequest;
-    newBatchRequest._triggeredTime = requestLocalTime;  // same as curRequest._requestTime
-    newBatchRequest._expectedBatchSize = batchSizeToRequest;
-    newBatchRequest._expectedTTL = 8000;    // in nanosecond, TODO: use config value instead.
-    _timestampBatchQue.emplace_back(std::move(newBatchRequest));
-
-    (void) GetTimestampBatch(batchSizeToRequest)
-        .then([this, triggeredTime = requestLocalTime](TimestampBatch&& newBatch) {
-            ProcessReturnedBatch(std::move(newBatch), triggeredTime);
-        }).handle_exception([this] (auto exc) {
-            // Set exception for all pending client requests
-            for (auto&& clientRequest : _pendingClientRequests)
-            {
-                clientRequest._promise->set_exception(exc);
-            }
-            _pendingClientRequests.clear();
-
-            K2ERROR_EXC("GetTimestampBatch failed: ", exc);
-        });
+    _requestBatch(batchSizeToRequest, requestLocalTime, false);  // triggered time same as curRequest._requestTime
 
     K2DEBUG("Request new Batch for this  TS.");
 
     curRequest._triggeredBatchRequest = true;
+    _stats.waited++;
     _pendingClientRequests.push_back(std::move(curRequest));
     return _pendingClientRequests.back()._promise->get_future();
 }
@@ -311,6 +471,13 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         return;
     }
 
+    // the round trip and the TTL tell us whether and when to prefetch the next batch
+    double rtt = nsec_count(Clock::now()) - nsec_count(batchTriggeredTime);
+    _avgBatchRTTNanos = _avgBatchRTTNanos == 0 ? rtt : _avgBatchRTTNanos + (rtt - _avgBatchRTTNanos) / 8;
+    _lastTTLNanos = batch.TTLNanoSec;
+    _stats.batchesReceived++;
+    _stats.timestampsReceived += batch.TSCount;
+
     // step 1/4 - check if the incoming batch is obsolete one, if yes, discard it and do nothing more.
     // We check obsoleteness by meeting one of two conditions
     // a) the batchTriggeredTime < _lastIssuedBatchTriggeredTime, this means the batch coming in late and out of order, we can use it any more.
@@ -329,6 +496,7 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
     {
         //TODO: log more detailed infor
         K2WARN("TimestampBatch comes in late, discarded. hasPendingClientRequest:" << (hasPendingCR ? "TRUE" : "FALSE"));
+        _stats.expiredBatches++;
         return;
     }
 
@@ -346,19 +514,24 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
     {
         K2ASSERT(ite->_usedCount < ite->_batch.TSCount, "we should not have used-up batch still kept around!");
         K2DEBUG("Discard existing obosolete available Front batch.");
+        _stats.expiredBatches++;
 
         _timestampBatchQue.pop_front();
         ite = _timestampBatchQue.begin();
     }
-    // remove case b)
+    // remove case b). A prefetched batch comes back while we still issue from the available batches in front of it,
+    // so skip over those
     ite = _timestampBatchQue.begin();
+    while (ite != _timestampBatchQue.end() && ite->_isAvailable)
+    {
+        ++ite;
+    }
     while (ite != _timestampBatchQue.end() &&
         !ite->_isAvailable &&
         ite->_triggeredTime < batchTriggeredTime)
     {
-        K2DEBUG("Discard existing unavailable older Front batch.");
-        _timestampBatchQue.pop_front();
-        ite = _timestampBatchQue.begin();
+        K2DEBUG("Discard existing unavailable older batch.");
+        ite = _timestampBatchQue.erase(ite);
     }
     // now match it, if we don't find a match, this must be a bug. But we can still use it, so log error and insert it in production and crash in debug.
     K2ASSERT(ite != _timestampBatchQue.end(), "")
@@ -373,7 +546,7 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         batchInfo._triggeredTime = batchTriggeredTime;
         batchInfo._expectedBatchSize = batch.TSCount;
         batchInfo._expectedTTL = batch.TTLNanoSec;
-        _timestampBatchQue.emplace_front(std::move(batchInfo));
+        _timestampBatchQue.insert(ite, std::move(batchInfo));
     }
     else
     {
@@ -431,34 +604,245 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         if (batchSizeToRequest > 0)
         {
 	        K2DEBUG("Need to request more batch due to unfulfilled pending client requests, count:" << batchSizeToRequest);
-            // TODO: get config from appBase and use max batch size, default 32
-            batchSizeToRequest = std::min(batchSizeToRequest, (uint16_t)32);
-
-            TimePoint curTime = Clock::now();
-            TimestampBatchInfo newBatchRequest;
-            newBatchRequest._triggeredTime = curTime;
-            newBatchRequest._expectedBatchSize = batchSizeToRequest;
-            newBatchRequest._expectedTTL = 8000;    // in nanosecond, TODO: use config value instead.
-            newBatchRequest._isTriggeredByReplacement = true;  // this is a replacement
-            _timestampBatchQue.emplace_back(std::move(newBatchRequest));
-
-            (void) GetTimestampBatch(batchSizeToRequest)
-                .then([this, triggeredTime = curTime](TimestampBatch newBatch) {
-                    ProcessReturnedBatch(newBatch, triggeredTime);
-            }).handle_exception([this] (auto exc) {
-                // Set exception for all pending client requests
-                for (auto&& clientRequest : _pendingClientRequests)
-                {
-                    clientRequest._promise->set_exception(exc);
-                }
-                _pendingClientRequests.clear();
+            batchSizeToRequest = std::min(batchSizeToRequest, _maxBatchSize());
 
-                K2ERROR_EXC("GetTimestampBatch failed: ", exc);
-            });
+            _requestBatch(batchSizeToRequest, Clock::now(), true);  // this is a replacement
         }
     }
 }
 
+void TSO_ClientLib::_requestBatch(uint16_t batchSize, TimePoint triggeredTime, bool isReplacement)
+{
+    TimestampBatchInfo newBatchRequest;
+    newBatchRequest._triggeredTime = triggeredTime;
+    newBatchRequest._expectedBatchSize = batchSize;
+    newBatchRequest._expectedTTL = _lastTTLNanos;   // the server decides the TTL. Expect the same as last time
+    newBatchRequest._isTriggeredByReplacement = isReplacement;
+    _timestampBatchQue.emplace_back(std::move(newBatchRequest));
+    _stats.batchRequests++;
+
+    (void) _fetchBatch(batchSize)
+        .then([this, triggeredTime](TimestampBatch&& newBatch) {
+            ProcessReturnedBatch(std::move(newBatch), triggeredTime);
+        }).handle_exception([this] (auto exc) {
+            // Set exception for all pending client requests
+            for (auto&& clientRequest : _pendingClientRequests)
+            {
+                clientRequest._promise->set_exception(exc);
+            }
+            _pendingClientRequests.clear();
+
+            K2ERROR_EXC("GetTimestampBatch failed: ", exc);
+        });
+}
+
+uint16_t TSO_ClientLib::_adaptiveBatchSize() const
+{
+    // the server knows its load and our request rate, so its suggestion comes first
+    if (_serverBatchSizeHint > 0 && _proxyGroupSize() <= 1)
+    {
+        return std::clamp(_serverBatchSizeHint, _minBatchSize(), _maxBatchSize());
+    }
+    // enough timestamps for the requests we expect to see within the TTL of a batch
+    double expected = _avgRequestGapNanos > 0 ? _lastTTLNanos / _avgRequestGapNanos : 0;
+    return uint16_t(std::clamp(std::ceil(expected), double(_minBatchSize()), double(_maxBatchSize())));
+}
+
+void TSO_ClientLib::_maybePrefetch()
+{
+    if (!_enablePrefetch() || _avgRequestGapNanos <= 0 || _avgBatchRTTNanos <= 0)
+    {
+        return;
+    }
+    // a batch which expires before it gets back to us is of no use
+    if (_lastTTLNanos <= _avgBatchRTTNanos)
+    {
+        return;
+    }
+    // only one batch in flight at a time. Outgoing batches are always behind the available ones
+    if (!_timestampBatchQue.empty() && !_timestampBatchQue.back()._isAvailable)
+    {
+        return;
+    }
+
+    auto now = Clock::now();
+    uint32_t remaining = 0;
+    TimePoint expiration = now;
+    for (auto& batchInfo : _timestampBatchQue)
+    {
+        remaining += batchInfo._batch.TSCount - batchInfo._usedCount;
+        expiration = std::max(expiration, batchInfo.ExpirationTime());
+    }
+    // prefetch when we expect to run out of timestamps, or out of time, before a new batch can get here
+    auto rtt = std::chrono::nanoseconds(uint64_t(_avgBatchRTTNanos));
+    if (remaining > _avgBatchRTTNanos / _avgRequestGapNanos && expiration > now + rtt)
+    {
+        return;
+    }
+    K2DEBUG("Prefetching batch with remaining=" << remaining);
+    _stats.prefetches++;
+    _requestBatch(_adaptiveBatchSize(), now, false);
+}
+
+seastar::future<TimestampBatch> TSO_ClientLib::_fetchBatch(uint16_t batchSize)
+{
+    if (_proxyGroupSize() <= 1)
+    {
+        return GetTimestampBatch(batchSize);
+    }
+    auto proxyCore = _proxyCore();
+    if (proxyCore == seastar::engine().cpu_id())
+    {
+        return _getProxySlice(batchSize);
+    }
+    return AppBase().getDist<TSO_ClientLib>().invoke_on(proxyCore, [batchSize] (TSO_ClientLib& proxy)
+    {
+        return proxy._getProxySlice(batchSize);
+    });
+}
+
+unsigned TSO_ClientLib::_proxyCore() const
+{
+    auto core = seastar::engine().cpu_id();
+    return core - core % _proxyGroupSize();
+}
+
+seastar::future<TimestampBatch> TSO_ClientLib::_getProxySlice(uint16_t batchSize)
+{
+    if (_stopped)
+    {
+        return seastar::make_exception_future<TimestampBatch>(TSOClientLibShutdownException());
+    }
+
+    // slices are handed out in the order they are asked for, so nobody can jump ahead of the cores waiting for a batch
+    auto now = Clock::now();
+    if (_proxyWaiters.empty() && _proxyRemaining > 0 && _proxyExpiration > now)
+    {
+        return seastar::make_ready_future<TimestampBatch>(_takeProxySlice(batchSize, now));
+    }
+
+    _proxyWaiters.emplace_back();
+    _proxyWaiters.back().batchSize = batchSize;
+    auto fut = _proxyWaiters.back().promise.get_future();
+    _fetchProxyBatch();
+    return fut;
+}
+
+TimestampBatch TSO_ClientLib::_takeProxySlice(uint16_t batchSize, TimePoint now)
+{
+    K2ASSERT(_proxyRemaining > 0, "can't slice a used up batch");
+    uint8_t count = (uint8_t) std::min<uint16_t>(batchSize, _proxyRemaining);
+
+    // the slice starts where the previous one ended, so the timestamps keep the TBENanoSecStep spacing of the batch
+    TimestampBatch slice = _proxyBatch;
+    uint16_t endingNanoSecAdjust = _proxyUsedCount * _proxyBatch.TBENanoSecStep;
+    slice.TBEBase += endingNanoSecAdjust;
+    slice.TsDelta += endingNanoSecAdjust;
+    slice.TSCount = count;
+    // the slice expires together with the batch. The receiving core counts the TTL from when it asked, which is earlier than now
+    slice.TTLNanoSec = (uint16_t) std::min<int64_t>(nsec(_proxyExpiration - now).count(), std::numeric_limits<uint16_t>::max());
+
+    _proxyUsedCount += count;
+    _proxyRemaining -= count;
+    _stats.proxySlices++;
+    return slice;
+}
+
+void TSO_ClientLib::_fetchProxyBatch()
+{
+    if (_proxyFetching)
+    {
+        return;
+    }
+    _proxyFetching = true;
+    _stats.proxyFetches++;
+
+    // enough for all the cores waiting, and at least tso_proxy_batch_size so that the next slices are ready when asked for
+    uint32_t wanted = 0;
+    for (auto& waiter : _proxyWaiters)
+    {
+        wanted += waiter.batchSize;
+    }
+    uint16_t batchSize = (uint16_t) std::min<uint32_t>(std::max<uint32_t>({wanted, _proxyBatchSize(), _serverBatchSizeHint}), std::numeric_limits<uint8_t>::max());
+    auto triggeredTime = Clock::now();
+
+    (void) GetTimestampBatch(batchSize)
+        .then([this, triggeredTime](TimestampBatch&& batch) {
+            _proxyFetching = false;
+            if (_stopped)
+            {
+                return;
+            }
+            _proxyBatch = std::move(batch);
+            _proxyUsedCount = 0;
+            _proxyRemaining = _proxyBatch.TSCount;
+            // same as the TTL of our own batches, counted from when we asked for it
+            _proxyExpiration = triggeredTime + std::chrono::nanoseconds(_proxyBatch.TTLNanoSec);
+            _serveProxyWaiters();
+        }).handle_exception([this] (auto exc) {
+            _proxyFetching = false;
+            for (auto&& waiter : _proxyWaiters)
+            {
+                waiter.promise.set_exception(exc);
+            }
+            _proxyWaiters.clear();
+
+            K2ERROR_EXC("GetTimestampBatch for the proxy failed: ", exc);
+        });
+}
+
+void TSO_ClientLib::_serveProxyWaiters()
+{
+    auto now = Clock::now();
+    while (!_proxyWaiters.empty() && _proxyRemaining > 0 && _proxyExpiration > now)
+    {
+        _proxyWaiters.front().promise.set_value(_takeProxySlice(_proxyWaiters.front().batchSize, now));
+        _proxyWaiters.pop_front();
+    }
+    if (!_proxyWaiters.empty())
+    {
+        // the batch ran out, or came back too late to be of use
+        _fetchProxyBatch();
+    }
+}
+
+void TSO_ClientLib::_registerMetrics()
+{
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    _metricGroups.add_group("tso_client", {
+        sm::make_counter("requests", _stats.requests, sm::description("Timestamp requests from the application"), labels),
+        sm::make_counter("served_without_wait", _stats.servedWithoutWait, sm::description("Timestamp requests served from a batch we already had"), labels),
+        sm::make_counter("waited", _stats.waited, sm::description("Timestamp requests which had to wait for a batch"), labels),
+        sm::make_gauge("served_without_wait_ratio", [this] { return _stats.requests ? double(_stats.servedWithoutWait) / _stats.requests : 0.0; },
+            sm::description("Fraction of timestamp requests served without waiting for a batch"), labels),
+        sm::make_counter("batch_requests", _stats.batchRequests, sm::description("Batch requests sent to the TSO server"), labels),
+        sm::make_counter("prefetches", _stats.prefetches, sm::description("Batch requests sent ahead of the application requests"), labels),
+        sm::make_counter("batches_received", _stats.batchesReceived, sm::description("Batches received from the TSO server"), labels),
+        sm::make_counter("timestamps_received", _stats.timestampsReceived, sm::description("Timestamps in the batches received, used or not"), labels),
+        sm::make_counter("expired_batches", _stats.expiredBatches, sm::description("Batches dropped since their TTL ran out"), labels),
+        sm::make_gauge("batch_size", [this] { return double(_adaptiveBatchSize()); }, sm::description("The batch size for the current request rate"), labels),
+        sm::make_gauge("avg_request_gap_nanos", [this] { return _avgRequestGapNanos; }, sm::description("Moving average of the time between timestamp requests"), labels),
+        sm::make_gauge("avg_batch_rtt_nanos", [this] { return _avgBatchRTTNanos; }, sm::description("Moving average of the batch round trip to the TSO server"), labels),
+        sm::make_counter("hedges", _stats.hedges, sm::description("Batch requests also sent to a second worker since the first one was slow"), labels),
+        sm::make_counter("hedge_wins", _stats.hedgeWins, sm::description("Hedged batch requests where the second worker answered first"), labels),
+        sm::make_counter("worker_failures", _stats.workerFailures, sm::description("Batch requests which failed or timed out"), labels),
+        sm::make_gauge("hedge_delay_nanos", [this] { return double(_hedgeDelayNanos); }, sm::description("How long we wait for a worker before we hedge the batch request"), labels),
+        sm::make_gauge("available_workers", [this] {
+                auto now = Clock::now();
+                return double(std::count_if(_tsoWorkers.begin(), _tsoWorkers.end(), [now](auto& w) { return w.unavailableUntil <= now; }));
+            }, sm::description("TSO workers which haven't failed recently"), labels),
+        sm::make_counter("proxy_slices", _stats.proxySlices, sm::description("Batch slices handed out to the cores sharing this proxy"), labels),
+        sm::make_counter("proxy_fetches", _stats.proxyFetches, sm::description("Batch requests the proxy sent to the TSO server"), labels),
+        sm::make_gauge("proxy_waiters", [this] { return double(_proxyWaiters.size()); }, sm::description("Slice requests waiting for the proxy to get a batch"), labels),
+        sm::make_counter("recent_timestamp_hits", _stats.recentTimestampHits, sm::description("Recent timestamp requests served from the node wide cache"), labels),
+        sm::make_counter("recent_timestamp_misses", _stats.recentTimestampMisses, sm::description("Recent timestamp requests which went to the TSO since the cache was too stale"), labels),
+        sm::make_gauge("recent_timestamp_age_nanos", [this] {
+                return _recentTimestampTime == TimePoint{} ? 0.0 : double(nsec(Clock::now() - _recentTimestampTime).count());
+            }, sm::description("Time since the cached recent timestamp was requested from the TSO"), labels)
+    });
+}
+
 seastar::future<TimestampBatch> TSO_ClientLib::GetTimestampBatch(uint16_t batchSize)
 {
     auto retryStrategy = k2::ExponentialBackoffStrategy();
@@ -476,34 +860,16 @@ seastar::future<TimestampBatch> TSO_ClientLib::GetTimestampBatch(uint16_t batchS
                 return seastar::make_exception_future<>(TSOClientLibShutdownException());
             }
 
-            K2ASSERT(!_curTSOServerWorkerEndPoints.empty(), "we should have workers");
-            // pick next worker (effecitvely random one, as _curTSOServerWorkerEndPoints is shuffled already when it is populated)
-            int randWorker = (_curWorkerIdx++) %  _curTSOServerWorkerEndPoints.size();
-
-            auto myRemote = _curTSOServerWorkerEndPoints[randWorker];
-            std::unique_ptr<Payload> payload = myRemote.newPayload();
-            payload->write(batchSize);
-
+            K2ASSERT(!_tsoWorkers.empty(), "we should have workers");
             (void) retriesLeft;
-            // K2INFO("Requesting timestampBatch with retriesLeft=" << retriesLeft << ", and timeout=" << k2::usec(timeout).count()
-            //        << "us, with worker " << randWorker);
-
-            return k2::RPC().sendRequest(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, std::move(payload), myRemote, timeout)
-            .then([this, &batch](std::unique_ptr<k2::Payload> replyPayload) mutable {
+            // each attempt goes to the best worker at the time, so a failed worker is skipped by the retry
+            return _sendHedgedBatchRequest(batchSize, timeout)
+            .then([this, &batch](TimestampBatch&& result) mutable {
                 if (_stopped)
                 {
                     K2INFO("Stopping retry since we were stopped");
                     return seastar::make_exception_future<>(TSOClientLibShutdownException());
                 }
-
-                if (!replyPayload || replyPayload->getSize() == 0)
-                {
-                    K2ERROR("TSO worker remote end did not provide a data. Giving up");
-                    return seastar::make_exception_future<>(std::runtime_error("no remote endpoint"));
-                }
-
-                TimestampBatch result;
-                replyPayload->read(result);
                 batch = std::move(result);
                 return seastar::make_ready_future();
             });
@@ -516,4 +882,190 @@ seastar::future<TimestampBatch> TSO_ClientLib::GetTimestampBatch(uint16_t batchS
 
 }
 
+seastar::future<TimestampBatch> TSO_ClientLib::_sendHedgedBatchRequest(uint16_t batchSize, Duration timeout)
+{
+    auto state = seastar::make_lw_shared<HedgedRequest>();
+    size_t first = _pickWorker(_NO_WORKER);
+    _sendBatchRequest(state, first, batchSize, timeout);
+
+    // if the first worker is slower than usual, ask another worker as well and take whichever answers first
+    auto hedgeDelay = std::chrono::nanoseconds(_hedgeDelayNanos);
+    if (_hedgeDelayNanos > 0 && _tsoWorkers.size() > 1 && !_batchRequestGate.is_closed())
+    {
+        (void) seastar::with_gate(_batchRequestGate, [this, state, first, batchSize, timeout, hedgeDelay]
+        {
+            return seastar::sleep(hedgeDelay)
+                .then([this, state, first, batchSize, timeout] () mutable
+                {
+                    if (state->done || _stopped)
+                    {
+                        return;
+                    }
+                    size_t second = _pickWorker(first);
+                    if (second == _NO_WORKER)
+                    {
+                        return;
+                    }
+                    K2DEBUG("Hedging batch request from worker " << first << " to worker " << second);
+                    _stats.hedges++;
+                    state->hedged = true;
+                    _sendBatchRequest(state, second, batchSize, timeout);
+                });
+        });
+    }
+    return state->promise.get_future();
+}
+
+void TSO_ClientLib::_sendBatchRequest(seastar::lw_shared_ptr<HedgedRequest> state, size_t workerIdx, uint16_t batchSize, Duration timeout)
+{
+    if (_batchRequestGate.is_closed())
+    {
+        if (!state->done && state->outstanding == 0)
+        {
+            state->done = true;
+            state->promise.set_exception(TSOClientLibShutdownException());
+        }
+        return;
+    }
+    auto myRemote = _tsoWorkers[workerIdx].endpoint;
+    std::unique_ptr<Payload> payload = myRemote.newPayload();
+    payload->write(batchSize);
+    payload->write(_clientID);
+    state->outstanding++;
+    bool isHedge = state->hedged;
+    auto start = Clock::now();
+
+    _batchRequestGate.enter();
+    (void) k2::RPC().sendRequest(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, std::move(payload), myRemote, timeout)
+    .then_wrapped([this, state, workerIdx, isHedge, start](auto&& fut) mutable {
+        // the request is over whether it succeeded or failed. When the last one fails, the batch request fails
+        state->outstanding--;
+        try
+        {
+            std::unique_ptr<k2::Payload> replyPayload = fut.get0();
+            if (!replyPayload || replyPayload->getSize() == 0)
+            {
+                // the worker couldn't issue a batch, e.g. it isn't ready yet
+                K2WARN("TSO worker " << _tsoWorkers[workerIdx].endpoint.getURL() << " did not provide a timestamp batch");
+                throw std::runtime_error("no timestamp batch from TSO worker");
+            }
+            TimestampBatch result;
+            replyPayload->read(result);
+            // newer servers follow the batch with the batch size they suggest for our next request
+            uint16_t batchSizeHint = 0;
+            if (replyPayload->getDataRemaining() >= sizeof(batchSizeHint) && replyPayload->read(batchSizeHint))
+            {
+                _serverBatchSizeHint = batchSizeHint;
+            }
+            _recordWorkerLatency(workerIdx, Clock::now() - start);
+            if (!state->done)
+            {
+                state->done = true;
+                if (isHedge)
+                {
+                    _stats.hedgeWins++;
+                }
+                state->promise.set_value(std::move(result));
+            }
+        }
+        catch (...)
+        {
+            _recordWorkerFailure(workerIdx);
+            // the other request, if any, may still succeed
+            if (!state->done && state->outstanding == 0)
+            {
+                state->done = true;
+                state->promise.set_exception(std::current_exception());
+            }
+        }
+    })
+    .finally([this] {
+        _batchRequestGate.leave();
+    });
+}
+
+size_t TSO_ClientLib::_pickWorker(size_t exclude)
+{
+    auto now = Clock::now();
+    size_t count = _tsoWorkers.size();
+    // every so often go round robin, so that we keep learning the latency of all workers
+    bool explore = (++_workerPicks % _EXPLORE_INTERVAL) == 0;
+    size_t best = _NO_WORKER;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t idx = explore ? (_curWorkerIdx + i) % count : i;
+        if (idx == exclude || _tsoWorkers[idx].unavailableUntil > now)
+        {
+            continue;
+        }
+        if (explore)
+        {
+            _curWorkerIdx = idx + 1;
+            return idx;
+        }
+        // workers we have no samples for yet have 0 latency, so we try them first
+        if (best == _NO_WORKER || _tsoWorkers[idx].avgLatencyNanos < _tsoWorkers[best].avgLatencyNanos)
+        {
+            best = idx;
+        }
+    }
+    if (best != _NO_WORKER)
+    {
+        return best;
+    }
+    // every worker has failed recently. Keep trying them in turn rather than give up
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t idx = (_curWorkerIdx++) % count;
+        if (idx != exclude)
+        {
+            return idx;
+        }
+    }
+    return _NO_WORKER;
+}
+
+void TSO_ClientLib::_recordWorkerLatency(size_t workerIdx, Duration latency)
+{
+    auto& worker = _tsoWorkers[workerIdx];
+    double nanos = nsec(latency).count();
+    worker.avgLatencyNanos = worker.avgLatencyNanos == 0 ? nanos : worker.avgLatencyNanos + (nanos - worker.avgLatencyNanos) / 8;
+    worker.consecutiveFailures = 0;
+    worker.unavailableUntil = TimePoint{};
+
+    if (_hedgePercentile() == 0)
+    {
+        return;
+    }
+    // the hedge delay is the configured percentile of the recent batch latencies over all workers
+    if (_recentLatencies.size() < _LATENCY_SAMPLES)
+    {
+        _recentLatencies.push_back(uint64_t(nanos));
+    }
+    else
+    {
+        _recentLatencies[_latencySampleIdx % _LATENCY_SAMPLES] = uint64_t(nanos);
+    }
+    _latencySampleIdx++;
+    if (_latencySampleIdx % _HEDGE_DELAY_UPDATE_INTERVAL == 0 && _recentLatencies.size() >= _HEDGE_DELAY_UPDATE_INTERVAL)
+    {
+        std::vector<uint64_t> samples(_recentLatencies);
+        size_t nth = std::min(samples.size() - 1, samples.size() * _hedgePercentile() / 100);
+        std::nth_element(samples.begin(), samples.begin() + nth, samples.end());
+        _hedgeDelayNanos = samples[nth];
+    }
+}
+
+void TSO_ClientLib::_recordWorkerFailure(size_t workerIdx)
+{
+    auto& worker = _tsoWorkers[workerIdx];
+    _stats.workerFailures++;
+    // leave the worker alone for a while, doubling the wait with every failure in a row
+    auto backoff = _workerBackoff() * (1 << std::min(worker.consecutiveFailures, 5u));
+    worker.consecutiveFailures++;
+    worker.unavailableUntil = Clock::now() + backoff;
+    K2WARN("TSO worker " << worker.endpoint.getURL() << " failed " << worker.consecutiveFailures
+           << " times in a row. Avoiding it for " << k2::msec(backoff).count() << "ms");
+}
+
 }
@@ -24,11 +24,15 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 #include <chrono>
 #include <climits>
+#include <limits>
+#include <random>
+#include <set>
 #include <tuple>
 
 // third-party
 #include <seastar/core/distributed.hh>  // for distributed<>
 #include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/gate.hh>         // for gate
 
 #include <k2/appbase/Appbase.h>
 #include <k2/common/Chrono.h>
@@ -56,12 +60,45 @@ public:
 
     // get the timestamp from TSO (distributed from TSOClient Timestamp batch)
     seastar::future<Timestamp> GetTimestampFromTSO(const TimePoint& requestLocalTime);
-    // get the timestamp with MTL(Minimum Transaction Latency) - alternatively instead of this new API, consider put MTL inside timestamp.
-    // seastar::future<std::tuple<Timestamp, Duration>> GetTimeStampWithMTLFromTSO(const TimePoint& requestLocalTime);
+    // get the timestamp with MTL(Minimum Transaction Latency), the uncertainty window of the batch the timestamp came from.
+    // A transaction committed at the timestamp can be acknowledged once the MTL has passed since the timestamp was returned
+    seastar::future<std::tuple<Timestamp, Duration>> GetTimeStampWithMTLFromTSO(const TimePoint& requestLocalTime);
+
+    // A recent timestamp from the node wide cache, if it was requested from the TSO no longer than maxStaleness ago.
+    // Otherwise a new timestamp from the TSO, which then goes into this core's cache.
+    // The result is a lower bound of the current TSO time, for uses like retention and GC watermarks and stale reads.
+    seastar::future<Timestamp> GetRecentTimestamp(Duration maxStaleness);
+
+    // While there are subscribers on any core, core 0 gets a timestamp from the TSO every half of the smallest
+    // maxStaleness the subscribers tolerate, and hands it to the cache of every core, so that GetRecentTimestamp()
+    // with that maxStaleness doesn't need to go to the TSO. Unsubscribe with the same maxStaleness
+    seastar::future<> SubscribeRecentTimestamp(Duration maxStaleness);
+    seastar::future<> UnsubscribeRecentTimestamp(Duration maxStaleness);
+
+    // counters since start, also reported as metrics
+    struct Stats
+    {
+        uint64_t requests{0};
+        uint64_t servedWithoutWait{0};
+        uint64_t waited{0};
+        uint64_t batchRequests{0};
+        uint64_t prefetches{0};
+        uint64_t hedges{0};
+        uint64_t hedgeWins{0};
+        uint64_t workerFailures{0};
+        uint64_t proxySlices{0};
+        uint64_t proxyFetches{0};
+        uint64_t batchesReceived{0};
+        uint64_t timestampsReceived{0};     // in the batches received, used or not
+        uint64_t expiredBatches{0};         // batches dropped since their TTL ran out, on arrival or before all were used
+        uint64_t recentTimestampHits{0};    // GetRecentTimestamp() calls served from the cache
+        uint64_t recentTimestampMisses{0};  // GetRecentTimestamp() calls which went to the TSO
+    };
+    const Stats& getStats() const { return _stats; }
 
 private:
 
-    // discover TSO server worker cores, populating _curTSOServerWorkerEndPoints, during start() and server change.
+    // discover TSO server worker cores, adding them to _tsoWorkers, during start() and server change.
     seastar::future<> DiscoverServerWorkerEndPoints(const k2::String& serverURL);
 
     seastar::future<TimestampBatch> GetTimestampBatch(uint16_t batchSize);
@@ -69,18 +106,133 @@ private:
     // process returned batch from TSO server
     void ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTriggeredTime);
 
+    // send a batch request to the TSO server, with its placeholder at the back of _timestampBatchQue
+    void _requestBatch(uint16_t batchSize, TimePoint triggeredTime, bool isReplacement);
+
+    // the batch size for the observed request rate, within [tso_min_batch_size, tso_max_batch_size]
+    uint16_t _adaptiveBatchSize() const;
+
+    // request the next batch ahead of time if the timestamps we have won't last until a new batch could get here
+    void _maybePrefetch();
+
+    void _registerMetrics();
+
+    // a batch from the TSO server, or a slice of one from the proxy core when tso_proxy_group_size is set
+    seastar::future<TimestampBatch> _fetchBatch(uint16_t batchSize);
+
+    // the first core of the group of tso_proxy_group_size cores this core is in. It fetches the batches for the group
+    unsigned _proxyCore() const;
+
+    // on the proxy core: up to batchSize timestamps out of the current batch, fetching a new batch if needed
+    seastar::future<TimestampBatch> _getProxySlice(uint16_t batchSize);
+    TimestampBatch _takeProxySlice(uint16_t batchSize, TimePoint now);
+    void _fetchProxyBatch();
+    void _serveProxyWaiters();
+
+    // a batch request which may have been sent to more than one worker. The first reply wins
+    struct HedgedRequest
+    {
+        seastar::promise<TimestampBatch> promise;
+        bool done{false};
+        bool hedged{false};
+        int outstanding{0};
+    };
+
+    // send the batch request to the best worker, and to a second worker as well if the first one is slow to answer
+    seastar::future<TimestampBatch> _sendHedgedBatchRequest(uint16_t batchSize, Duration timeout);
+
+    void _sendBatchRequest(seastar::lw_shared_ptr<HedgedRequest> state, size_t workerIdx, uint16_t batchSize, Duration timeout);
+
+    // the worker with the lowest latency which hasn't failed recently, other than exclude
+    size_t _pickWorker(size_t exclude);
+
+    void _recordWorkerLatency(size_t workerIdx, Duration latency);
+    void _recordWorkerFailure(size_t workerIdx);
+
+    // on core 0: get a timestamp from the TSO and give it to all cores, then re-arm the refresh timer
+    void _refreshRecentTimestamp();
+    // on core 0: how often the recent timestamp is refreshed for the current subscribers
+    Duration _recentTimestampRefreshInterval() const;
+    // keep the timestamp if it was requested later than the one we have
+    void _updateRecentTimestamp(const Timestamp& ts, TimePoint requestTime);
+
     ConfigVar<k2::String> TSOServerURL{"tso_endpoint"};
+    // more TSO servers to use together with the one in tso_endpoint
+    ConfigVar<std::vector<k2::String>> _moreTSOServerURLs{"tso_endpoints"};
+
+    // hedge a batch request once it takes longer than this percentile of the recent batch latencies. 0 disables hedging
+    ConfigVar<uint32_t> _hedgePercentile{"tso_hedge_percentile", 95};
+    // how long a failed worker is avoided, doubled with each failure in a row
+    ConfigDuration _workerBackoff{"tso_worker_backoff", 100ms};
+
+    // share the batches between groups of this many cores, through the first core of each group. 0 or 1 disables it
+    ConfigVar<uint32_t> _proxyGroupSize{"tso_proxy_group_size", 0};
+    // the smallest batch the proxy asks for
+    ConfigVar<uint16_t> _proxyBatchSize{"tso_proxy_batch_size", 64};
+
+    // talk to the TSO workers over UDP when they offer it. Timestamp batch requests are small and idempotent
+    ConfigVar<bool> _preferUDP{"tso_prefer_udp", false};
+
+    ConfigVar<uint16_t> _minBatchSize{"tso_min_batch_size", 4};
+    ConfigVar<uint16_t> _maxBatchSize{"tso_max_batch_size", 32};
+    ConfigVar<bool> _enablePrefetch{"tso_enable_prefetch", true};
+
+    // the node wide recent timestamp, as a copy on each core, and the local time when it was requested from the TSO
+    Timestamp _recentTimestamp;
+    TimePoint _recentTimestampTime{};
+    // on core 0 only: the maxStaleness of each subscriber from all cores, and the refresh in progress
+    std::multiset<Duration> _recentTimestampSubscribers;
+    bool _recentTimestampRefreshing{false};
+    seastar::timer<> _recentTimestampTimer{[this] { _refreshRecentTimestamp(); }};
+    seastar::future<> _recentTimestampRefresh = seastar::make_ready_future();
+
+    // moving averages of the time between client requests and of the batch round trip, in nanoseconds
+    double _avgRequestGapNanos{0};
+    double _avgBatchRTTNanos{0};
+
+    // the TTL of the last batch from the server, in nanoseconds. Used as the expected TTL of outgoing batches
+    uint16_t _lastTTLNanos{8000};
+
+    // the batch size the TSO server suggested with the last batch, 0 if it didn't
+    uint16_t _serverBatchSizeHint{0};
+
+    // sent with our batch requests so that the TSO workers see all of them as one client, whichever connection
+    // or port they come from
+    uint64_t _clientID{(uint64_t(std::random_device()()) << 32) | std::random_device()()};
+
+    Stats _stats;
+    sm::metric_groups _metricGroups;
 
     bool _stopped{false};
+    // the batch requests to the TSO workers and the hedge delays, which gracefulStop() waits for
+    seastar::gate _batchRequestGate;
 
     // a vector of TSO servers
-    // TODO: currently just use one, we will use multiple later, with more info like location(local or remote), availability status etc. Also get them from CPO instead.
-    //       the CPO should give the list of TSO servers in preference order in the vector.
+    // TODO: get them from CPO instead, with more info like location(local or remote)
     std::vector<k2::String> _tSOServerURLs;
 
-    // all URLs of workers of current TSO server
-    std::vector<k2::TXEndpoint> _curTSOServerWorkerEndPoints;
+    struct WorkerInfo
+    {
+        k2::TXEndpoint endpoint;
+        double avgLatencyNanos{0};          // moving average of the batch latency from this worker
+        uint32_t consecutiveFailures{0};
+        TimePoint unavailableUntil{};       // don't use the worker before this time, since it failed
+    };
+
+    // the workers of all TSO servers
+    std::vector<WorkerInfo> _tsoWorkers;
     size_t _curWorkerIdx{0};
+    uint64_t _workerPicks{0};
+    static constexpr size_t _NO_WORKER = std::numeric_limits<size_t>::max();
+    // every this many picks we go round robin instead of picking the fastest worker
+    static constexpr uint64_t _EXPLORE_INTERVAL = 16;
+
+    // recent batch latencies from all workers, used to find the hedge delay
+    std::vector<uint64_t> _recentLatencies;
+    uint64_t _latencySampleIdx{0};
+    uint64_t _hedgeDelayNanos{0};
+    static constexpr size_t _LATENCY_SAMPLES = 256;
+    static constexpr size_t _HEDGE_DELAY_UPDATE_INTERVAL = 32;
 
     // For debugging and verification purpose, as we are processing request with steady clock, use this to verify
     // the requet we see are always coming in with bigger value steady clock.
@@ -166,6 +318,19 @@ private:
 
     std::deque<ClientRequest>  _pendingClientRequests;
     std::deque<TimestampBatchInfo> _timestampBatchQue;
+
+    // proxy core only: the batch we slice up for the group, and the slice requests waiting for the next batch
+    struct ProxyWaiter
+    {
+        uint16_t batchSize{0};
+        seastar::promise<TimestampBatch> promise;
+    };
+    TimestampBatch _proxyBatch;
+    uint8_t _proxyUsedCount{0};
+    uint8_t _proxyRemaining{0};
+    TimePoint _proxyExpiration{};
+    bool _proxyFetching{false};
+    std::deque<ProxyWaiter> _proxyWaiters;
 };
 
 class TimeStampRequestOutOfOrderException : public std::exception {
@@ -22,6 +22,7 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include <algorithm>    // std::min/max
+#include <cmath>
 #include <tuple>
 
 #include <boost/range/irange.hpp>
@@ -51,6 +52,7 @@ seastar::future<> TSOService::TSOController::start()
             _heartBeatTimer.arm(_heartBeatTimerInterval());
             _timeSyncTimer.arm(_timeSyncTimerInterval());
             _statsUpdateTimer.arm(_statsUpdateTimerInterval());
+            RegisterMetrics();
 
             // register RPC APIs
             RegisterGetTSOMasterURL();
@@ -72,6 +74,7 @@ seastar::future<> TSOService::TSOController::gracefulStop() {
             _heartBeatTimer.cancel();
             _timeSyncTimer.cancel();
             _statsUpdateTimer.cancel();
+            _metricGroups.clear();
 
             // unregistar all APIs
             RPC().registerMessageObserver(dto::Verbs::GET_TSO_MASTERSERVER_URL, nullptr);
@@ -105,6 +108,8 @@ void TSOService::TSOController::InitWorkerControlInfo()
     _controlInfoToSend.TBENanoSecStep =     seastar::smp::count - 1;            
     _controlInfoToSend.TsDelta =            _defaultTBWindowSize().count();
     _controlInfoToSend.BatchTTL =           _defaultTBWindowSize().count();
+
+    _workerStats.resize(seastar::smp::count - 1);
 }
 
 seastar::future<> TSOService::TSOController::GetAllWorkerURLs()
@@ -479,7 +484,7 @@ void TSOService::TSOController::CollectAndReportStats()
     {
         if (!_stopRequested)
         {
-            _statsUpdateTimer.arm(_timeSyncTimerInterval());
+            _statsUpdateTimer.arm(_statsUpdateTimerInterval());
         }
     });
 
@@ -488,7 +493,75 @@ void TSOService::TSOController::CollectAndReportStats()
 
 seastar::future<> TSOService::TSOController::DoCollectAndReportStats()
 {
-    return seastar::make_ready_future<>();
+    if (_stopRequested)
+        return seastar::make_ready_future<>();
+
+    return seastar::parallel_for_each(boost::irange(1u, seastar::smp::count),   // all worker cores, starting from 1
+        [this] (unsigned cpuId) {
+            return AppBase().getDist<k2::TSOService>().invoke_on(cpuId, &TSOService::CollectWorkerStatistics)
+            .then([this, cpuId] (TSOWorkerStatistics stats) {
+                _workerStats[cpuId - 1] = stats;
+            });
+        })
+        .then([this] () mutable {
+            double maxBatchRate = 0;
+            for (uint32_t i = 0; i < _workerStats.size(); i++)
+            {
+                auto& stats = _workerStats[i];
+                K2DEBUG("Worker " << i + 1 << " issued " << stats.TimestampCount << " timestamps in " << stats.BatchCount
+                    << " batches for " << stats.ClientCount << " clients, utilization " << stats.Utilization()
+                    << ", parked requests " << stats.ParkedCount << "(" << stats.ParkedNanoSec << "ns)");
+                maxBatchRate = std::max(maxBatchRate, stats.BatchRate());
+            }
+
+            // when the busiest worker gets more requests than we want, the workers suggest proportionally larger batches to the clients.
+            // Only go back down once it is well under the target, so that we don't flip back and forth
+            uint8_t multiplier = _controlInfoToSend.BatchSizeMultiplier;
+            double wanted = multiplier * maxBatchRate / _targetWorkerBatchRate();
+            if (wanted > multiplier)
+            {
+                multiplier = (uint8_t) std::min(std::ceil(wanted), 16.0);
+            }
+            else if (wanted < multiplier / 2.0)
+            {
+                multiplier = (uint8_t) std::max(std::ceil(wanted), 1.0);
+            }
+            if (multiplier != _controlInfoToSend.BatchSizeMultiplier)
+            {
+                K2INFO("Batch size multiplier changes from " << (int) _controlInfoToSend.BatchSizeMultiplier << " to " << (int) multiplier
+                    << ", busiest worker at " << maxBatchRate << " batches/s");
+                // goes to the workers with the next heartbeat
+                _controlInfoToSend.BatchSizeMultiplier = multiplier;
+            }
+        });
+}
+
+void TSOService::TSOController::RegisterMetrics()
+{
+    _metricGroups.clear();
+    for (uint32_t i = 0; i < _workerStats.size(); i++)
+    {
+        std::vector<sm::label_instance> labels;
+        labels.push_back(sm::label_instance("worker", i + 1));
+        _metricGroups.add_group("tso", {
+            sm::make_gauge("worker_timestamp_rate", [this, i] { return _workerStats[i].TimestampRate(); },
+                sm::description("Timestamps per second the worker issued, over the last stats interval"), labels),
+            sm::make_gauge("worker_batch_rate", [this, i] { return _workerStats[i].BatchRate(); },
+                sm::description("Timestamp batches per second the worker issued, over the last stats interval"), labels),
+            sm::make_gauge("worker_utilization", [this, i] { return _workerStats[i].Utilization(); },
+                sm::description("Fraction of the timestamps the worker could issue that it did, over the last stats interval"), labels),
+            sm::make_gauge("worker_clients", [this, i] { return double(_workerStats[i].ClientCount); },
+                sm::description("Clients the worker tracks for its batch size suggestions"), labels),
+            sm::make_gauge("worker_parked_requests", [this, i] { return double(_workerStats[i].ParkedCount); },
+                sm::description("Requests which waited for the worker to be able to issue timestamps, over the last stats interval"), labels),
+            sm::make_gauge("worker_parked_nanos", [this, i] { return double(_workerStats[i].ParkedNanoSec); },
+                sm::description("Total time requests waited, over the last stats interval"), labels)
+        });
+    }
+    _metricGroups.add_group("tso", {
+        sm::make_gauge("batch_size_multiplier", [this] { return double(_lastSentControlInfo.BatchSizeMultiplier); },
+            sm::description("How many times the timestamps they need the workers suggest clients ask for"), std::vector<sm::label_instance>{})
+    });
 }
 
 }
@@ -92,6 +92,13 @@ void TSOService::UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo
     return _worker->UpdateWorkerControlInfo(controlInfo);
 }
 
+TSOService::TSOWorkerStatistics TSOService::CollectWorkerStatistics()
+{
+    K2ASSERT(seastar::engine().cpu_id() != 0 && _worker != nullptr, "CollectWorkerStatistics should be on worker core only!");
+
+    return _worker->CollectStatistics();
+}
+
 std::vector<k2::String> TSOService::GetWorkerURLs()
 {
     // NOTE: this fn is called by controller during start() on worker after the transport is initialized
@@ -110,6 +117,15 @@ std::vector<k2::String> TSOService::GetWorkerURLs()
         result.push_back(k2::RPC().getServerEndpoint(k2::RRDMARPCProtocol::proto)->getURL());
     }
 
+    ConfigVar<bool> enableUDP{"enable_udp_rpc"};
+    if (enableUDP()) {
+        auto udpEndpoint = k2::RPC().getServerEndpoint(k2::UDPRPCProtocol::proto);
+        if (udpEndpoint) {
+            K2INFO("TSOWorker have UDP transport.");
+            result.push_back(udpEndpoint->getURL());
+        }
+    }
+
     return result;
 }
 
@@ -24,11 +24,14 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 #include <chrono>
 #include <climits>
+#include <deque>
 #include <tuple>
+#include <unordered_map>
 
 // third-party
 #include <seastar/core/distributed.hh>  // for distributed<>
 #include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/gate.hh>         // for gate
 
 #include <k2/appbase/Appbase.h>
 #include <k2/common/Chrono.h>
@@ -64,11 +67,29 @@ public: // types
         uint16_t    TsDelta;                // batch starting time adjustment from TbeTSEAdjustment, basically the uncertainty window size, in nanoSec
         uint64_t    ReservedTimeShreshold;  // reservedTimeShreshold upper bound, the generated batch and TS in it can't be bigger than that, in nanoSec counts
         uint16_t    BatchTTL;               // TTL of batch issued in nanoseconds, not expected to change once set
+        uint8_t     BatchSizeMultiplier;    // under load, workers suggest clients ask for this many times the timestamps they need, so that they send fewer requests
 
-        TSOWorkerControlInfo() : IsReadyToIssueTS(false), TBENanoSecStep(0), TBEAdjustment(0), TsDelta(0), ReservedTimeShreshold(0), BatchTTL(0) {};
+        TSOWorkerControlInfo() : IsReadyToIssueTS(false), TBENanoSecStep(0), TBEAdjustment(0), TsDelta(0), ReservedTimeShreshold(0), BatchTTL(0), BatchSizeMultiplier(1) {};
     };
 
-    // TODO: worker/controller statistics structure typedef
+    // statistics of a worker since the controller last collected them
+    struct TSOWorkerStatistics
+    {
+        uint64_t    BatchCount{0};          // timestamp batches issued
+        uint64_t    TimestampCount{0};      // timestamps issued in these batches
+        uint64_t    ClientCount{0};         // clients the worker currently tracks for its batch size suggestions
+        uint64_t    DurationNanoSec{0};     // time these statistics cover
+        uint64_t    ParkedCount{0};         // requests which had to wait, e.g. for the next microsecond once this one ran out of timestamps
+        uint64_t    ParkedNanoSec{0};       // total time the requests served or failed in this period waited
+        uint16_t    TimestampsPerMicroSec{0};   // most timestamps the worker can issue in a microsecond
+
+        // timestamps issued per second
+        double TimestampRate() const { return DurationNanoSec ? TimestampCount * 1e9 / DurationNanoSec : 0; }
+        // batches issued per second
+        double BatchRate() const { return DurationNanoSec ? BatchCount * 1e9 / DurationNanoSec : 0; }
+        // fraction of the timestamps the worker could have issued in this time
+        double Utilization() const { return DurationNanoSec && TimestampsPerMicroSec ? TimestampCount * 1000.0 / DurationNanoSec / TimestampsPerMicroSec : 0; }
+    };
 
 public :  // application lifespan
     TSOService();
@@ -85,6 +106,9 @@ public :  // application lifespan
     // worker API updating the controlInfo, triggered from controller through SS cross-core communication
     void UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo);
 
+    // worker API returning the statistics since the last call, triggered from controller through SS cross-core communication
+    TSOWorkerStatistics CollectWorkerStatistics();
+
     // get worker endpoint URLs of all transport stack, TCP/IP, RDMA, etc.
     std::vector<k2::String> GetWorkerURLs();
 
@@ -233,6 +257,8 @@ class TSOService::TSOController
     void CollectAndReportStats();
     seastar::future<> DoCollectAndReportStats();
 
+    // per worker issuance rate and utilization from the last collected statistics
+    void RegisterMetrics();
 
     // suicide when and only when we are master and find we lost lease
     void Suicide();
@@ -313,6 +339,13 @@ class TSOService::TSOController
     ConfigDuration _statsUpdateTimerInterval{"tso.ctrol_stats_update_interval", 1s};
     seastar::future<> _statsUpdateFuture = seastar::make_ready_future<>();  // need to keep track of statsUpdate task future for proper shutdown
 
+    // batch requests per second we want a worker to handle at most. Above that, clients are asked for larger batches
+    ConfigVar<uint64_t> _targetWorkerBatchRate{"tso.ctrol_target_worker_batch_rate", 200000};
+
+    // last collected statistics, of worker core i+1 at index i
+    std::vector<TSOWorkerStatistics> _workerStats;
+    sm::metric_groups _metricGroups;
+
 };
 
 // TSOWorker - worker cores of TSO service that take TSO client requests and issue Timestamp (batch).
@@ -323,7 +356,9 @@ class TSOService::TSOController
 class TSOService::TSOWorker
 {
     public:
-    TSOWorker(TSOService& outer) : _outer(outer){};
+    TSOWorker(TSOService& outer) :
+        _outer(outer),
+        _parkedTimer([this]{this->ServeParkedRequests();}){};
 
     seastar::future<> gracefulStop();
     seastar::future<> start();
@@ -333,8 +368,8 @@ class TSOService::TSOWorker
     // get updated controlInfo from controller and update local copy
     void UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo);
 
-    // periodical task to send statistics to controller core
-    seastar::future<> SendWorkderStatistics() {return seastar::make_ready_future<>();};
+    // statistics since the last call, for the controller to collect
+    TSOWorkerStatistics CollectStatistics();
 
     private:
     // outer TSOService object
@@ -350,16 +385,61 @@ class TSOService::TSOWorker
     // Note: each worker core can issue up to (1000/TBENanoSecStep) timestamps within same microsecond (at TBE)
     uint16_t _lastRequestTimeStampCount{0};
 
-    // TODO: statistics structure
+    TSOWorkerStatistics _stats;
+    uint64_t _statsStartNanoSec{0};
+
+    // what we know about the request rate of a client
+    struct ClientInfo
+    {
+        uint64_t LastRequestNanoSec{0};
+        double AvgGapNanoSec{0};    // moving average of the time between batch requests
+        double AvgBatchSize{0};     // moving average of the batch size requested
+    };
+    // clients by the ID they send with their requests. Cleared when it grows past _maxTrackedClients
+    std::unordered_map<uint64_t, ClientInfo> _clients;
+    ConfigVar<size_t> _maxTrackedClients{"tso.worker_max_tracked_clients", 10000};
+
+    // the batch size we suggest the client asks for next, from its request rate, the batch TTL and the controller's BatchSizeMultiplier
+    uint16_t SuggestBatchSize(uint64_t clientID, uint16_t batchSizeRequested);
 
     // APIs to TSO clients
     void RegisterGetTSOTimestampBatch();
 
+    // issue a batch for the given request and send it back, or park the request if we can't issue now
+    void HandleTimestampBatchRequest(k2::Request&& request, uint16_t batchSize, uint64_t clientID);
+    void ReplyTimestampBatch(k2::Request& request, uint16_t batchSize, uint64_t clientID, const TimestampBatch& timestampBatch);
+    // empty reply for a request we failed to issue a batch for, so that the client can go to another worker right away
+    void ReplyNoTimestampBatch(k2::Request& request, const std::exception& exc);
+
+    // requests which came in when we couldn't issue timestamps, served in order from _parkedTimer
+    // instead of spinning on the clock, so that the core keeps serving everything else
+    struct ParkedRequest
+    {
+        k2::Request request;
+        uint16_t batchSize;
+        uint64_t clientID;
+        uint64_t parkedNanoSec;
+    };
+    std::deque<ParkedRequest> _parkedRequests;
+    seastar::timer<> _parkedTimer;
+    void ServeParkedRequests();
+
+    // local steady clock time in nanosec, when we can try to issue again after GetTimestampFromTSO() returned false
+    uint64_t _nextIssueNanoSec{0};
+    // local steady clock time in nanosec, before which we don't issue due to a control info change
+    uint64_t _pausedUntilNanoSec{0};
+
+    // testing only: delay every batch reply by this much, to simulate a slow server
+    ConfigDuration _injectedDelay{"tso_inject_delay", 0us};
+    // the delayed requests, which gracefulStop() waits for
+    seastar::gate _injectedDelayGate;
+
     // the main API for TSO client to get timestamp in batch
     // batchSizeRequested may be partically fulfilled based on server side timestamp availability
-    TimestampBatch GetTimestampFromTSO(uint16_t batchSizeRequested);
+    // returns false if no timestamp can be issued until _nextIssueNanoSec
+    bool GetTimestampFromTSO(uint16_t batchSizeRequested, TimestampBatch& result);
     // helper function to issue timestamp (or check error situation)
-    TimestampBatch GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t nowMicroSecRounded);
+    bool GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t nowMicroSecRounded, uint64_t nowNanoSec, TimestampBatch& result);
 
     // private helper
     // helpers for updateWorkerControlInfo
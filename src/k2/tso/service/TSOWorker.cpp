@@ -22,6 +22,8 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include <algorithm>    // std::min
+#include <cmath>
+#include <limits>
 #include "seastar/core/sleep.hh"
 
 #include <k2/common/Log.h>
@@ -38,6 +40,7 @@ namespace k2
 seastar::future<> TSOService::TSOWorker::start()
 {
     _tsoId = _outer.TSOId();
+    _statsStartNanoSec = now_nsec_count();
 
     RegisterGetTSOTimestampBatch();
     return seastar::make_ready_future<>();
@@ -47,7 +50,10 @@ seastar::future<> TSOService::TSOWorker::gracefulStop()
 {
     // unregistar all APIs
     RPC().registerMessageObserver(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, nullptr);
-    return seastar::make_ready_future<>();
+    // the clients retry the requests we drop here with another worker
+    _parkedTimer.cancel();
+    _parkedRequests.clear();
+    return _injectedDelayGate.close();
 }
 
 void TSOService::TSOWorker::RegisterGetTSOTimestampBatch()
@@ -58,13 +64,40 @@ void TSOService::TSOWorker::RegisterGetTSOTimestampBatch()
         {
             uint16_t batchSize;
             request.payload->read((void*)&batchSize, sizeof(batchSize));
+            uint64_t clientID;
+            if (request.payload->getDataRemaining() >= sizeof(clientID))
+            {
+                request.payload->read((void*)&clientID, sizeof(clientID));
+            }
+            else
+            {
+                // older clients don't send an ID. Tell them apart by endpoint, which splits a client with several
+                // connections(or UDP ports) in several, each with a share of its rate. Their hints come out low
+                clientID = std::hash<k2::String>()(request.endpoint.getURL());
+            }
 
-            // TODO: handle exceptions
-            auto response = request.endpoint.newPayload();
-            auto timestampBatch = GetTimestampFromTSO(batchSize);
-            //K2INFO("time stamp batch returned is: " << timestampBatch);
-            response->write(timestampBatch);
-            k2::RPC().sendReply(std::move(response), request);
+            if (_injectedDelay() > 0s)
+            {
+                // testing only: behave like a slow TSO server
+                if (_injectedDelayGate.is_closed())
+                {
+                    return;
+                }
+                (void) seastar::with_gate(_injectedDelayGate, [this, request=std::move(request), batchSize, clientID] () mutable
+                {
+                    return seastar::sleep(_injectedDelay())
+                        .then([this, request=std::move(request), batchSize, clientID] () mutable
+                        {
+                            // once stopped, drop the request. The client retries it with another worker
+                            if (!_injectedDelayGate.is_closed())
+                            {
+                                HandleTimestampBatchRequest(std::move(request), batchSize, clientID);
+                            }
+                        });
+                });
+                return;
+            }
+            HandleTimestampBatchRequest(std::move(request), batchSize, clientID);
         }
         else
         {
@@ -74,6 +107,132 @@ void TSOService::TSOWorker::RegisterGetTSOTimestampBatch()
     });
 }
 
+void TSOService::TSOWorker::HandleTimestampBatchRequest(k2::Request&& request, uint16_t batchSize, uint64_t clientID)
+{
+    // requests parked before this one go first
+    if (_parkedRequests.empty())
+    {
+        try
+        {
+            TimestampBatch timestampBatch;
+            if (GetTimestampFromTSO(batchSize, timestampBatch))
+            {
+                ReplyTimestampBatch(request, batchSize, clientID, timestampBatch);
+                return;
+            }
+        }
+        catch (std::exception& exc)
+        {
+            ReplyNoTimestampBatch(request, exc);
+            return;
+        }
+    }
+
+    // we can't issue timestamps right now. Rather than spin until we can, park the request and serve the others
+    _parkedRequests.push_back(ParkedRequest{std::move(request), batchSize, clientID, now_nsec_count()});
+    _stats.ParkedCount++;
+    if (!_parkedTimer.armed())
+    {
+        _parkedTimer.arm(TimePoint(std::chrono::nanoseconds(_nextIssueNanoSec)));
+    }
+}
+
+void TSOService::TSOWorker::ServeParkedRequests()
+{
+    while (!_parkedRequests.empty())
+    {
+        auto& parked = _parkedRequests.front();
+        try
+        {
+            TimestampBatch timestampBatch;
+            if (!GetTimestampFromTSO(parked.batchSize, timestampBatch))
+            {
+                break;
+            }
+            ReplyTimestampBatch(parked.request, parked.batchSize, parked.clientID, timestampBatch);
+        }
+        catch (std::exception& exc)
+        {
+            ReplyNoTimestampBatch(parked.request, exc);
+        }
+        _stats.ParkedNanoSec += now_nsec_count() - parked.parkedNanoSec;
+        _parkedRequests.pop_front();
+    }
+
+    if (!_parkedRequests.empty())
+    {
+        _parkedTimer.arm(TimePoint(std::chrono::nanoseconds(_nextIssueNanoSec)));
+    }
+}
+
+void TSOService::TSOWorker::ReplyTimestampBatch(k2::Request& request, uint16_t batchSize, uint64_t clientID, const TimestampBatch& timestampBatch)
+{
+    auto response = request.endpoint.newPayload();
+    //K2INFO("time stamp batch returned is: " << timestampBatch);
+    response->write(timestampBatch);
+    // the batch size hint for the next request follows the batch. Clients which don't know about it don't read it
+    response->write(SuggestBatchSize(clientID, batchSize));
+    k2::RPC().sendReply(std::move(response), request);
+
+    _stats.BatchCount++;
+    _stats.TimestampCount += timestampBatch.TSCount;
+}
+
+void TSOService::TSOWorker::ReplyNoTimestampBatch(k2::Request& request, const std::exception& exc)
+{
+    // e.g. the worker is not ready(any more). The client takes an empty reply as a failure of this worker
+    // and moves on to another one, rather than wait for its request to time out
+    K2WARN("Unable to issue timestamp batch: " << exc.what());
+    k2::RPC().sendReply(request.endpoint.newPayload(), request);
+}
+
+uint16_t TSOService::TSOWorker::SuggestBatchSize(uint64_t clientID, uint16_t batchSizeRequested)
+{
+    // forget all clients once we know too many. The active ones are back with their next request
+    if (_clients.size() >= _maxTrackedClients())
+    {
+        K2WARN("Tracking too many clients(" << _clients.size() << "), starting over");
+        _clients.clear();
+    }
+
+    uint64_t now = now_nsec_count();
+    auto& info = _clients[clientID];
+    if (info.LastRequestNanoSec == 0)
+    {
+        // first request, nothing to go on yet
+        info.LastRequestNanoSec = now;
+        info.AvgBatchSize = batchSizeRequested;
+        return batchSizeRequested;
+    }
+    double gap = now - info.LastRequestNanoSec;
+    info.LastRequestNanoSec = now;
+    info.AvgGapNanoSec = info.AvgGapNanoSec == 0 ? gap : info.AvgGapNanoSec + (gap - info.AvgGapNanoSec) / 8;
+    info.AvgBatchSize += (batchSizeRequested - info.AvgBatchSize) / 8;
+
+    if (info.AvgGapNanoSec <= 0 || _curControlInfo.BatchTTL == 0 || _curControlInfo.TBENanoSecStep == 0)
+    {
+        return batchSizeRequested;
+    }
+    // the timestamps the client goes through within the TTL of a batch. More than that would expire unused,
+    // unless the controller asks for larger batches to bring the request rate down
+    double needed = info.AvgBatchSize / info.AvgGapNanoSec * _curControlInfo.BatchTTL * _curControlInfo.BatchSizeMultiplier;
+    double maxBatchSize = std::min(1000 / _curControlInfo.TBENanoSecStep, (int) std::numeric_limits<uint8_t>::max());
+    return (uint16_t) std::clamp(std::ceil(needed), 1.0, maxBatchSize);
+}
+
+TSOService::TSOWorkerStatistics TSOService::TSOWorker::CollectStatistics()
+{
+    uint64_t now = now_nsec_count();
+    TSOWorkerStatistics result = _stats;
+    result.DurationNanoSec = now - _statsStartNanoSec;
+    result.ClientCount = _clients.size();
+    result.TimestampsPerMicroSec = _curControlInfo.TBENanoSecStep ? 1000 / _curControlInfo.TBENanoSecStep : 0;
+
+    _stats = TSOWorkerStatistics{};
+    _statsStartNanoSec = now;
+    return result;
+}
+
 void TSOService::TSOWorker::UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo)
 {
     if (_curControlInfo.IsReadyToIssueTS && controlInfo.IsReadyToIssueTS)
@@ -164,11 +323,8 @@ void TSOService::TSOWorker::AdjustWorker(const TSOWorkerControlInfo& controlInfo
                 K2WARN("TSOWorkerControlInfo change trigger long sleep. Worker core:" << seastar::engine().cpu_id() << " going to sleep "<< sleepNanoSecCount << " nanosec.");
             }
 
-            // busy sleep
-            while ((curTBEMicroSecRounded - timeToPauseWorkerNanoSec) < _lastRequestTBEMicroSecRounded) 
-            {
-                curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
-            }
+            // don't issue until then, in local steady clock time with the TBEAdjustment before this change. Requests in the meantime get parked
+            _pausedUntilNanoSec = _lastRequestTBEMicroSecRounded + timeToPauseWorkerNanoSec - _curControlInfo.TBEAdjustment;
         }
     }
 
@@ -178,23 +334,23 @@ void TSOService::TSOWorker::AdjustWorker(const TSOWorkerControlInfo& controlInfo
 }
 
 // API issuing Timestamp to the TSO client
-TimestampBatch TSOService::TSOWorker::GetTimestampFromTSO(uint16_t batchSizeRequested)
+bool TSOService::TSOWorker::GetTimestampFromTSO(uint16_t batchSizeRequested, TimestampBatch& result)
 {
-    TimestampBatch result;
-
     //K2INFO("Start getting a timestamp batch");
 
     // this function is on hotpath, code organized to optimized the most common happy case for efficiency
     // In most of time, it is happy path, where current TBE(Timestamp Batch End) time at microsecond level(curTBEMicroSecRounded) is greater than last call's Timebatch end time
     // i.e. each worker core has one call or less per microsecond
     // In such case, simply issue timebatch associated with curTBEMicroSecRounded, timestamp counts up to either batchSizeRequested or max allowed from 1 microsec
-    uint64_t curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
+    uint64_t nowNanoSec = now_nsec_count();
+    uint64_t curTBEMicroSecRounded = (nowNanoSec +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
     //K2INFO("Start getting a timestamp batch, got current time.");
 
     // most straightward happy case, fast path
     if (_curControlInfo.IsReadyToIssueTS &&
         curTBEMicroSecRounded + 1000 < _curControlInfo.ReservedTimeShreshold &&
-        curTBEMicroSecRounded > _lastRequestTBEMicroSecRounded) 
+        curTBEMicroSecRounded > _lastRequestTBEMicroSecRounded &&
+        nowNanoSec >= _pausedUntilNanoSec) 
     {
         uint16_t batchSizeToIssue = std::min(batchSizeRequested, (uint16_t)(1000/_curControlInfo.TBENanoSecStep));
 
@@ -214,17 +370,15 @@ TimestampBatch TSOService::TSOWorker::GetTimestampFromTSO(uint16_t batchSizeRequ
         _lastRequestTBEMicroSecRounded = curTBEMicroSecRounded;
         _lastRequestTimeStampCount = batchSizeToIssue;
 
-        // TODO: accumulate statistics
-
-        return result;
+        return true;
     }
 
     // otherwise, handle less frequent situation
-    return GetTimeStampFromTSOLessFrequentHelper(batchSizeRequested, curTBEMicroSecRounded);
+    return GetTimeStampFromTSOLessFrequentHelper(batchSizeRequested, curTBEMicroSecRounded, nowNanoSec, result);
 }
 
 // helper function to issue timestamp (or check error situation)
-TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t curTBEMicroSecRounded) 
+bool TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t curTBEMicroSecRounded, uint64_t nowNanoSec, TimestampBatch& result) 
 {
     K2INFO("getting a timestamp batch in helper");
     // step 1/4 sanity check, check IsReadyToIssueTS and possible issued timestamp is within ReservedTimeShreshold
@@ -236,6 +390,13 @@ TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint
         throw TSONotReadyException();
     }
 
+    // paused by a control info change, see AdjustWorker()
+    if (nowNanoSec < _pausedUntilNanoSec)
+    {
+        _nextIssueNanoSec = _pausedUntilNanoSec;
+        return false;
+    }
+
     // step 2/4 this is case when we try to issue timestamp batch beyond ReservedTimeShreshold (indicating it is not refreshed), this is really a bug and need to root cause.
     if (curTBEMicroSecRounded + 1000 > _curControlInfo.ReservedTimeShreshold)
     {
@@ -256,25 +417,18 @@ TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint
     }
 
     // step 4/4 handle the case curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded
-    // If leftover timestamp of this microSec is sufficient, issue them out, otherwise, busy wait to next microsec and issue timestamp.
+    // Issue what is left of this microSec, up to the requested size. If nothing is left, the caller has to come back on the next microsec.
     K2ASSERT(curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded, "last and this requests are in same microsecond!");
     uint16_t leftoverTS = 1000 / _curControlInfo.TBENanoSecStep - _lastRequestTimeStampCount;
 
-    if (leftoverTS < batchSizeRequested)
+    if (leftoverTS == 0)
     {
-        // not enough timestamp at current microsecond to issue out,
-        // busy wait out and go through normal code path to issue timestamp on next microsecond
-        while (curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded)
-        {
-            curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
-        }
-
-        return GetTimestampFromTSO(batchSizeRequested);
+        _nextIssueNanoSec = _lastRequestTBEMicroSecRounded + 1000 - _curControlInfo.TBEAdjustment;
+        return false;
     }
+    // the batch size may be partially fulfilled, the client asks again for the rest
+    batchSizeRequested = std::min(batchSizeRequested, leftoverTS);
 
-    K2ASSERT(curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded, "last and this requests are in same microsecond!");
-
-    TimestampBatch result;
     result.TBEBase = curTBEMicroSecRounded + seastar::engine().cpu_id() - 1 + _lastRequestTimeStampCount * _curControlInfo.TBENanoSecStep;
     result.TSOId = _tsoId;
     result.TsDelta = _curControlInfo.TsDelta;
@@ -285,7 +439,7 @@ TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint
     //_lastRequestTBEMicroSecRounded = curTBEMicroSecRounded;   // they are same, no need to set.
     _lastRequestTimeStampCount += batchSizeRequested; // we've just issued batchSizeRequested
 
-    return result;
+    return true;
 }
 
 }
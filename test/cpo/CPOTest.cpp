@@ -55,6 +55,7 @@ seastar::future<> CPOTest::start() {
         .then([this] { return runTest3(); })
         .then([this] { return runTest4(); })
         .then([this] { return runTest5(); })
+        .then([this] { return runTest6(); })
         .then([this] {
             K2INFO("======= All tests passed ========");
             exitcode = 0;
@@ -226,3 +227,47 @@ seastar::future<> CPOTest::runTest5() {
             }
         });
 }
+
+seastar::future<> CPOTest::runTest6() {
+    K2INFO(">>> Test6: get a collection while it is being assigned");
+
+    auto request = dto::CollectionCreateRequest{
+        .metadata{
+            .name = "collectionWait",
+            .hashScheme=dto::HashScheme::HashCRC32C,
+            .storageDriver=dto::StorageDriver::K23SI,
+            .capacity{
+                .dataCapacityMegaBytes = 1000,
+                .readIOPs = 100000,
+                .writeIOPs = 100000
+            },
+            .retentionPeriod = 5h
+        },
+        .clusterEndpoints = _k2ConfigEps(),
+        .rangeEnds{}
+    };
+    return RPC()
+        .callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>(dto::Verbs::CPO_COLLECTION_CREATE, request, *_cpoEndpoint, 1s)
+        .then([](auto&& response) {
+            // create the collection
+            auto& [status, resp] = response;
+            K2EXPECT(status, Statuses::S201_Created);
+        })
+        .then([this] {
+            // the CPO holds the get until all the assignments are done
+            auto request = dto::CollectionGetRequest{.name = "collectionWait", .waitForAssignment = true};
+            return RPC()
+                .callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>(dto::Verbs::CPO_COLLECTION_GET, request, *_cpoEndpoint, 1s);
+        })
+        .then([this](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(status, Statuses::S200_OK);
+            K2EXPECT(resp.collection.metadata.name, "collectionWait");
+            K2EXPECT(resp.collection.partitionMap.partitions.size(), _k2ConfigEps().size());
+
+            // the nodes already host collectionAssign from test5, so they refuse these assignments
+            for (auto& p: resp.collection.partitionMap.partitions) {
+                K2EXPECT(p.astate, dto::AssignmentState::PendingAssignment);
+            }
+        });
+}
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Benchmark of collection creation in the CPO, for collections of 10, 100 and 1000 partitions.
+# cpobench accepts the partition assignments itself, on all of its 8 cores, so no nodepool is needed.
+# Add --assignment_parallelism 1 to the CPO to compare with assigning one partition at a time
+topname=$(dirname "$0")
+cd ${topname}/../..
+set -e
+CPODIR=/tmp/___cpo_bench
+rm -rf ${CPODIR}
+CPO=tcp+k2rpc://0.0.0.0:9000
+EPS="tcp+k2rpc://0.0.0.0:10000 tcp+k2rpc://0.0.0.0:10001 tcp+k2rpc://0.0.0.0:10002 tcp+k2rpc://0.0.0.0:10003 tcp+k2rpc://0.0.0.0:10004 tcp+k2rpc://0.0.0.0:10005 tcp+k2rpc://0.0.0.0:10006 tcp+k2rpc://0.0.0.0:10007"
+
+# start CPO on 1 core
+./build/src/k2/cmd/controlPlaneOracle/cpo_main -c1 --tcp_endpoints ${CPO} --data_dir ${CPODIR} --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63000 &
+cpo_child_pid=$!
+
+function finish {
+  # cleanup code
+  rm -rf ${CPODIR}
+
+  kill ${cpo_child_pid}
+  echo "Waiting for cpo child pid: ${cpo_child_pid}"
+  wait ${cpo_child_pid}
+}
+trap finish EXIT
+
+sleep 2
+
+./build/src/k2/cmd/txbench/cpobench -c8 --tcp_endpoints ${EPS} --cpo ${CPO} --partition_counts 10 100 1000 --rounds 3 --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Benchmark of the TSO client with two TSO servers, one of which replies 5ms late.
+# Compare the latency reported by tsobench with --tso_hedge_percentile 0 and with the default.
+# Then with a TSO server which never replies in time, and without hedging, so that every batch request
+# sent to it times out and has to fail over. tsobench should report no failed timestamps
+topname=$(dirname "$0")
+cd ${topname}/../..
+set -e
+TSO_FAST=tcp+k2rpc://0.0.0.0:13000
+TSO_SLOW=tcp+k2rpc://0.0.0.0:14000
+
+# start the fast tso on 2 cores
+./build/src/k2/cmd/tso/tso -c2 --tcp_endpoints ${TSO_FAST} 13001 --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63003 &
+tso_fast_child_pid=$!
+
+# start the slow tso on 2 cores
+./build/src/k2/cmd/tso/tso -c2 --tcp_endpoints ${TSO_SLOW} 14001 --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63004 --tso_inject_delay 5ms &
+tso_slow_child_pid=$!
+
+# start the tso which times out on 2 cores. Its delay is longer than any batch request timeout of the client
+TSO_TIMEOUT=tcp+k2rpc://0.0.0.0:15000
+./build/src/k2/cmd/tso/tso -c2 --tcp_endpoints ${TSO_TIMEOUT} 15001 --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63005 --tso_inject_delay 1s &
+tso_timeout_child_pid=$!
+
+function finish {
+  # cleanup code
+  kill ${tso_fast_child_pid}
+  echo "Waiting for tso child pid: ${tso_fast_child_pid}"
+  wait ${tso_fast_child_pid}
+
+  kill ${tso_slow_child_pid}
+  echo "Waiting for tso child pid: ${tso_slow_child_pid}"
+  wait ${tso_slow_child_pid}
+
+  kill ${tso_timeout_child_pid}
+  echo "Waiting for tso child pid: ${tso_timeout_child_pid}"
+  wait ${tso_timeout_child_pid}
+}
+trap finish EXIT
+
+sleep 2
+
+./build/src/k2/cmd/txbench/tsobench -c1 --tso_endpoint ${TSO_SLOW} --tso_endpoints ${TSO_FAST} --pipeline_depth 8 --test_duration 10s --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100 "$@"
+
+echo "One TSO server times out"
+./build/src/k2/cmd/txbench/tsobench -c1 --tso_endpoint ${TSO_TIMEOUT} --tso_endpoints ${TSO_FAST} --tso_hedge_percentile 0 --pipeline_depth 8 --test_duration 10s --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
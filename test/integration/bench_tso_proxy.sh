@@ -0,0 +1,28 @@
+#!/bin/bash
+# Benchmark of the TSO client on 8 cores, with each core getting its own batches, and with one core per node
+# getting them for all the others. Compare the rate and latency reported by tsobench, and the batch requests
+# the server gets (tso_client_batch_requests on the clients)
+topname=$(dirname "$0")
+cd ${topname}/../..
+set -e
+TSO=tcp+k2rpc://0.0.0.0:13000
+
+# start tso on 2 cores
+./build/src/k2/cmd/tso/tso -c2 --tcp_endpoints ${TSO} 13001 --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63003 &
+tso_child_pid=$!
+
+function finish {
+  # cleanup code
+  kill ${tso_child_pid}
+  echo "Waiting for tso child pid: ${tso_child_pid}"
+  wait ${tso_child_pid}
+}
+trap finish EXIT
+
+sleep 2
+
+echo "Each core gets its own batches"
+./build/src/k2/cmd/txbench/tsobench -c8 --tso_endpoint ${TSO} --pipeline_depth 8 --test_duration 10s --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
+
+echo "Core 0 gets the batches for all cores"
+./build/src/k2/cmd/txbench/tsobench -c8 --tso_endpoint ${TSO} --tso_proxy_group_size 8 --pipeline_depth 8 --test_duration 10s --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
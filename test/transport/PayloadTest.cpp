@@ -26,6 +26,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/Payload.h>
 #include <k2/common/Common.h>
 #include <k2/transport/PayloadSerialization.h>
+#include <k2/transport/PayloadPool.h>
+#include <k2/transport/Status.h>
+#include <k2/transport/RPCParser.h>
 // catch
 #include "catch2/catch.hpp"
 using namespace k2;
@@ -276,6 +279,296 @@ SCENARIO("test empty payload serialization after some data") {
         REQUIRE(dst2.copy() == dst2);
     }
 }
+SCENARIO("string views into payload") {
+    // small buffers so that some strings span buffer boundaries
+    Payload payload([] { return Binary(16); });
+    String shortStr("abc"), longStr("a string which is longer than one buffer");
+    payload.write(shortStr);
+    payload.write(longStr);
+    payload.write(std::string_view("view"));
+    payload.seek(0);
+
+    std::string_view v1, v2;
+    String s3;
+    REQUIRE(payload.read(v1));
+    REQUIRE(payload.read(v2));
+    REQUIRE(payload.read(s3));
+    REQUIRE(v1 == std::string_view(shortStr.data(), shortStr.size()));
+    REQUIRE(v2 == std::string_view(longStr.data(), longStr.size()));
+    REQUIRE(s3 == "view");
+    REQUIRE(!payload.read(v1));
+}
+
+SCENARIO("compact encoding round trip") {
+    // small buffers so that some varints span buffer boundaries
+    auto d1 = makeData(3, 1ull << 40, 'x', -7, 'y', 5, "za", -300, 'z', "payload data", "d", 16, -15ms);
+    Payload fixed([] { return Binary(7); });
+    Payload compact([] { return Binary(7); });
+    compact.setCompactEncoding(true);
+    fixed.write(d1);
+    compact.write(d1);
+    compact.writeDelta(1000000);
+    compact.writeDelta(999990);
+    REQUIRE(compact.getSize() < fixed.getSize());
+
+    compact.seek(0);
+    data<embeddedComplex> d2;
+    uint64_t t1 = 0, t2 = 0;
+    REQUIRE(compact.read(d2));
+    REQUIRE(compact.readDelta(t1));
+    REQUIRE(compact.readDelta(t2));
+    REQUIRE(d1 == d2);
+    REQUIRE(t1 == 1000000);
+    REQUIRE(t2 == 999990);
+    REQUIRE(compact.getDataRemaining() == 0);
+
+    // values which don't fit in the target type are rejected
+    Payload tooBig([] { return Binary(16); });
+    tooBig.setCompactEncoding(true);
+    tooBig.write(uint32_t(70000));
+    tooBig.seek(0);
+    uint16_t small = 0;
+    REQUIRE(!tooBig.read(small));
+}
+
+SCENARIO("compact encoding of nested payloads") {
+    // a value written as SerializeAsPayload<T> reads back as SerializeAsPayload<Payload> and then as T, and the other way
+    embeddedComplex v1{.a = "a string longer than a buffer", .b = -300, .c = 'z'};
+    Payload typed([] { return Binary(7); });
+    typed.setCompactEncoding(true);
+    typed.writeDelta(1000000);
+    typed.write(SerializeAsPayload<embeddedComplex>{v1});
+    typed.writeDelta(999990);
+
+    typed.seek(0);
+    uint64_t t1 = 0, t2 = 0;
+    SerializeAsPayload<Payload> nested;
+    REQUIRE(typed.readDelta(t1));
+    REQUIRE(typed.read(nested));
+    REQUIRE(typed.readDelta(t2));
+    REQUIRE(t1 == 1000000);
+    REQUIRE(t2 == 999990);
+    REQUIRE(typed.getDataRemaining() == 0);
+    REQUIRE(nested.val.isCompactEncoding());
+
+    Payload generic([] { return Binary(7); });
+    generic.setCompactEncoding(true);
+    generic.writeDelta(1000000);
+    generic.write(nested);
+    generic.writeDelta(999990);
+    REQUIRE(generic.getSize() == typed.getSize());
+
+    embeddedComplex v2;
+    REQUIRE(nested.val.read(v2));
+    REQUIRE(v1 == v2);
+
+    generic.seek(0);
+    SerializeAsPayload<embeddedComplex> v3;
+    t1 = t2 = 0;
+    REQUIRE(generic.readDelta(t1));
+    REQUIRE(generic.read(v3));
+    REQUIRE(generic.readDelta(t2));
+    REQUIRE(v1 == v3.val);
+    REQUIRE(t1 == 1000000);
+    REQUIRE(t2 == 999990);
+    REQUIRE(generic.getDataRemaining() == 0);
+}
+
+SCENARIO("payload pool reuses buffers and payloads") {
+    auto& pool = PayloadPool::local();
+    auto before = pool.getStats();
+    for (int i = 0; i < 10; ++i) {
+        auto payload = std::make_unique<Payload>(PayloadPool::makeAllocator(1446));
+        payload->write(String(3000, 'p'));
+        // shared buffers go back to the pool only once the last reference is gone
+        auto shared = payload->share();
+        payload.reset();
+        shared.seek(0);
+        String result;
+        REQUIRE(shared.read(result));
+        REQUIRE(result.size() == 3000);
+    }
+    auto after = pool.getStats();
+    // the first iteration allocates 3 buffers and a payload. The rest reuse them
+    REQUIRE(after.bufferAllocs - before.bufferAllocs <= 3);
+    REQUIRE(after.bufferReuses - before.bufferReuses >= 27);
+    REQUIRE(after.payloadAllocs - before.payloadAllocs <= 1);
+
+    // buffers are exactly the requested size, whatever their size class
+    auto small = pool.getBuffer(100);
+    REQUIRE(small.size() == 100);
+}
+
+SCENARIO("status wire encoding") {
+    size_t fixedWritten = 0;
+    for (bool compact : {false, true}) {
+        Payload payload([] { return Binary(64); });
+        payload.setCompactEncoding(compact);
+        payload.write(Statuses::S200_OK("read succeeded"));
+        payload.write(Statuses::S409_Conflict("incumbent txn won"));
+        payload.write(Status{.code = 999, .message = ""});
+        auto written = payload.getSize();
+        payload.seek(0);
+
+        Status ok, conflict, custom;
+        REQUIRE(payload.read(ok));
+        REQUIRE(payload.read(conflict));
+        REQUIRE(payload.read(custom));
+        REQUIRE(payload.getDataRemaining() == 0);
+
+        REQUIRE(ok.code == 200);
+#if K2_DEBUG_LOGGING == 0
+        REQUIRE(ok.message == "");
+        if (compact) {
+            // varint codes with a flag bit for the message
+            REQUIRE(written < fixedWritten);
+        }
+        else {
+            fixedWritten = written;
+            // the original int code + string message which peers without the compact encoding expect
+            REQUIRE(Payload::serializedSize(ok) == sizeof(int) + Payload::serializedSize(String()));
+            REQUIRE(written == Payload::serializedSize(ok) + Payload::serializedSize(conflict) +
+                               Payload::serializedSize(custom));
+        }
+#endif
+        REQUIRE(conflict.code == 409);
+        REQUIRE(conflict.message == "incumbent txn won");
+        REQUIRE(String(conflict.getDescription()) == "Conflict");
+        REQUIRE(custom.code == 999);
+        REQUIRE(!Status::isKnownCode(custom.code));
+        REQUIRE(String(custom.getDescription()) == "Unknown");
+    }
+}
+
+SCENARIO("rpc compression round trip") {
+    auto makePayload = [](size_t size) {
+        auto payload = std::make_unique<Payload>([] { return Binary(8096); });
+        payload->skip(txconstants::MAX_HEADER_SIZE);
+        for (size_t i = 0; i < size; ++i) {
+            payload->write(char('a' + (i / 100) % 3));
+        }
+        return payload;
+    };
+    auto feed = [](RPCParser& parser, std::vector<Binary> buffers) {
+        size_t wireBytes = 0;
+        for (auto& buf : buffers) {
+            wireBytes += buf.size();
+            parser.feed(std::move(buf));
+            parser.dispatchSome();
+        }
+        return wireBytes;
+    };
+
+    RPCParser sender([] { return false; }, true, 1024);
+    RPCParser receiver([] { return false; }, true, 1024);
+    std::unique_ptr<Payload> received;
+    MessageMetadata receivedMeta;
+    receiver.registerMessageObserver([&](Verb, MessageMetadata meta, std::unique_ptr<Payload> payload) {
+        receivedMeta = meta;
+        received = std::move(payload);
+    });
+    sender.registerMessageObserver([](Verb, MessageMetadata, std::unique_ptr<Payload>) {});
+
+    const size_t size = 20000;
+    // the sender doesn't know yet that the receiver can decompress
+    auto wire = feed(receiver, sender.prepareForSend(1, makePayload(size), MessageMetadata()));
+    REQUIRE(wire > size);
+    REQUIRE(!receivedMeta.isCompressedSet());
+    REQUIRE(received->getSize() == size);
+
+    // any message from the receiver advertises its support for compression
+    feed(sender, receiver.prepareForSend(1, makePayload(10), MessageMetadata()));
+
+    wire = feed(receiver, sender.prepareForSend(1, makePayload(size), MessageMetadata()));
+    REQUIRE(wire < size / 10);
+    REQUIRE(receivedMeta.isCompressedSet());
+    REQUIRE(received->getSize() == size);
+    String expected(size, '\0'), actual(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        expected[i] = char('a' + (i / 100) % 3);
+    }
+    received->seek(0);
+    REQUIRE(received->read(actual.data(), size));
+    REQUIRE(actual == expected);
+    REQUIRE(sender.getCompressionStats().compressedMessages == 1);
+    REQUIRE(receiver.getCompressionStats().decompressedMessages == 1);
+
+    // small payloads are never compressed
+    feed(receiver, sender.prepareForSend(1, makePayload(100), MessageMetadata()));
+    REQUIRE(!receivedMeta.isCompressedSet());
+    REQUIRE(received->getSize() == 100);
+}
+
+SCENARIO("rpc parsing of whole and split messages") {
+    auto makePayload = [](size_t size, char fill) {
+        auto payload = std::make_unique<Payload>([] { return Binary(8096); });
+        payload->skip(txconstants::MAX_HEADER_SIZE);
+        for (size_t i = 0; i < size; ++i) {
+            payload->write(fill);
+        }
+        return payload;
+    };
+    // put all the buffers of a message into one contiguous binary
+    auto flatten = [](std::vector<Binary> buffers) {
+        String data;
+        for (auto& buf : buffers) {
+            data.append(buf.get(), buf.size());
+        }
+        return data;
+    };
+
+    RPCParser sender([] { return false; }, true);
+    RPCParser receiver([] { return false; }, true);
+    std::vector<std::pair<Verb, String>> received;
+    receiver.registerMessageObserver([&](Verb verb, MessageMetadata, std::unique_ptr<Payload> payload) {
+        // messages without data don't have a payload
+        String data(payload ? payload->getSize() : 0, '\0');
+        if (payload) {
+            payload->seek(0);
+            payload->read(data.data(), data.size());
+        }
+        received.emplace_back(verb, std::move(data));
+    });
+    bool failed = false;
+    receiver.registerParserFailureObserver([&](std::exception_ptr) { failed = true; });
+
+    String stream;
+    stream += flatten(sender.prepareForSend(1, makePayload(10, 'a'), MessageMetadata()));
+    stream += flatten(sender.prepareForSend(2, makePayload(0, 'b'), MessageMetadata()));
+    stream += flatten(sender.prepareForSend(3, makePayload(3000, 'c'), MessageMetadata()));
+
+    // feed all messages at once, and then again split in the middle of the last payload
+    for (size_t split : {stream.size(), stream.size() - 100}) {
+        received.clear();
+        Binary first(stream.data(), split);
+        receiver.feed(std::move(first));
+        while (receiver.canDispatch()) {
+            receiver.dispatchSome();
+        }
+        if (split < stream.size()) {
+            REQUIRE(received.size() == 2);
+            Binary second(stream.data() + split, stream.size() - split);
+            receiver.feed(std::move(second));
+            while (receiver.canDispatch()) {
+                receiver.dispatchSome();
+            }
+        }
+        REQUIRE(!failed);
+        REQUIRE(received.size() == 3);
+        REQUIRE(received[0] == std::make_pair(Verb(1), String(10, 'a')));
+        REQUIRE(received[1] == std::make_pair(Verb(2), String()));
+        REQUIRE(received[2] == std::make_pair(Verb(3), String(3000, 'c')));
+    }
+
+    // a corrupted payload fails the checksum validation
+    stream[stream.size() - 1] = 'x';
+    receiver.feed(Binary(stream.data(), stream.size()));
+    while (receiver.canDispatch()) {
+        receiver.dispatchSome();
+    }
+    REQUIRE(failed);
+}
+
 /*
 SCENARIO("rpc parsing") {
     RPCParser([] { return false; }, false) parseNoCRC;
@@ -0,0 +1,109 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// RPCParser throughput microbenchmark.
+// Usage: rpcparser_bench [iterations]
+// A stream of messages is cut into segments, as they would arrive from the network, and fed to a parser. For each
+// message size, segment size and checksum setting it reports the average time to parse a message and the throughput.
+// With segments larger than the messages, most messages are dispatched straight out of the received segment.
+
+// stl
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+// k2
+#include <k2/common/Chrono.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/RPCHeader.h>
+#include <k2/transport/RPCParser.h>
+
+using namespace k2;
+
+// how many messages we put in the stream we parse in each iteration
+static const size_t messagesPerStream = 100;
+
+// build a stream of messages with the given payload size
+static String makeStream(RPCParser& sender, size_t messageSize) {
+    String stream;
+    for (size_t i = 0; i < messagesPerStream; ++i) {
+        auto payload = std::make_unique<Payload>([] { return Binary(8192); });
+        payload->skip(txconstants::MAX_HEADER_SIZE);
+        for (size_t j = 0; j < messageSize; ++j) {
+            payload->write(char('a' + j % 26));
+        }
+        MessageMetadata meta;
+        meta.setRequestID(uint32_t(i + 1));
+        for (auto& buf : sender.prepareForSend(1, std::move(payload), std::move(meta))) {
+            stream.append(buf.get(), buf.size());
+        }
+    }
+    return stream;
+}
+
+static void bench(size_t messageSize, size_t segmentSize, bool checksum, size_t iterations) {
+    RPCParser sender([] { return false; }, checksum);
+    RPCParser receiver([] { return false; }, checksum);
+    size_t received = 0;
+    receiver.registerMessageObserver([&received](Verb, MessageMetadata, std::unique_ptr<Payload>) { received++; });
+    bool failed = false;
+    receiver.registerParserFailureObserver([&failed](std::exception_ptr) { failed = true; });
+
+    auto stream = makeStream(sender, messageSize);
+    Binary wire(stream.data(), stream.size());
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations && !failed; ++i) {
+        for (size_t offset = 0; offset < wire.size(); offset += segmentSize) {
+            receiver.feed(wire.share(offset, std::min(segmentSize, wire.size() - offset)));
+            while (receiver.canDispatch()) {
+                receiver.dispatchSome();
+            }
+        }
+    }
+    auto elapsed = Clock::now() - start;
+    auto nanos = std::max<uint64_t>(1, nsec(elapsed).count());
+    std::cout << "message=" << std::left << std::setw(6) << messageSize
+              << " segment=" << std::setw(6) << segmentSize
+              << (checksum ? " crc   " : " no-crc")
+              << " parse=" << std::setw(8) << nanos / std::max<size_t>(1, received) << "ns/msg"
+              << " rate=" << std::setw(10) << uint64_t(received * 1e9 / nanos) << "msgs/s"
+              << " throughput=" << std::setw(8) << uint64_t(iterations * wire.size() * 1e3 / nanos) << "MB/s"
+              << (failed || received != iterations * messagesPerStream ? " PARSE FAILED" : "") << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000;
+    if (iterations == 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+    for (size_t messageSize : {0, 64, 512, 4096}) {
+        // typical TCP read size, and a single ethernet frame worth of data
+        for (size_t segmentSize : {8192, 1448}) {
+            bench(messageSize, segmentSize, false, iterations);
+            bench(messageSize, segmentSize, true, iterations);
+        }
+    }
+    return 0;
+}